@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench_common.h"
+
+extern "C" {
+char* darwin_setlocale(int category, const char* locale);
+int darwin_strcoll(const char* s1, const char* s2);
+int darwin_wcscoll(const wchar_t* s1, const wchar_t* s2);
+}
+
+static constexpr int DARWIN_LC_ALL = 0;
+
+struct BenchOptions {
+    uint32_t iterations = 10;
+    std::size_t count = 100000; // strings per sort
+    const char* locale = "C.UTF-8";
+};
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions ret;
+    bench_parse_args(argc, argv, {
+            bench_arg("--iterations", ret.iterations, 1),
+            bench_arg("--count", ret.count, 2),
+            bench_arg("--locale", ret.locale),
+    });
+    return ret;
+}
+
+// Path like strings, so that comparisons have to get past a shared prefix
+static std::vector<std::string> generate_strings(std::size_t count) {
+    static const char* const prefixes[] = {"/usr/lib/", "/usr/local/share/", "/System/Library/Frameworks/", "/tmp/"};
+    std::mt19937 rng (1);
+    std::vector<std::string> ret;
+    for (std::size_t i = 0; i < count; i++) {
+        std::string s = prefixes[rng() % std::size(prefixes)];
+        auto length = 4 + rng() % 24;
+        for (std::size_t j = 0; j < length; j++)
+            s += (char) ('a' + rng() % 26);
+        ret.push_back(std::move(s));
+    }
+    return ret;
+}
+
+template <typename T, typename Compare>
+static double time_sort(std::vector<T> const& input, Compare compare, uint32_t iterations) {
+    return bench_median_of(iterations, [&] {
+        auto data = input;
+        auto start = std::chrono::steady_clock::now();
+        std::sort(data.begin(), data.end(), [&](T const& a, T const& b) { return compare(a, b) < 0; });
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    });
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+    // Both the host functions and the shims look at the same global locale
+    if (!darwin_setlocale(DARWIN_LC_ALL, options.locale)) {
+        fprintf(stderr, "locale %s is not available\n", options.locale);
+        return 1;
+    }
+
+    auto strings = generate_strings(options.count);
+    std::vector<const char*> narrow;
+    std::vector<std::wstring> wideStorage;
+    std::vector<const wchar_t*> wide;
+    for (auto const& s : strings) {
+        narrow.push_back(s.c_str());
+        wideStorage.emplace_back(s.begin(), s.end());
+    }
+    for (auto const& s : wideStorage)
+        wide.push_back(s.c_str());
+
+    printf("%-10s %12s %12s   (median ms to sort %zu strings, %s)\n", "function", "host", "shim", options.count, options.locale);
+    printf("%-10s %12.2f %12.2f\n", "strcoll",
+           time_sort(narrow, [](const char* a, const char* b) { return strcoll(a, b); }, options.iterations),
+           time_sort(narrow, [](const char* a, const char* b) { return darwin_strcoll(a, b); }, options.iterations));
+    printf("%-10s %12.2f %12.2f\n", "wcscoll",
+           time_sort(wide, [](const wchar_t* a, const wchar_t* b) { return wcscoll(a, b); }, options.iterations),
+           time_sort(wide, [](const wchar_t* a, const wchar_t* b) { return darwin_wcscoll(a, b); }, options.iterations));
+    return 0;
+}
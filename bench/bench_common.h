@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Scaffolding shared by the benchmarks: command line options, samples reduced to their median and the header of the
+// result tables. A benchmark only lists its options and the variants it measures.
+
+struct BenchArg {
+    const char* name;
+    const char* valueName; // shown in the usage message
+    std::function<void(const char* value)> set;
+};
+
+// An integer option, raised to minimum when given less
+template <typename T>
+BenchArg bench_arg(const char* name, T& target, unsigned long long minimum = 0) {
+    static_assert(std::is_unsigned_v<T>, "options are counts");
+    return {name, "N", [&target, minimum](const char* value) { target = (T) std::max(std::stoull(value), minimum); }};
+}
+
+inline BenchArg bench_arg(const char* name, const char*& target) {
+    return {name, "NAME", [&target](const char* value) { target = value; }};
+}
+
+// Every option takes a value, anything else prints the usage and exits
+inline void bench_parse_args(int argc, char* argv[], std::initializer_list<BenchArg> args) {
+    for (int i = 1; i < argc; i++) {
+        auto arg = std::find_if(args.begin(), args.end(), [&](BenchArg const& a) { return strcmp(a.name, argv[i]) == 0; });
+        if (arg == args.end() || i + 1 >= argc) {
+            fprintf(stderr, "usage: %s", argv[0]);
+            for (auto const& a : args)
+                fprintf(stderr, " [%s %s]", a.name, a.valueName);
+            fprintf(stderr, "\n");
+            exit(1);
+        }
+        arg->set(argv[++i]);
+    }
+}
+
+template <typename Fn>
+struct BenchVariant {
+    const char* name;
+    Fn run;
+};
+
+// Sorts the samples, so that front() and back() are the extremes, and returns the middle one
+inline double bench_median(std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+template <typename Sample>
+double bench_median_of(uint32_t iterations, Sample sample) {
+    std::vector<double> samples;
+    for (uint32_t i = 0; i < iterations; i++)
+        samples.push_back(sample());
+    return bench_median(samples);
+}
+
+// One column per variant, the rows are labelled by the caller
+template <typename Variants>
+void bench_print_header(const char* rowLabel, Variants const& variants, const char* unit) {
+    printf("%-10s", rowLabel);
+    for (auto const& variant : variants)
+        printf(" %12s", variant.name);
+    printf("   (%s)\n", unit);
+}
@@ -0,0 +1,84 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "converter/converter.h"
+#include "converter/log.h"
+#include "bench_common.h"
+#include "macho_generator.h"
+
+struct BenchOptions {
+    MachOGeneratorOptions generator;
+    uint32_t iterations = 10;
+};
+
+struct Stage {
+    const char* name;
+    void (Converter::*run)();
+    std::vector<double> samples;
+};
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions ret;
+    bench_parse_args(argc, argv, {
+            bench_arg("--functions", ret.generator.functionCount),
+            bench_arg("--rebases", ret.generator.rebaseCount),
+            bench_arg("--bindings", ret.generator.bindingCount),
+            bench_arg("--dylibs", ret.generator.dylibCount),
+            bench_arg("--dwarf-interval", ret.generator.dwarfFunctionInterval),
+            bench_arg("--iterations", ret.iterations, 1),
+    });
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+
+    auto tmpDir = std::filesystem::temp_directory_path();
+    auto inputPath = tmpDir / "macho2elf_bench.dylib";
+    auto outputPath = tmpDir / "macho2elf_bench.so";
+    {
+        auto input = generateMachO(options.generator);
+        std::ofstream fs (inputPath, std::ios::binary);
+        fs.write((const char*) input.data(), input.size());
+        printf("Generated %s (%zu bytes): %u functions, %u rebases, %u bindings, %u dylibs\n", inputPath.c_str(),
+               input.size(), options.generator.functionCount, options.generator.rebaseCount,
+               options.generator.bindingCount, options.generator.dylibCount);
+    }
+
+    Stage stages[] = {
+            {"parse", &Converter::parse},
+            {"sections", &Converter::convertSections},
+            {"dynsym", &Converter::buildDynamicSymbols},
+            {"relocations", &Converter::buildRelocations},
+            {"unwind", &Converter::convertUnwindInfo},
+            {"layout", &Converter::layout},
+            {"save", &Converter::save},
+    };
+
+    Logger::setLevel(LogLevel::None);
+    for (uint32_t i = 0; i < options.iterations; i++) {
+        Converter converter ({inputPath.string(), outputPath.string()});
+        for (auto& stage : stages) {
+            auto start = std::chrono::steady_clock::now();
+            (converter.*stage.run)();
+            auto end = std::chrono::steady_clock::now();
+            stage.samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+    }
+
+    printf("%-12s %10s %10s %10s\n", "stage", "min ms", "median ms", "max ms");
+    double totalMin = 0, totalMedian = 0;
+    for (auto& stage : stages) {
+        auto median = bench_median(stage.samples);
+        printf("%-12s %10.3f %10.3f %10.3f\n", stage.name, stage.samples.front(), median, stage.samples.back());
+        totalMin += stage.samples.front();
+        totalMedian += median;
+    }
+    printf("%-12s %10.3f %10.3f\n", "total", totalMin, totalMedian);
+
+    std::filesystem::remove(inputPath);
+    std::filesystem::remove(outputPath);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include "bench_common.h"
+
+extern "C" {
+struct os_unfair_lock_s {
+    uint32_t _os_unfair_lock_opaque;
+};
+void os_unfair_lock_lock(os_unfair_lock_s* lock);
+void os_unfair_lock_unlock(os_unfair_lock_s* lock);
+void OSSpinLockLock(volatile int32_t* lock);
+void OSSpinLockUnlock(volatile int32_t* lock);
+}
+
+struct BenchOptions {
+    uint32_t iterations = 5;
+    uint64_t operations = 2000000; // lock/unlock pairs per sample, split between the threads
+    uint32_t work = 10; // pause instructions inside the critical section
+};
+
+struct LockFunctions {
+    void (*lock)();
+    void (*unlock)();
+};
+
+using Variant = BenchVariant<LockFunctions>;
+
+static os_unfair_lock_s unfairLock {};
+static int32_t spinLock = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t shared = 0;
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions ret;
+    bench_parse_args(argc, argv, {
+            bench_arg("--iterations", ret.iterations, 1),
+            bench_arg("--operations", ret.operations),
+            bench_arg("--work", ret.work),
+    });
+    return ret;
+}
+
+static double run(Variant const& variant, unsigned threadCount, BenchOptions const& options) {
+    auto perThread = options.operations / threadCount;
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&] {
+            for (uint64_t i = 0; i < perThread; i++) {
+                variant.run.lock();
+                shared++;
+                for (uint32_t w = 0; w < options.work; w++)
+                    __builtin_ia32_pause();
+                variant.run.unlock();
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double) (perThread * threadCount);
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+
+    Variant variants[] = {
+            {"pthread", {[] { pthread_mutex_lock(&mutex); }, [] { pthread_mutex_unlock(&mutex); }}},
+            {"unfair", {[] { os_unfair_lock_lock(&unfairLock); }, [] { os_unfair_lock_unlock(&unfairLock); }}},
+            {"spinlock", {[] { OSSpinLockLock(&spinLock); }, [] { OSSpinLockUnlock(&spinLock); }}},
+    };
+    auto cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < cpus * 2; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(cpus * 2); // oversubscribed, lock holders get preempted
+
+    bench_print_header("threads", variants, "median ns per lock/unlock pair");
+    for (auto threadCount : threadCounts) {
+        printf("%-10u", threadCount);
+        for (auto const& variant : variants)
+            printf(" %12.2f", bench_median_of(options.iterations, [&] { return run(variant, threadCount, options); }));
+        printf("\n");
+    }
+    return 0;
+}
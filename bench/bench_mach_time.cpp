@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include "bench_common.h"
+
+extern "C" {
+struct mach_timebase_info {
+    uint32_t numer;
+    uint32_t denom;
+};
+uint64_t mach_absolute_time();
+int mach_timebase_info(struct mach_timebase_info* info);
+}
+
+struct BenchOptions {
+    uint32_t iterations = 5;
+    uint64_t calls = 10000000; // clock reads per sample
+};
+
+using Variant = BenchVariant<uint64_t (*)()>;
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions ret;
+    bench_parse_args(argc, argv, {
+            bench_arg("--iterations", ret.iterations, 1),
+            bench_arg("--calls", ret.calls, 1),
+    });
+    return ret;
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts {};
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static double run(Variant const& variant, BenchOptions const& options) {
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < options.calls; i++)
+        sink += variant.run();
+    auto end = std::chrono::steady_clock::now();
+    asm volatile("" : : "r"(sink));
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double) options.calls;
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+
+    // The first call calibrates, keep it out of the measurements
+    struct mach_timebase_info timebase {};
+    mach_timebase_info(&timebase);
+    auto firstMach = mach_absolute_time();
+    auto firstRaw = clock_ns(CLOCK_MONOTONIC_RAW);
+
+    Variant variants[] = {
+            {"mach_absolute_time", [] { return mach_absolute_time(); }},
+            {"CLOCK_MONOTONIC_RAW", [] { return clock_ns(CLOCK_MONOTONIC_RAW); }},
+            {"CLOCK_MONOTONIC", [] { return clock_ns(CLOCK_MONOTONIC); }},
+    };
+    printf("%-22s %12s   (median ns per call)\n", "clock", "latency");
+    for (auto const& variant : variants)
+        printf("%-22s %12.2f\n", variant.name, bench_median_of(options.iterations, [&] { return run(variant, options); }));
+
+    // How far mach_absolute_time went apart from the kernel's clock over the run
+    auto machElapsed = (double) (mach_absolute_time() - firstMach) * timebase.numer / timebase.denom;
+    auto rawElapsed = (double) (clock_ns(CLOCK_MONOTONIC_RAW) - firstRaw);
+    printf("timebase %u/%u, offset from CLOCK_MONOTONIC_RAW %lld ns, drift %.3f ppm over %.2f s\n", timebase.numer,
+           timebase.denom, (long long) (mach_absolute_time() - clock_ns(CLOCK_MONOTONIC_RAW)),
+           (machElapsed - rawElapsed) / rawElapsed * 1e6, rawElapsed / 1e9);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "bench_common.h"
+
+extern "C" {
+void memset_pattern4(void *b, const void *pattern4, size_t len);
+void memset_pattern8(void *b, const void *pattern8, size_t len);
+void memset_pattern16(void *b, const void *pattern16, size_t len);
+}
+
+struct BenchOptions {
+    uint32_t iterations = 20;
+    std::size_t offset = 0; // misalignment of the destination
+};
+
+static const uint8_t pattern[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+static BenchOptions parse_options(int argc, char* argv[]) {
+    BenchOptions ret;
+    bench_parse_args(argc, argv, {
+            bench_arg("--iterations", ret.iterations, 1),
+            bench_arg("--offset", ret.offset),
+    });
+    ret.offset %= 64;
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+    auto options = parse_options(argc, argv);
+
+    BenchVariant<void (*)(void* b, std::size_t len)> variants[] = {
+            {"memset", [](void* b, std::size_t len) { memset(b, pattern[0], len); }},
+            {"pattern4", [](void* b, std::size_t len) { memset_pattern4(b, pattern, len); }},
+            {"pattern8", [](void* b, std::size_t len) { memset_pattern8(b, pattern, len); }},
+            {"pattern16", [](void* b, std::size_t len) { memset_pattern16(b, pattern, len); }},
+    };
+    const std::size_t sizes[] = {15, 64, 256, 1024, 4096, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024};
+
+    std::vector<uint8_t> buffer (sizes[std::size(sizes) - 1] + 64);
+    memset(buffer.data(), 0, buffer.size()); // fault the pages in before timing anything
+    auto dst = buffer.data() + options.offset;
+
+    bench_print_header("size", variants, "median GB/s");
+    for (auto size : sizes) {
+        // Repeat small fills so that every sample covers at least 64 MiB
+        auto repeat = std::max<std::size_t>(1, (64 * 1024 * 1024) / size);
+        printf("%-10zu", size);
+        for (auto const& variant : variants) {
+            auto seconds = bench_median_of(options.iterations, [&] {
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t r = 0; r < repeat; r++) {
+                    variant.run(dst, size);
+                    asm volatile("" : : "r"(dst) : "memory");
+                }
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double>(end - start).count();
+            });
+            printf(" %12.2f", (double) size * repeat / seconds / 1e9);
+        }
+        printf("\n");
+    }
+    return 0;
+}
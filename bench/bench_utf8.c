@@ -0,0 +1,151 @@
+#include "xlocale_private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+int _UTF8_init(struct __xlocale_st_runelocale *);
+int _UTF8_init_scalar(struct __xlocale_st_runelocale *);
+
+struct bench_options {
+	unsigned int iterations;
+	size_t length;	/* characters per conversion */
+};
+
+struct converter {
+	const char *name;
+	struct __xlocale_st_runelocale rl;
+};
+
+/* Fraction of non-ASCII characters in the generated texts, in percent */
+static const int mixes[] = {0, 1, 10, 50};
+
+static struct bench_options
+parse_options(int argc, char *argv[])
+{
+	struct bench_options ret = {20, 4096};
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+			ret.iterations = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+			ret.length = strtoul(argv[++i], NULL, 10);
+		} else {
+			fprintf(stderr, "usage: %s [--iterations N] [--length N]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (ret.iterations < 1)
+		ret.iterations = 1;
+	if (ret.length < 1)
+		ret.length = 1;
+	return (ret);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/* Median throughput in millions of characters per second */
+static double
+run(const struct converter *c, int wide_to_mb, const char *mb, const wchar_t *wcs,
+    size_t nbytes, size_t nchars, const struct bench_options *options,
+    double *samples)
+{
+	static char mbbuf[4 * 1024 * 1024];
+	static wchar_t wcbuf[1024 * 1024];
+	size_t repeat, r;
+	unsigned int i;
+
+	/* Repeat short conversions so that every sample covers about 16M characters */
+	repeat = 16 * 1024 * 1024 / nchars + 1;
+	for (i = 0; i < options->iterations; i++) {
+		double start = now();
+		for (r = 0; r < repeat; r++) {
+			__darwin_mbstate_t state;
+			memset(&state, 0, sizeof(state));
+			if (wide_to_mb) {
+				const wchar_t *s = wcs;
+				c->rl.__wcsnrtombs(mbbuf, &s, nchars, sizeof(mbbuf), &state, NULL);
+			} else {
+				const char *s = mb;
+				c->rl.__mbsnrtowcs(wcbuf, &s, nbytes, nchars, &state, NULL);
+			}
+			__asm__ volatile("" : : : "memory");
+		}
+		samples[i] = now() - start;
+	}
+	qsort(samples, options->iterations, sizeof(double), compare_double);
+	return ((double)nchars * repeat / samples[options->iterations / 2] / 1e6);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_options options = parse_options(argc, argv);
+	struct converter converters[2];
+	double *samples;
+	char *mb;
+	wchar_t *wcs;
+	size_t nbytes, i;
+	unsigned int m, c, dir;
+
+	if (options.length > 1024 * 1024)
+		options.length = 1024 * 1024;
+	memset(converters, 0, sizeof(converters));
+	converters[0].name = "scalar";
+	_UTF8_init_scalar(&converters[0].rl);
+	converters[1].name = "simd";
+	_UTF8_init(&converters[1].rl);
+
+	samples = malloc(options.iterations * sizeof(double));
+	mb = malloc(options.length * 4);
+	wcs = malloc(options.length * sizeof(wchar_t));
+
+	printf("%-6s %-8s", "mix", "dir");
+	for (c = 0; c < 2; c++)
+		printf(" %12s", converters[c].name);
+	printf("   (median Mchar/s, %zu characters)\n", options.length);
+	for (m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+		srand(1);
+		nbytes = 0;
+		for (i = 0; i < options.length; i++) {
+			/* U+00E9 when non-ASCII, 2 bytes in UTF-8 */
+			if (rand() % 100 < mixes[m]) {
+				wcs[i] = 0xe9;
+				mb[nbytes++] = (char)0xc3;
+				mb[nbytes++] = (char)0xa9;
+			} else {
+				wcs[i] = 'a' + rand() % 26;
+				mb[nbytes++] = (char)wcs[i];
+			}
+		}
+		for (dir = 0; dir < 2; dir++) {
+			printf("%-6d %-8s", mixes[m], dir ? "wcs->mb" : "mb->wcs");
+			for (c = 0; c < 2; c++)
+				printf(" %12.1f", run(&converters[c], dir, mb, wcs, nbytes,
+				    options.length, &options, samples));
+			printf("\n");
+		}
+	}
+	free(samples);
+	free(mb);
+	free(wcs);
+	return (0);
+}
@@ -0,0 +1,506 @@
+#include "macho_generator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+// Only the handful of Mach-O definitions used below, so that the generator does not depend on the macOS headers
+enum : uint32_t {
+    MH_MAGIC_64 = 0xfeedfacf,
+    CPU_TYPE_X86_64 = 0x01000007,
+    CPU_SUBTYPE_X86_64_ALL = 3,
+    MH_DYLIB = 6,
+    MH_NOUNDEFS = 0x1,
+    MH_DYLDLINK = 0x4,
+    MH_TWOLEVEL = 0x80,
+
+    LC_SYMTAB = 0x2,
+    LC_DYSYMTAB = 0xb,
+    LC_LOAD_DYLIB = 0xc,
+    LC_ID_DYLIB = 0xd,
+    LC_SEGMENT_64 = 0x19,
+    LC_DYLD_INFO_ONLY = 0x80000022,
+
+    VM_PROT_READ = 1,
+    VM_PROT_WRITE = 2,
+    VM_PROT_EXECUTE = 4,
+
+    S_ATTR_PURE_INSTRUCTIONS = 0x80000000,
+    S_ATTR_SOME_INSTRUCTIONS = 0x400,
+    S_COALESCED = 0xb,
+    S_ATTR_NO_TOC = 0x40000000,
+    S_ATTR_STRIP_STATIC_SYMS = 0x20000000,
+    S_ATTR_LIVE_SUPPORT = 0x08000000,
+
+    N_UNDF = 0x0,
+    N_EXT = 0x1,
+    N_SECT = 0xe,
+
+    REBASE_TYPE_POINTER = 1,
+    REBASE_OPCODE_SET_TYPE_IMM = 0x10,
+    REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB = 0x20,
+    REBASE_OPCODE_DO_REBASE_ULEB_TIMES = 0x60,
+    BIND_TYPE_POINTER = 1,
+    BIND_OPCODE_SET_DYLIB_ORDINAL_IMM = 0x10,
+    BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB = 0x20,
+    BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM = 0x40,
+    BIND_OPCODE_SET_TYPE_IMM = 0x50,
+    BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB = 0x70,
+    BIND_OPCODE_DO_BIND = 0x90,
+
+    UNWIND_X86_64_MODE_RBP_FRAME = 0x01000000,
+    UNWIND_X86_64_MODE_STACK_IMMD = 0x02000000,
+    UNWIND_X86_64_MODE_DWARF = 0x04000000,
+    UNWIND_SECOND_LEVEL_REGULAR = 2,
+};
+
+static constexpr uint32_t FUNCTION_SIZE = 16;
+static constexpr uint32_t UNWIND_PAGE_ENTRY_COUNT = 511;
+static constexpr uint32_t CIE_SIZE = 24;
+static constexpr uint32_t FDE_SIZE = 32;
+
+static const char* const knownDylibs[] = {
+    "/usr/lib/libSystem.B.dylib",
+    "/usr/lib/libc++.1.dylib",
+    "/usr/lib/libiconv.2.dylib",
+};
+
+namespace {
+
+class ByteWriter {
+
+public:
+    std::vector<uint8_t> data;
+
+    size_t size() const { return data.size(); }
+
+    template <typename T>
+    void write(T v) {
+        auto off = data.size();
+        data.resize(off + sizeof(T));
+        memcpy(&data[off], &v, sizeof(T));
+    }
+
+    template <typename T>
+    void writeAt(size_t off, T v) {
+        memcpy(&data[off], &v, sizeof(T));
+    }
+
+    void writeBytes(std::initializer_list<uint8_t> bytes) {
+        data.insert(data.end(), bytes);
+    }
+
+    void writeString(std::string const& str) {
+        data.insert(data.end(), str.begin(), str.end());
+        data.push_back(0);
+    }
+
+    void writeFixedString(const char* str, size_t len) {
+        auto off = data.size();
+        data.resize(off + len);
+        strncpy((char*) &data[off], str, len);
+    }
+
+    void writeUleb128(uint64_t v) {
+        do {
+            uint8_t b = v & 0x7f;
+            v >>= 7;
+            data.push_back(v ? (b | 0x80) : b);
+        } while (v);
+    }
+
+    void align(size_t alignment, uint8_t fill = 0) {
+        data.resize((data.size() + alignment - 1) / alignment * alignment, fill);
+    }
+
+};
+
+struct SectionDesc {
+    const char* name;
+    const char* segment;
+    uint64_t address;
+    uint64_t size;
+    uint32_t offset;
+    uint32_t align;
+    uint32_t flags;
+};
+
+size_t ulebSize(uint64_t v) {
+    size_t ret = 1;
+    while (v >>= 7)
+        ++ret;
+    return ret;
+}
+
+// Export trie with single character edges, node offsets are recomputed until they stop changing since the size of a
+// node depends on the ULEB128 encoded offsets of its children
+std::vector<uint8_t> buildExportTrie(std::vector<std::pair<std::string, uint64_t>> const& exports) {
+    struct Node {
+        std::map<char, size_t> children;
+        bool terminal = false;
+        uint64_t address = 0;
+        uint32_t offset = 0;
+    };
+    std::vector<Node> nodes (1);
+    for (auto const& e : exports) {
+        size_t node = 0;
+        for (char c : e.first) {
+            auto it = nodes[node].children.find(c);
+            if (it == nodes[node].children.end()) {
+                nodes.emplace_back();
+                it = nodes[node].children.emplace(c, nodes.size() - 1).first;
+            }
+            node = it->second;
+        }
+        nodes[node].terminal = true;
+        nodes[node].address = e.second;
+    }
+
+    const auto terminalSize = [](Node const& node) -> size_t {
+        return node.terminal ? 1 + ulebSize(node.address) : 0;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        uint32_t offset = 0;
+        for (auto& node : nodes) {
+            if (node.offset != offset)
+                changed = true;
+            node.offset = offset;
+            offset += ulebSize(terminalSize(node)) + terminalSize(node) + 1;
+            for (auto const& child : node.children)
+                offset += 2 + ulebSize(nodes[child.second].offset);
+        }
+    }
+
+    ByteWriter ret;
+    for (auto const& node : nodes) {
+        ret.writeUleb128(terminalSize(node));
+        if (node.terminal) {
+            ret.writeUleb128(0); // flags
+            ret.writeUleb128(node.address);
+        }
+        ret.write<uint8_t>(node.children.size());
+        for (auto const& child : node.children) {
+            ret.write<char>(child.first);
+            ret.write<char>(0);
+            ret.writeUleb128(nodes[child.second].offset);
+        }
+    }
+    return std::move(ret.data);
+}
+
+}
+
+static uint64_t alignUp(uint64_t v, uint64_t alignment) {
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t getCompactEncoding(uint32_t index) {
+    switch (index % 4) {
+        case 0:
+            return UNWIND_X86_64_MODE_RBP_FRAME;
+        case 1:
+            return UNWIND_X86_64_MODE_RBP_FRAME | (1 << 16) | 1; // rbx saved at rbp-8
+        case 2:
+            return UNWIND_X86_64_MODE_STACK_IMMD | (1 << 16); // return address only
+        default:
+            return UNWIND_X86_64_MODE_STACK_IMMD | (3 << 16) | (1 << 10); // push rbx; sub rsp, 8
+    }
+}
+
+static std::string getDylibName(uint32_t index) {
+    if (index < sizeof(knownDylibs) / sizeof(knownDylibs[0]))
+        return knownDylibs[index];
+    return "/usr/lib/libbench" + std::to_string(index) + ".dylib";
+}
+
+std::vector<uint8_t> generateMachO(MachOGeneratorOptions const& options) {
+    const uint32_t functionCount = std::max<uint32_t>(options.functionCount, 1);
+    const uint32_t dylibCount = std::max<uint32_t>(options.dylibCount, 1);
+
+    std::vector<std::string> dylibNames;
+    uint32_t loadCommandsSize = (72 + 80 * 3) + (72 + 80 * 1) + 72 + 48 + 24 + 80;
+    for (uint32_t i = 0; i <= dylibCount; i++) {
+        dylibNames.push_back(i == 0 ? "/usr/lib/libbench.dylib" : getDylibName(i - 1));
+        loadCommandsSize += alignUp(24 + dylibNames.back().size() + 1, 8);
+    }
+    const uint32_t loadCommandCount = 3 + 3 + dylibNames.size();
+
+    // __TEXT
+    const uint64_t textAddr = alignUp(32 + loadCommandsSize, 16);
+    const uint64_t textSize = (uint64_t) functionCount * FUNCTION_SIZE;
+    std::vector<uint32_t> encodings (functionCount);
+    for (uint32_t i = 0, compactIndex = 0; i < functionCount; i++) {
+        if (options.dwarfFunctionInterval && i % options.dwarfFunctionInterval == 0)
+            encodings[i] = UNWIND_X86_64_MODE_DWARF;
+        else
+            encodings[i] = getCompactEncoding(compactIndex++);
+    }
+
+    ByteWriter text;
+    for (uint32_t i = 0; i < functionCount; i++) {
+        auto mode = encodings[i] & 0x0f000000;
+        if (mode == UNWIND_X86_64_MODE_STACK_IMMD)
+            text.writeBytes({0xc3});
+        else
+            text.writeBytes({0x55, 0x48, 0x89, 0xe5, 0x5d, 0xc3}); // push rbp; mov rbp, rsp; pop rbp; ret
+        text.align(FUNCTION_SIZE, 0xcc);
+    }
+
+    const uint64_t ehFrameAddr = alignUp(textAddr + textSize, 8);
+    ByteWriter ehFrame;
+    ehFrame.write<uint32_t>(CIE_SIZE - 4);
+    ehFrame.write<uint32_t>(0); // CIE id
+    ehFrame.write<uint8_t>(1); // version
+    ehFrame.writeString("zR");
+    ehFrame.writeBytes({0x01, 0x78, 0x10}); // code alignment 1, data alignment -8, return address register 16
+    ehFrame.writeBytes({0x01, 0x1b}); // augmentation data: pcrel sdata4 FDE pointers
+    ehFrame.writeBytes({0x0c, 0x07, 0x08, 0x90, 0x01}); // def_cfa rsp+8; offset rip, cfa-8
+    ehFrame.align(8);
+    std::vector<uint32_t> fdeOffsets (functionCount);
+    for (uint32_t i = 0; i < functionCount; i++) {
+        if (encodings[i] != UNWIND_X86_64_MODE_DWARF)
+            continue;
+        auto off = (uint32_t) ehFrame.size();
+        fdeOffsets[i] = off;
+        ehFrame.write<uint32_t>(FDE_SIZE - 4);
+        ehFrame.write<uint32_t>(off + 4); // CIE pointer
+        ehFrame.write<int32_t>((int32_t) (textAddr + i * FUNCTION_SIZE - (ehFrameAddr + off + 8)));
+        ehFrame.write<uint32_t>(FUNCTION_SIZE);
+        ehFrame.write<uint8_t>(0); // augmentation data length
+        // advance 1; def_cfa_offset 16; offset rbp, cfa-16; advance 3; def_cfa_register rbp
+        ehFrame.writeBytes({0x41, 0x0e, 0x10, 0x86, 0x02, 0x43, 0x0d, 0x06});
+        ehFrame.align(8);
+    }
+    ehFrame.write<uint32_t>(0);
+
+    const uint64_t unwindInfoAddr = alignUp(ehFrameAddr + ehFrame.size(), 4);
+    ByteWriter unwindInfo;
+    {
+        const uint32_t pageCount = (functionCount + UNWIND_PAGE_ENTRY_COUNT - 1) / UNWIND_PAGE_ENTRY_COUNT;
+        const uint32_t headerSize = 28;
+        const uint32_t indexOffset = headerSize;
+        const uint32_t lsdaOffset = indexOffset + (pageCount + 1) * 12;
+        unwindInfo.write<uint32_t>(1); // version
+        unwindInfo.write<uint32_t>(headerSize); // common encodings
+        unwindInfo.write<uint32_t>(0);
+        unwindInfo.write<uint32_t>(headerSize); // personalities
+        unwindInfo.write<uint32_t>(0);
+        unwindInfo.write<uint32_t>(indexOffset);
+        unwindInfo.write<uint32_t>(pageCount + 1);
+
+        uint32_t pageOffset = lsdaOffset;
+        for (uint32_t p = 0; p < pageCount; p++) {
+            auto first = p * UNWIND_PAGE_ENTRY_COUNT;
+            unwindInfo.write<uint32_t>((uint32_t) (textAddr + first * FUNCTION_SIZE));
+            unwindInfo.write<uint32_t>(pageOffset);
+            unwindInfo.write<uint32_t>(lsdaOffset);
+            pageOffset += 8 + std::min(UNWIND_PAGE_ENTRY_COUNT, functionCount - first) * 8;
+        }
+        unwindInfo.write<uint32_t>((uint32_t) (textAddr + textSize));
+        unwindInfo.write<uint32_t>(0);
+        unwindInfo.write<uint32_t>(lsdaOffset);
+
+        for (uint32_t p = 0; p < pageCount; p++) {
+            auto first = p * UNWIND_PAGE_ENTRY_COUNT;
+            auto count = std::min(UNWIND_PAGE_ENTRY_COUNT, functionCount - first);
+            unwindInfo.write<uint32_t>(UNWIND_SECOND_LEVEL_REGULAR);
+            unwindInfo.write<uint16_t>(8);
+            unwindInfo.write<uint16_t>(count);
+            for (uint32_t i = first; i < first + count; i++) {
+                unwindInfo.write<uint32_t>((uint32_t) (textAddr + i * FUNCTION_SIZE));
+                unwindInfo.write<uint32_t>(encodings[i] == UNWIND_X86_64_MODE_DWARF ? encodings[i] | fdeOffsets[i] : encodings[i]);
+            }
+        }
+    }
+    const uint64_t textSegmentSize = alignUp(unwindInfoAddr + unwindInfo.size(), 0x1000);
+
+    // __DATA, rebased pointers to the functions followed by the bound pointers
+    const uint64_t dataAddr = textSegmentSize;
+    ByteWriter data;
+    for (uint32_t i = 0; i < options.rebaseCount; i++)
+        data.write<uint64_t>(textAddr + (i % functionCount) * FUNCTION_SIZE);
+    for (uint32_t i = 0; i < options.bindingCount; i++)
+        data.write<uint64_t>(0);
+    data.align(8);
+    const uint64_t dataSegmentSize = alignUp(std::max<size_t>(data.size(), 8), 0x1000);
+
+    // __LINKEDIT
+    ByteWriter rebase;
+    if (options.rebaseCount) {
+        rebase.write<uint8_t>(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+        rebase.write<uint8_t>(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+        rebase.writeUleb128(0);
+        rebase.write<uint8_t>(REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+        rebase.writeUleb128(options.rebaseCount);
+    }
+    rebase.write<uint8_t>(0);
+    rebase.align(8);
+
+    ByteWriter bind;
+    std::vector<std::string> importNames;
+    for (uint32_t i = 0; i < options.bindingCount; i++) {
+        auto ordinal = i % dylibCount + 1;
+        importNames.push_back("_bench_import_" + std::to_string(i));
+        if (ordinal < 16) {
+            bind.write<uint8_t>(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | ordinal);
+        } else {
+            bind.write<uint8_t>(BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB);
+            bind.writeUleb128(ordinal);
+        }
+        bind.write<uint8_t>(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+        bind.writeString(importNames.back());
+        bind.write<uint8_t>(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+        bind.write<uint8_t>(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+        bind.writeUleb128(((uint64_t) options.rebaseCount + i) * 8);
+        bind.write<uint8_t>(BIND_OPCODE_DO_BIND);
+    }
+    bind.write<uint8_t>(0);
+    bind.align(8);
+
+    std::vector<std::pair<std::string, uint64_t>> exports;
+    for (uint32_t i = 0; i < functionCount; i++)
+        exports.emplace_back("_bench_func_" + std::to_string(i), textAddr + i * FUNCTION_SIZE);
+    ByteWriter exportTrie;
+    exportTrie.data = buildExportTrie(exports);
+    exportTrie.align(8);
+
+    ByteWriter strtab;
+    strtab.write<uint8_t>(0);
+    ByteWriter symtab;
+    for (auto const& e : exports) {
+        symtab.write<uint32_t>(strtab.size());
+        symtab.write<uint8_t>(N_SECT | N_EXT);
+        symtab.write<uint8_t>(1);
+        symtab.write<uint16_t>(0);
+        symtab.write<uint64_t>(e.second);
+        strtab.writeString(e.first);
+    }
+    for (uint32_t i = 0; i < importNames.size(); i++) {
+        symtab.write<uint32_t>(strtab.size());
+        symtab.write<uint8_t>(N_UNDF | N_EXT);
+        symtab.write<uint8_t>(0);
+        symtab.write<uint16_t>((i % dylibCount + 1) << 8);
+        symtab.write<uint64_t>(0);
+        strtab.writeString(importNames[i]);
+    }
+    strtab.align(8);
+
+    const uint64_t linkeditAddr = dataAddr + dataSegmentSize;
+    const uint64_t rebaseOff = linkeditAddr;
+    const uint64_t bindOff = rebaseOff + rebase.size();
+    const uint64_t exportOff = bindOff + bind.size();
+    const uint64_t symOff = exportOff + exportTrie.size();
+    const uint64_t strOff = symOff + symtab.size();
+    const uint64_t linkeditSize = strOff + strtab.size() - linkeditAddr;
+
+    // Addresses and file offsets are identical, the image is laid out the way it would be mapped
+    ByteWriter out;
+    out.write<uint32_t>(MH_MAGIC_64);
+    out.write<uint32_t>(CPU_TYPE_X86_64);
+    out.write<uint32_t>(CPU_SUBTYPE_X86_64_ALL);
+    out.write<uint32_t>(MH_DYLIB);
+    out.write<uint32_t>(loadCommandCount);
+    out.write<uint32_t>(loadCommandsSize);
+    out.write<uint32_t>(MH_NOUNDEFS | MH_DYLDLINK | MH_TWOLEVEL);
+    out.write<uint32_t>(0);
+
+    const auto writeSegment = [&](const char* name, uint64_t addr, uint64_t size, uint64_t fileSize, uint32_t prot,
+            std::initializer_list<SectionDesc> sections) {
+        out.write<uint32_t>(LC_SEGMENT_64);
+        out.write<uint32_t>(72 + 80 * sections.size());
+        out.writeFixedString(name, 16);
+        out.write<uint64_t>(addr);
+        out.write<uint64_t>(size);
+        out.write<uint64_t>(addr);
+        out.write<uint64_t>(fileSize);
+        out.write<uint32_t>(prot);
+        out.write<uint32_t>(prot);
+        out.write<uint32_t>(sections.size());
+        out.write<uint32_t>(0);
+        for (auto const& sec : sections) {
+            out.writeFixedString(sec.name, 16);
+            out.writeFixedString(sec.segment, 16);
+            out.write<uint64_t>(sec.address);
+            out.write<uint64_t>(sec.size);
+            out.write<uint32_t>(sec.offset);
+            out.write<uint32_t>(sec.align);
+            out.write<uint32_t>(0);
+            out.write<uint32_t>(0);
+            out.write<uint32_t>(sec.flags);
+            out.write<uint32_t>(0);
+            out.write<uint32_t>(0);
+            out.write<uint32_t>(0);
+        }
+    };
+    writeSegment("__TEXT", 0, textSegmentSize, textSegmentSize, VM_PROT_READ | VM_PROT_EXECUTE, {
+        {"__text", "__TEXT", textAddr, textSize, (uint32_t) textAddr, 4, S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS},
+        {"__eh_frame", "__TEXT", ehFrameAddr, ehFrame.size(), (uint32_t) ehFrameAddr, 3,
+         S_COALESCED | S_ATTR_NO_TOC | S_ATTR_STRIP_STATIC_SYMS | S_ATTR_LIVE_SUPPORT},
+        {"__unwind_info", "__TEXT", unwindInfoAddr, unwindInfo.size(), (uint32_t) unwindInfoAddr, 2, 0},
+    });
+    writeSegment("__DATA", dataAddr, dataSegmentSize, dataSegmentSize, VM_PROT_READ | VM_PROT_WRITE, {
+        {"__data", "__DATA", dataAddr, data.size(), (uint32_t) dataAddr, 3, 0},
+    });
+    writeSegment("__LINKEDIT", linkeditAddr, alignUp(linkeditSize, 0x1000), linkeditSize, VM_PROT_READ, {});
+
+    for (size_t i = 0; i < dylibNames.size(); i++) {
+        out.write<uint32_t>(i == 0 ? LC_ID_DYLIB : LC_LOAD_DYLIB);
+        out.write<uint32_t>(alignUp(24 + dylibNames[i].size() + 1, 8));
+        out.write<uint32_t>(24);
+        out.write<uint32_t>(2); // timestamp
+        out.write<uint32_t>(0x10000); // current version
+        out.write<uint32_t>(0x10000); // compatibility version
+        out.writeString(dylibNames[i]);
+        out.align(8);
+    }
+
+    out.write<uint32_t>(LC_DYLD_INFO_ONLY);
+    out.write<uint32_t>(48);
+    out.write<uint32_t>(rebaseOff);
+    out.write<uint32_t>(rebase.size());
+    out.write<uint32_t>(bindOff);
+    out.write<uint32_t>(bind.size());
+    out.write<uint32_t>(0); // weak bind
+    out.write<uint32_t>(0);
+    out.write<uint32_t>(0); // lazy bind
+    out.write<uint32_t>(0);
+    out.write<uint32_t>(exportOff);
+    out.write<uint32_t>(exportTrie.size());
+
+    out.write<uint32_t>(LC_SYMTAB);
+    out.write<uint32_t>(24);
+    out.write<uint32_t>(symOff);
+    out.write<uint32_t>(exports.size() + importNames.size());
+    out.write<uint32_t>(strOff);
+    out.write<uint32_t>(strtab.size());
+
+    out.write<uint32_t>(LC_DYSYMTAB);
+    out.write<uint32_t>(80);
+    out.write<uint32_t>(0); // local symbols
+    out.write<uint32_t>(0);
+    out.write<uint32_t>(0); // external symbols
+    out.write<uint32_t>(exports.size());
+    out.write<uint32_t>(exports.size()); // undefined symbols
+    out.write<uint32_t>(importNames.size());
+    for (int i = 0; i < 12; i++)
+        out.write<uint32_t>(0);
+
+    const auto place = [&](uint64_t offset, ByteWriter const& content) {
+        if (out.size() < offset)
+            out.data.resize(offset, 0);
+        out.data.insert(out.data.end(), content.data.begin(), content.data.end());
+    };
+    place(textAddr, text);
+    place(ehFrameAddr, ehFrame);
+    place(unwindInfoAddr, unwindInfo);
+    place(dataAddr, data);
+    place(rebaseOff, rebase);
+    place(bindOff, bind);
+    place(exportOff, exportTrie);
+    place(symOff, symtab);
+    place(strOff, strtab);
+    return std::move(out.data);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct MachOGeneratorOptions {
+    uint32_t functionCount = 20000;
+    uint32_t rebaseCount = 20000;
+    uint32_t bindingCount = 5000;
+    uint32_t dylibCount = 4;
+    // Every n-th function uses DWARF mode and gets an FDE in __eh_frame, the others cycle through the RBP frame and
+    // frameless compact encodings
+    uint32_t dwarfFunctionInterval = 4;
+};
+
+// Generates a synthetic x86_64 MH_DYLIB with a __text section made out of small functions, __eh_frame and
+// __unwind_info describing them, a __data section with rebased and bound pointers, and the dyld info (rebase, bind,
+// export trie) and symbol table referencing all of it.
+std::vector<uint8_t> generateMachO(MachOGeneratorOptions const& options);
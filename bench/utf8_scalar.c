@@ -0,0 +1,4 @@
+/* The UTF-8 converters without the ASCII kernels, as the baseline for bench_utf8 */
+#define	UTF8_SCALAR_ONLY
+#define	_UTF8_init	_UTF8_init_scalar
+#include "../macoscompat/locale/utf8.c"
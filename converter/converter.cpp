@@ -0,0 +1,1134 @@
+#include "converter.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <unordered_set>
+#include <LIEF/LIEF.hpp>
+#include <elfio/elfio.hpp>
+#include "embedded_blob.h"
+#include "embedded_shims.h"
+#include "log.h"
+#include "translation_default.h"
+#include "translation_helper.h"
+#include "unwind_compact_decoder.h"
+#include "unwind_rewriter.h"
+#include "unwind_sframe.h"
+#include "str_data.h"
+
+using namespace ELFIO;
+
+static Elf_Word convert_section_type(LIEF::MachO::MACHO_SECTION_TYPES type);
+static Elf_Word map_prot(LIEF::MachO::VM_PROTECTIONS prot);
+
+static void setup_elf(elfio& writer, bool isExe) {
+    writer.create(ELFCLASS64, ELFDATA2LSB);
+    writer.set_os_abi(ELFOSABI_LINUX);
+    writer.set_type(isExe ? ET_EXEC : ET_DYN);
+    writer.set_machine(EM_X86_64);
+
+    auto phdr = writer.segments.add();
+    phdr->set_type(PT_PHDR);
+    phdr->set_flags(PF_R | PF_X);
+    phdr->set_align(8);
+    phdr->set_virtual_address(writer.get_base() + 0x40);
+    phdr->set_physical_address(writer.get_base() + 0x40);
+
+    auto interpSec = writer.sections.add(".interp");
+    auto interpName = "/lib64/ld-linux-x86-64.so.2";
+    interpSec->set_data(interpName, strlen(interpName) + 1);
+    interpSec->set_type(SHT_PROGBITS);
+    interpSec->set_flags(SHF_ALLOC);
+    interpSec->set_addr_align(1);
+    auto interp = writer.segments.add();
+    interp->set_type(PT_INTERP);
+    interp->set_flags(PF_R);
+    interp->add_section(interpSec, 1);
+    interp->set_align(1);
+}
+
+struct DynBuilder {
+
+private:
+    struct SymbolInfo {
+        std::string name;
+        unsigned char st_info;
+        Elf64_Half shndx = 0;
+        Elf64_Addr value;
+        Elf_Xword size;
+    };
+
+    std::vector<Elf64_Dyn> dyn;
+    StrData dynstr;
+    std::size_t tagDynStr, tagDynStrSz;
+    std::size_t tagDynSym;
+    std::size_t tagGnuHash;
+    std::size_t tagDynRela, tagDynRelaSz;
+    std::size_t tagFini;
+    std::vector<SymbolInfo> symbols;
+    std::vector<Elf64_Rela> rela;
+
+    inline std::size_t addDyn(Elf_Sxword tag, Elf_Xword val) {
+        auto ret = dyn.size();
+        Elf64_Dyn d = {tag};
+        d.d_un.d_val = val;
+        dyn.push_back(d);
+        return ret;
+    }
+
+public:
+    section* dynstrSec;
+    section* dynsymSec;
+    section* dynamicSec;
+    section* gnuHashSec;
+    section* relaDynSec;
+
+    std::map<std::string, Elf64_Word> symbolMap;
+
+    DynBuilder() {
+        symbols.push_back({});
+    }
+
+    void build(elfio& writer, Elf64_Addr base, std::vector<std::string> const& neededLibs, section* elfInitSec) {
+        dynstrSec = writer.sections.add(".dynstr");
+        dynstrSec->set_type(SHT_STRTAB);
+        dynstrSec->set_flags(SHF_ALLOC);
+        dynstrSec->set_addr_align(1);
+
+        dynsymSec = writer.sections.add(".dynsym");
+        dynsymSec->set_type(SHT_DYNSYM);
+        dynsymSec->set_flags(SHF_ALLOC);
+        dynsymSec->set_entry_size(sizeof(Elf64_Sym));
+        dynsymSec->set_addr_align(8);
+        dynsymSec->set_link(dynstrSec->get_index());
+
+        gnuHashSec = writer.sections.add(".gnu.hash");
+        gnuHashSec->set_type(SHT_DYNAMIC);
+        gnuHashSec->set_flags(SHF_ALLOC | SHF_WRITE);
+        gnuHashSec->set_entry_size(sizeof(Elf64_Dyn));
+        gnuHashSec->set_addr_align(8);
+        gnuHashSec->set_link(dynstrSec->get_index());
+
+        relaDynSec = writer.sections.add(".rela.dyn");
+        relaDynSec->set_type(SHT_RELA);
+        relaDynSec->set_flags(SHF_ALLOC);
+        relaDynSec->set_entry_size(sizeof(Elf64_Rela));
+        relaDynSec->set_addr_align(8);
+        relaDynSec->set_link(dynsymSec->get_index());
+
+        dynamicSec = writer.sections.add(".dynamic");
+        dynamicSec->set_type(SHT_DYNAMIC);
+        dynamicSec->set_flags(SHF_ALLOC | SHF_WRITE);
+        dynamicSec->set_entry_size(sizeof(Elf64_Dyn));
+        dynamicSec->set_addr_align(8);
+        dynamicSec->set_link(dynstrSec->get_index());
+
+        auto dynamic = writer.segments.add();
+        dynamic->set_type(PT_DYNAMIC);
+        dynamic->set_flags(PF_R | PF_W);
+        dynamic->set_virtual_address(base);
+        dynamic->set_physical_address(base);
+        dynamic->add_section(dynamicSec, 8);
+
+        for (auto const& lib : neededLibs)
+            addDyn(DT_NEEDED, dynstr.add(lib));
+//        addDyn(DT_RUNPATH, dynstr.add("$ORIGIN"));
+        tagDynStr = addDyn(DT_STRTAB, 0);
+        tagDynStrSz = addDyn(DT_STRSZ, 0);
+        tagDynSym = addDyn(DT_SYMTAB, 0);
+        tagGnuHash = addDyn(DT_GNU_HASH, 0);
+        addDyn(DT_SYMENT, sizeof(Elf64_Sym));
+        tagDynRela = addDyn(DT_RELA, 0);
+        tagDynRelaSz = addDyn(DT_RELASZ, 0);
+        addDyn(DT_RELAENT, sizeof(Elf64_Rela));
+        if (elfInitSec) {
+            addDyn(DT_INIT_ARRAY, elfInitSec->get_address());
+            addDyn(DT_INIT_ARRAYSZ, elfInitSec->get_size());
+        }
+        tagFini = addDyn(DT_FINI, 0);
+        addDyn(DT_DEBUG, 0);
+        addDyn(DT_NULL, 0);
+
+        dynamicSec->set_data((const char*) dyn.data(), dyn.size() * sizeof(Elf64_Dyn));
+    }
+
+    void addSymbol(std::string name, unsigned char st_info, Elf64_Half shndx = 0, Elf64_Addr value = 0, Elf_Xword size = 0) {
+        symbols.push_back({std::move(name), st_info, shndx, value, size});
+    }
+
+    std::size_t getSymbolCount() const {
+        return symbols.size();
+    }
+
+    std::size_t getRelocationCount() const {
+        return rela.size();
+    }
+
+    static inline std::size_t roundUpToPowerOf2(std::size_t v) {
+        std::size_t ret = 1;
+        while (ret < v)
+            ret*=2;
+        return ret;
+    }
+
+    void buildGnuHash(Elf64_Word symndx) {
+        // taken from ExeLayout.hpp : 272
+        using HashWord = uint64_t;
+
+        const std::size_t shift2 = 26;
+        auto nBuckets = std::max<std::size_t>((symbols.size() - symndx) / 4, 1);
+        std::size_t maskWords = 1;
+        if ((symbols.size() - symndx) > 0) {
+            maskWords = roundUpToPowerOf2((symbols.size() - symndx) * 12 / (sizeof(HashWord) * 8));
+        }
+
+        std::stable_sort(symbols.begin() + symndx, symbols.end(), [&nBuckets] (const auto& a, const auto& b) {
+            return (LIEF::ELF::dl_new_hash(a.name.c_str()) % nBuckets) < (LIEF::ELF::dl_new_hash(b.name.c_str()) % nBuckets);
+        });
+
+        std::vector<HashWord> bloomFilters(maskWords, 0);
+        const unsigned c = 64;
+        for (size_t i = symndx; i < symbols.size(); ++i) {
+            const uint32_t hash = LIEF::ELF::dl_new_hash(symbols[i].name.c_str());
+            const size_t pos = (hash / c) & (maskWords - 1);
+            HashWord V = (static_cast<HashWord>(1) << (hash % c)) |
+                         (static_cast<HashWord>(1) << ((hash >> shift2) % c));
+            bloomFilters[pos] |= V;
+        }
+
+
+        // Write buckets and hash
+        int previousBucket = -1;
+        size_t hashValueIdx = 0;
+        std::vector<uint32_t> buckets(nBuckets, 0);
+        std::vector<uint32_t> hashValues(symbols.size() - symndx, 0);
+
+        for (size_t i = symndx; i < symbols.size(); ++i) {
+            const uint32_t hash = LIEF::ELF::dl_new_hash(symbols[i].name.c_str());
+            int bucket = (int) (hash % nBuckets);
+            if (bucket < previousBucket)
+                throw std::runtime_error("Previous bucket is greater than the current one");
+
+            if (bucket != previousBucket) {
+                buckets[bucket] = i;
+                previousBucket = bucket;
+                if (hashValueIdx > 0) {
+                    hashValues[hashValueIdx - 1] |= 1;
+                }
+            }
+
+            hashValues[hashValueIdx] = hash & ~1;
+            ++hashValueIdx;
+        }
+
+        if (hashValueIdx > 0) {
+            hashValues[hashValueIdx - 1] |= 1;
+        }
+
+        std::vector<uint8_t> data;
+        data.resize(
+                sizeof(uint32_t) * 4 +
+                sizeof(HashWord) * bloomFilters.size() +
+                sizeof(uint32_t) * buckets.size() +
+                sizeof(uint32_t) * hashValues.size());
+
+        auto header = (uint32_t*) &data[0];
+        header[0] = nBuckets;
+        header[1] = symndx;
+        header[2] = maskWords;
+        header[3] = shift2;
+
+        auto dataBloomFilters = (HashWord*) &header[4];
+        memcpy(dataBloomFilters, bloomFilters.data(), sizeof(HashWord) * bloomFilters.size());
+
+        auto dataBucketData = (uint32_t*) &dataBloomFilters[bloomFilters.size()];
+        memcpy(dataBucketData, buckets.data(), sizeof(uint32_t) * buckets.size());
+        memcpy(dataBucketData + buckets.size(), hashValues.data(), sizeof(uint32_t) * hashValues.size());
+
+        gnuHashSec->set_data((const char*) data.data(), data.size());
+    }
+
+    void buildDynsym(std::size_t exportSymbolStart) {
+        std::vector<Elf64_Sym> syms;
+
+        buildGnuHash(exportSymbolStart);
+
+        for (auto& sym : symbols) {
+            symbolMap[sym.name] = syms.size();
+            syms.push_back({(Elf_Word) dynstr.add(sym.name), sym.st_info, 0, sym.shndx, sym.value, sym.size});
+        }
+
+        dynsymSec->set_data((const char*) syms.data(), syms.size() * sizeof(Elf64_Sym));
+    }
+
+    std::size_t addRelocation(Elf64_Addr offset, Elf64_Word symbol, Elf64_Word type, Elf_Sxword addend = 0) {
+        auto ret = rela.size();
+        rela.push_back({offset, ((Elf_Xword) symbol << 32) | type, addend});
+        return ret;
+    }
+
+    void updateRelocationOffset(std::size_t index, Elf64_Addr offset) {
+        rela[index].r_offset = offset;
+    }
+
+    void updateRelocationAddend(std::size_t index, Elf_Sxword addend) {
+        rela[index].r_addend = addend;
+    }
+
+    void buildDynRela() {
+        relaDynSec->set_data((const char*) rela.data(), rela.size() * sizeof(Elf64_Rela));
+    }
+
+    void setFinalizer(Elf64_Addr addr) {
+        dyn[tagFini].d_un.d_ptr = addr;
+    }
+
+    void finalize() {
+        dynstrSec->set_data(dynstr.data());
+    }
+
+    void fixup() {
+        dyn[tagDynStr].d_un.d_ptr = dynstrSec->get_address();
+        dyn[tagDynStrSz].d_un.d_ptr = dynstrSec->get_size();
+        dyn[tagDynSym].d_un.d_ptr = dynsymSec->get_address();
+        dyn[tagGnuHash].d_un.d_ptr = gnuHashSec->get_address();
+        dyn[tagDynRela].d_un.d_ptr = relaDynSec->get_address();
+        dyn[tagDynRelaSz].d_un.d_ptr = relaDynSec->get_size();
+        dynamicSec->set_data((const char*) dyn.data(), dyn.size() * sizeof(Elf64_Dyn));
+        relaDynSec->set_data((const char*) rela.data(), rela.size() * sizeof(Elf64_Rela));
+    }
+
+};
+
+struct EmbeddedCodeBuilder {
+
+    struct PlacedBlob {
+        EmbeddedBlob const* blob;
+        std::size_t textOffset;
+        std::size_t dataOffset;
+        std::size_t firstFixup; // index of the blob's first entry in dataRelocations
+    };
+
+    section* dataSec;
+    section* textSec;
+    std::vector<uint8_t> embeddedBlobData;
+    std::vector<PlacedBlob> blobs;
+    std::vector<std::size_t> dataRelocations; // dynamic relocation index of every data fixup, or -1 for text fixups
+    std::unordered_map<std::string_view, std::size_t> inlineSymbols; // text offset of every in-image shim
+    std::vector<std::pair<std::size_t, Elf_Sxword>> inlineSymbolRelocations; // addend is relative to .compat.text
+
+    void build(elfio& writer, DynBuilder& dyn, bool inlineShims) {
+        dataSec = writer.sections.add(".compat.data");
+        dataSec->set_type(SHT_PROGBITS);
+        dataSec->set_flags(SHF_ALLOC);
+        dataSec->set_addr_align(8);
+
+        textSec = writer.sections.add(".compat.text");
+        textSec->set_type(SHT_PROGBITS);
+        textSec->set_flags(SHF_ALLOC);
+        textSec->set_addr_align(16);
+
+        std::size_t dataSize = 0;
+        auto place = [&](EmbeddedBlob const& blob) -> PlacedBlob& {
+            auto textOffset = (embeddedBlobData.size() + 15) & ~(std::size_t) 15;
+            dataSize = (dataSize + 7) & ~(std::size_t) 7;
+            embeddedBlobData.resize(textOffset, 0xcc);
+            embeddedBlobData.insert(embeddedBlobData.end(), blob.code, blob.code + blob.codeSize);
+            blobs.push_back({&blob, textOffset, dataSize, 0});
+            dataSize += blob.dataSize;
+            return blobs.back();
+        };
+        place(embedded_blob::blob);
+        if (inlineShims) {
+            auto& shims = place(embedded_shims::blob);
+            for (std::size_t i = 0; i < shims.blob->symbolCount; i++)
+                inlineSymbols[shims.blob->symbols[i].name] = shims.textOffset + shims.blob->symbols[i].offset;
+        }
+
+        std::string dataData;
+        dataData.resize(dataSize);
+        dataSec->set_data(dataData);
+        textSec->set_size(embeddedBlobData.size());
+
+        std::unordered_set<std::string_view> imports;
+        for (auto const& placed : blobs) {
+            for (std::size_t i = 0; i < placed.blob->fixupCount; i++) {
+                auto const& f = placed.blob->fixups[i];
+                if (f.kind == EmbeddedFixupKind::DataAbs64Import && imports.insert(f.symbol).second)
+                    dyn.addSymbol(f.symbol, ELF_ST_INFO(STB_GLOBAL, STT_FUNC));
+            }
+        }
+    }
+
+    bool isInlineSymbol(std::string const& name) const {
+        return inlineSymbols.count(name) != 0;
+    }
+
+    // Binds a pointer of the image to one of the in-image shims, the address is only known after layout
+    void addInlineSymbolRelocation(DynBuilder& dyn, Elf64_Addr address, std::string const& name, Elf_Sxword addend) {
+        auto index = dyn.addRelocation(address, 0, ELFIO::R_X86_64_RELATIVE, 0);
+        inlineSymbolRelocations.emplace_back(index, (Elf_Sxword) inlineSymbols.at(name) + addend);
+    }
+
+    void createRelocations(DynBuilder& dyn, Elf64_Addr base, Elf64_Addr oldEntrypoint) {
+        // The offsets are only known after layout, fixup() updates them
+        for (auto& placed : blobs) {
+            placed.firstFixup = dataRelocations.size();
+            for (std::size_t i = 0; i < placed.blob->fixupCount; i++) {
+                auto const& f = placed.blob->fixups[i];
+                switch (f.kind) {
+                    case EmbeddedFixupKind::TextPcRel32ToData:
+                        dataRelocations.push_back((std::size_t) -1);
+                        break;
+                    case EmbeddedFixupKind::DataAbs64Import:
+                        dataRelocations.push_back(dyn.addRelocation(0, dyn.symbolMap.at(f.symbol), ELFIO::R_X86_64_64, f.target));
+                        break;
+                    case EmbeddedFixupKind::DataAbs64EntryPoint:
+                        dataRelocations.push_back(dyn.addRelocation(0, 0, ELFIO::R_X86_64_RELATIVE, (Elf_Sxword) oldEntrypoint + f.target));
+                        break;
+                    case EmbeddedFixupKind::DataAbs64ImageBase:
+                        dataRelocations.push_back(dyn.addRelocation(0, 0, ELFIO::R_X86_64_RELATIVE, (Elf_Sxword) base + f.target));
+                        break;
+                }
+            }
+        }
+    }
+
+    void fixup(DynBuilder& dyn) {
+        for (auto const& placed : blobs) {
+            auto codeAddr = textSec->get_address() + placed.textOffset;
+            auto dataAddr = dataSec->get_address() + placed.dataOffset;
+            for (std::size_t i = 0; i < placed.blob->fixupCount; i++) {
+                auto const& f = placed.blob->fixups[i];
+                if (f.kind == EmbeddedFixupKind::TextPcRel32ToData) {
+                    auto value = (uint32_t) (dataAddr + f.target - (codeAddr + f.offset));
+                    memcpy(&embeddedBlobData[placed.textOffset + f.offset], &value, sizeof(value));
+                } else {
+                    dyn.updateRelocationOffset(dataRelocations[placed.firstFixup + i], dataAddr + f.offset);
+                }
+            }
+        }
+        textSec->set_data((const char*) embeddedBlobData.data(), embeddedBlobData.size());
+
+        for (auto const& [index, addend] : inlineSymbolRelocations)
+            dyn.updateRelocationAddend(index, (Elf_Sxword) textSec->get_address() + addend);
+
+        dyn.setFinalizer(getSymAddr(embedded_blob::symbol_finalize));
+    }
+
+    // Takes one of the embedded_blob::symbol_* offsets
+    Elf64_Addr getSymAddr(std::size_t symbolOffset) const {
+        return textSec->get_address() + blobs[0].textOffset + symbolOffset;
+    }
+
+};
+
+class SectionHelper {
+
+private:
+    std::vector<std::tuple<Elf64_Addr, Elf64_Addr, section*>> sections;
+    int cachedIndex = 0;
+
+public:
+    void addSection(section* s) {
+        sections.emplace_back(s->get_address(), s->get_address() + s->get_size(), s);
+    }
+
+    section* findSectionByVA(Elf64_Addr addr) {
+        Elf64_Addr start, end;
+        if (cachedIndex < sections.size()) {
+            std::tie(start, end, std::ignore) = sections[cachedIndex];
+            if (addr >= start && addr < end)
+                return std::get<2>(sections[cachedIndex]);
+        }
+        for (int i = 0; i < (int)sections.size(); i++) {
+            std::tie(start, end, std::ignore) = sections[i];
+            if (addr >= start && addr < end) {
+                cachedIndex = i;
+                return std::get<2>(sections[i]);
+            }
+        }
+        return nullptr;
+    }
+
+};
+
+struct EhFrameBuilder {
+
+    section* hdrSec;
+    std::vector<uint8_t> data;
+
+    void build(elfio& writer, std::vector<std::pair<uint32_t, uint32_t>> const& map) {
+        hdrSec = writer.sections.add(".eh_frame_hdr");
+        hdrSec->set_type(SHT_PROGBITS);
+        hdrSec->set_flags(SHF_ALLOC);
+        hdrSec->set_addr_align(4);
+        hdrSec->set_size(12 + map.size() * 8);
+    }
+
+    void writeAtFixup(section* ehFrameSec, std::vector<std::pair<uint32_t, uint32_t>> const& map) {
+        std::vector<uint8_t> data (12 + map.size() * 8);
+
+        data[0] = 1; // version: 1
+        data[1] = 0x1B; // eh_frame ptr encoding: rel int32
+        data[2] = 3; // fde count encoding: uint32
+        data[3] = 0x3B; // binary table encoding: rel
+        (uint32_t&)data[4] = (ehFrameSec ? ehFrameSec->get_address() : 0) - (hdrSec->get_address() + 4);
+        (uint32_t&)data[8] = map.size();
+        int32_t* table = (int32_t*) &data[12];
+        int32_t funcAddrAdjust = -hdrSec->get_address();
+        int32_t frameAddrAdjust = ehFrameSec->get_address() - hdrSec->get_address();
+        for (auto const& it : map) {
+            *table++ = it.first + funcAddrAdjust;
+            *table++ = it.second + frameAddrAdjust;
+        }
+
+        hdrSec->set_data((const char*) data.data(), data.size());
+    }
+
+};
+
+// Consumed by macoscompat/unwind.cpp, keep in sync
+static constexpr Elf_Word PT_COMPAT_UNWIND_INFO = 0x6d326501;
+
+struct CompactUnwindIndexBuilder {
+
+    static constexpr std::size_t HEADER_SIZE = 24;
+
+    section* sec;
+    segment* seg;
+    std::vector<uint8_t> data;
+
+    void build(elfio& writer, UnwindRewriter const& unwindRewriter) {
+        auto table = unwindRewriter.buildCompactIndex();
+        data.resize(HEADER_SIZE + table.size());
+        memcpy(&data[HEADER_SIZE], table.data(), table.size());
+
+        sec = writer.sections.add(".compat.unwind_info");
+        sec->set_type(SHT_PROGBITS);
+        sec->set_flags(SHF_ALLOC);
+        sec->set_addr_align(8);
+        sec->set_size(data.size());
+
+        seg = writer.segments.add();
+        seg->set_type(PT_COMPAT_UNWIND_INFO);
+        seg->set_flags(PF_R);
+        seg->set_align(8);
+        seg->set_memory_size(data.size());
+        seg->set_file_size(data.size());
+    }
+
+    void writeAtFixup(Elf64_Addr base, section* ehFrameSec) {
+        (uint32_t&)data[0] = 1; // version
+        (uint32_t&)data[4] = data.size() - HEADER_SIZE;
+        (uint64_t&)data[8] = base;
+        (uint64_t&)data[16] = ehFrameSec->get_address();
+        sec->set_data((const char*) data.data(), data.size());
+
+        seg->set_virtual_address(sec->get_address());
+        seg->set_physical_address(sec->get_address());
+        seg->set_offset(sec->get_offset());
+    }
+
+};
+
+// Consumed by macoscompat/dyld.cpp (getsectdata), keep in sync
+static constexpr Elf_Word PT_COMPAT_SECTIONS = 0x6d326502;
+
+// Table of the original Mach-O sections: a version and count header followed by { segname[16], sectname[16], address,
+// size } entries, named like in section_64 so that lookups by segment and section name keep working
+struct SectionTableBuilder {
+
+    static constexpr std::size_t HEADER_SIZE = 8;
+    static constexpr std::size_t ENTRY_SIZE = 48;
+
+    section* sec;
+    segment* seg;
+
+    void build(elfio& writer, LIEF::MachO::Binary& binary) {
+        std::vector<uint8_t> data (HEADER_SIZE);
+        uint32_t count = 0;
+        for (const auto& section : binary.sections()) {
+            auto off = data.size();
+            data.resize(off + ENTRY_SIZE);
+            auto segName = section.segment_name();
+            auto sectName = section.name();
+            memcpy(&data[off], segName.data(), std::min<std::size_t>(segName.size(), 16));
+            memcpy(&data[off + 16], sectName.data(), std::min<std::size_t>(sectName.size(), 16));
+            (uint64_t&)data[off + 32] = section.address();
+            (uint64_t&)data[off + 40] = section.size();
+            ++count;
+        }
+        (uint32_t&)data[0] = 1; // version
+        (uint32_t&)data[4] = count;
+
+        sec = writer.sections.add(".compat.sections");
+        sec->set_type(SHT_PROGBITS);
+        sec->set_flags(SHF_ALLOC);
+        sec->set_addr_align(8);
+        sec->set_data((const char*) data.data(), data.size());
+
+        seg = writer.segments.add();
+        seg->set_type(PT_COMPAT_SECTIONS);
+        seg->set_flags(PF_R);
+        seg->set_align(8);
+        seg->set_memory_size(data.size());
+        seg->set_file_size(data.size());
+    }
+
+    void writeAtFixup() {
+        seg->set_virtual_address(sec->get_address());
+        seg->set_physical_address(sec->get_address());
+        seg->set_offset(sec->get_offset());
+    }
+
+};
+
+// Mach-O thread local variable descriptors are { thunk, key, offset } triples whose key dyld fills in at load time.
+// Here the key of every descriptor points to a per-image record instead, which _tlv_bootstrap in macoscompat/dyld.s
+// uses to find the thread's copy of the image's TLV template. Keep the layout in sync with macoscompat/dyld.cpp.
+struct ThreadLocalBuilder {
+
+    static constexpr std::size_t DESCRIPTOR_SIZE = 24;
+    static constexpr std::size_t RECORD_SIZE = 32; // slot, template address, template size, total size
+    static constexpr int ALIGNMENT_SHIFT = 56; // log2 of the largest section alignment, in the top byte of total size
+
+    section* sec = nullptr;
+    std::vector<Elf64_Addr> descriptorKeys;
+    Elf64_Addr templateStart = 0;
+    uint64_t templateSize = 0, totalSize = 0;
+    uint32_t alignmentLog2 = 0;
+    std::vector<std::size_t> relocations; // descriptor keys followed by the record's template address
+
+    bool empty() const {
+        return descriptorKeys.empty();
+    }
+
+    void build(elfio& writer, LIEF::MachO::Binary& binary) {
+        Elf64_Addr start = UINT64_MAX, initializedEnd = 0, end = 0;
+        for (const auto& section : binary.sections()) {
+            switch (section.type()) {
+                case LIEF::MachO::MACHO_SECTION_TYPES::S_THREAD_LOCAL_VARIABLES:
+                    for (uint64_t off = 0; off + DESCRIPTOR_SIZE <= section.size(); off += DESCRIPTOR_SIZE)
+                        descriptorKeys.push_back(section.address() + off + 8);
+                    break;
+                case LIEF::MachO::MACHO_SECTION_TYPES::S_THREAD_LOCAL_REGULAR:
+                    initializedEnd = std::max(initializedEnd, section.address() + section.size());
+                    [[fallthrough]];
+                case LIEF::MachO::MACHO_SECTION_TYPES::S_THREAD_LOCAL_ZEROFILL:
+                    start = std::min(start, section.address());
+                    end = std::max(end, section.address() + section.size());
+                    alignmentLog2 = std::max(alignmentLog2, section.alignment());
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (descriptorKeys.empty())
+            return;
+        if (start < end) {
+            templateStart = start;
+            templateSize = initializedEnd > start ? initializedEnd - start : 0;
+            totalSize = end - start;
+        }
+
+        sec = writer.sections.add(".compat.tlv");
+        sec->set_type(SHT_PROGBITS);
+        sec->set_flags(SHF_ALLOC | SHF_WRITE);
+        sec->set_addr_align(8);
+        sec->set_size(RECORD_SIZE);
+    }
+
+    void createRelocations(DynBuilder& dyn) {
+        // The record's address is only known after layout, writeAtFixup() sets the addends
+        for (auto key : descriptorKeys)
+            relocations.push_back(dyn.addRelocation(key, 0, ELFIO::R_X86_64_RELATIVE, 0));
+        relocations.push_back(dyn.addRelocation(0, 0, ELFIO::R_X86_64_RELATIVE, (Elf_Sxword) templateStart));
+    }
+
+    void writeAtFixup(DynBuilder& dyn) {
+        uint64_t data[RECORD_SIZE / 8] = {0, templateStart, templateSize, totalSize | (uint64_t) alignmentLog2 << ALIGNMENT_SHIFT};
+        sec->set_data((const char*) data, sizeof(data));
+
+        for (std::size_t i = 0; i < descriptorKeys.size(); i++)
+            dyn.updateRelocationAddend(relocations[i], (Elf_Sxword) sec->get_address());
+        dyn.updateRelocationOffset(relocations.back(), sec->get_address() + 8);
+    }
+
+};
+
+struct Converter::State {
+
+    ConverterOptions options;
+    TranslationHelper trHelper;
+    std::unique_ptr<LIEF::MachO::FatBinary> macho;
+    LIEF::MachO::Binary* binary = nullptr;
+    bool isExe = false;
+
+    elfio writer;
+    std::unordered_map<LIEF::MachO::Section const*, section*> sectionMap;
+    SectionHelper sectionVaHelper;
+    section* elfInitSec = nullptr;
+    Elf64_Addr ourBase = 0;
+
+    DynBuilder dyn;
+    EmbeddedCodeBuilder embeddedCode;
+
+    std::unique_ptr<UnwindRewriter> unwindRewriter;
+    EhFrameBuilder ehFrameBuilder;
+    section* ehFrameSec = nullptr;
+    std::unique_ptr<SFrameWriter> sframeWriter;
+    section* sframeSec = nullptr;
+    CompactUnwindIndexBuilder compactIndexBuilder;
+    ThreadLocalBuilder threadLocals;
+    SectionTableBuilder sectionTable;
+
+    segment* cEhFrame = nullptr;
+    segment* cSFrame = nullptr;
+
+    ConversionStats stats;
+
+    explicit State(ConverterOptions options) : options(std::move(options)) {}
+
+    void parse() {
+        if (options.translationPath.empty())
+            trHelper.load(std::string_view(translation_txt, translation_txt_size));
+        else
+            trHelper.loadFile(options.translationPath);
+
+        macho = LIEF::MachO::Parser::parse(options.inputPath);
+        if (!macho || macho->size() == 0)
+            throw std::runtime_error("Failed to parse " + options.inputPath);
+        LOG_INFO("Binary count: " << macho->size());
+        binary = macho->at(0);
+
+        isExe = binary->header().file_type() == LIEF::MachO::FILE_TYPES::MH_EXECUTE;
+
+        for (const auto& cmd : binary->commands()) {
+            if (cmd.command() == LIEF::MachO::LOAD_COMMAND_TYPES::LC_SEGMENT_64) {
+                auto seg = static_cast<const LIEF::MachO::SegmentCommand*>(&cmd);
+                if (!seg->sections().empty()) {
+                    LOG_INFO("Using " << std::hex << seg->virtual_address() << " as base");
+                    writer.set_base(seg->virtual_address());
+                    break;
+                }
+            }
+        }
+        setup_elf(writer, isExe);
+
+        stats.count("load_commands", binary->commands().size());
+        stats.count("macho_sections", binary->sections().size());
+    }
+
+    void convertSections() {
+        LOG_DEBUG("== Sections ==");
+        for (const auto& section : binary->sections()) {
+            LOG_DEBUG(section);
+            auto name = section.name();
+            if (name[0] == '_' && name[1] == '_') {
+                name[1] = '.';
+                name = name.substr(1);
+            }
+            if (name == ".eh_frame")
+                name = ".eh_frame_bak";
+            auto elfSection = writer.sections.add(name);
+            elfSection->set_type(convert_section_type(section.type()));
+            Elf_Xword flags = SHF_ALLOC;
+            if (section.flags() & (uint32_t) LIEF::MachO::MACHO_SECTION_FLAGS::S_ATTR_SOME_INSTRUCTIONS)
+                flags |= SHF_EXECINSTR;
+            elfSection->set_flags(flags);
+            elfSection->set_addr_align(1 << section.alignment());
+            elfSection->set_address(section.address());
+            elfSection->set_data((const char*) section.content().data(), section.content().size());
+            elfSection->set_size(section.size());
+            sectionMap[&section] = elfSection;
+            sectionVaHelper.addSection(elfSection);
+
+            if (section.type() == LIEF::MachO::MACHO_SECTION_TYPES::S_MOD_INIT_FUNC_POINTERS)
+                elfInitSec = elfSection;
+        }
+
+        LOG_DEBUG("== Segments ==");
+        for (const auto& cmd : binary->commands()) {
+            if (cmd.command() == LIEF::MachO::LOAD_COMMAND_TYPES::LC_SEGMENT_64) {
+                auto seg = static_cast<const LIEF::MachO::SegmentCommand*>(&cmd);
+                LOG_DEBUG("Segment64:");
+
+                segment* elfSeg = nullptr;
+                for (auto& sec : seg->sections()) {
+                    auto elfSec = sectionMap.find(&sec);
+                    if (elfSec != sectionMap.end()) {
+                        if (!elfSeg) {
+                            elfSeg = writer.segments.add();
+                            elfSeg->set_type(PT_LOAD);
+                            elfSeg->set_virtual_address(seg->virtual_address());
+                            elfSeg->set_physical_address(seg->virtual_address());
+                            elfSeg->set_memory_size(seg->virtual_size());
+                            elfSeg->set_flags(map_prot((LIEF::MachO::VM_PROTECTIONS) seg->init_protection()));
+                            elfSeg->set_align(0x1000);
+                            if (seg->virtual_address() == writer.get_base()) {
+                                elfSeg->add_section(writer.sections[0], writer.sections[0]->get_addr_align()); // elf header
+                                elfSeg->add_section(writer.sections[2], writer.sections[2]->get_addr_align()); // interp
+                            }
+                        }
+                        LOG_DEBUG("  " << sec.name());
+                        elfSeg->add_section(elfSec->second, elfSec->second->get_addr_align());
+                    }
+                }
+
+                if (seg->virtual_address() + seg->virtual_size() > ourBase)
+                    ourBase = seg->virtual_address() + seg->virtual_size();
+            }
+        }
+        ourBase = (ourBase + 0xfffu) &~ 0xfffLLu;
+
+        sectionTable.build(writer, *binary);
+
+        stats.count("mapped_sections", sectionMap.size());
+        stats.count("mapped_segments", writer.segments.size());
+    }
+
+    void buildDynamicSymbols() {
+        std::vector<std::string> neededLibs;
+        neededLibs.emplace_back("libc.so.6");
+        for (const auto& lib : binary->libraries()) {
+            trHelper.registerLibrary(lib, neededLibs);
+        }
+
+        dyn.build(writer, ourBase, neededLibs, elfInitSec);
+
+        embeddedCode.build(writer, dyn, options.inlineShims);
+
+        const auto getSymbolInfo = [](uint16_t desc, bool isObj = false) -> unsigned char {
+            auto isWeak = desc & ((uint32_t)LIEF::MachO::SYMBOL_DESCRIPTIONS::N_WEAK_REF | (uint32_t)LIEF::MachO::SYMBOL_DESCRIPTIONS::N_WEAK_DEF);
+            isObj |= desc & 0x800u;
+            return ELF_ST_INFO(isWeak ? STB_WEAK : STB_GLOBAL, isObj ? STT_OBJECT : STT_FUNC);
+        };
+
+    //    for (const auto& symbol : binary->symbols()) {
+        size_t bindingCount = 0, missingSymbolCount = 0;
+        for (const auto& binding : binary->dyld_info()->bindings()) {
+            const auto& symbol = *binding.symbol();
+            auto targetName = trHelper.mapSymbol(binding).targetName;
+            ++bindingCount;
+            if (targetName.empty()) {
+                LOG_WARNING("Missing symbol: " << (binding.library() ? binding.library()->name() : "null") << ' ' << symbol.name());
+                ++missingSymbolCount;
+                continue;
+            }
+            if (embeddedCode.isInlineSymbol(targetName))
+                continue;
+            dyn.addSymbol(targetName, getSymbolInfo(symbol.description()), 0, 0, symbol.size());
+        }
+        auto exportedSymbolStart = dyn.getSymbolCount();
+        for (const auto& symbol : binary->exported_symbols()) {
+            auto section = sectionVaHelper.findSectionByVA(symbol.value());
+            if (section == nullptr) {
+                LOG_WARNING("Missing section for exported symbol " << symbol.name() << ' ' << std::hex << symbol.value());
+                continue;
+            }
+            auto sectionNdx = section ? section->get_index() : 0;
+            auto name = symbol.name();
+            if (name[0] == '_')
+                name = name.substr(1);
+            auto useAsObj = section->get_name() != "__text"; //TODO:
+            dyn.addSymbol(name, getSymbolInfo(symbol.description(), useAsObj), sectionNdx, symbol.value(), symbol.size());
+        }
+        dyn.buildDynsym(exportedSymbolStart);
+
+        stats.count("needed_libraries", neededLibs.size());
+        stats.count("macho_bindings", bindingCount);
+        stats.count("missing_symbols", missingSymbolCount);
+        stats.count("exports", dyn.getSymbolCount() - exportedSymbolStart);
+        stats.count("dynsym_entries", dyn.getSymbolCount());
+    }
+
+    void buildRelocations() {
+        embeddedCode.createRelocations(dyn, writer.get_base(), binary->has_entrypoint() ? binary->entrypoint() : writer.get_base());
+
+        threadLocals.build(writer, *binary);
+        if (!threadLocals.empty())
+            threadLocals.createRelocations(dyn);
+
+        size_t rebaseCount = 0, boundRelocationCount = 0, inlineShimBindingCount = 0;
+        for (const auto& reloc : binary->relocations()) {
+    //        std::cout << reloc << "\n";
+            switch ((LIEF::MachO::REBASE_TYPES) reloc.type()) {
+                case LIEF::MachO::REBASE_TYPES::REBASE_TYPE_POINTER: {
+                    auto data = binary->get_content_from_virtual_address(reloc.address(), 8);
+                    dyn.addRelocation(reloc.address(), 0, ELFIO::R_X86_64_RELATIVE, *(Elf_Sxword *)data.data());
+                    ++rebaseCount;
+                    break;
+                }
+                default:
+                    abort();
+            }
+        }
+
+        for (const auto& binding : binary->dyld_info()->bindings()) {
+            Elf64_Word type;
+
+            switch (binding.binding_type()) {
+                case LIEF::MachO::BIND_TYPES::BIND_TYPE_POINTER:
+                    type = ELFIO::R_X86_64_64;
+                    break;
+                default:
+                    abort();
+            }
+    //        std::cout << binding.binding_type() << "\n";
+    //        std::cout << *binding.symbol() << binding.symbol()->type() << "\n";
+
+            auto name = trHelper.mapSymbol(binding).targetName;
+            if (name.empty())
+                continue;
+            if (embeddedCode.isInlineSymbol(name)) {
+                embeddedCode.addInlineSymbolRelocation(dyn, binding.address(), name, binding.addend());
+                ++inlineShimBindingCount;
+                continue;
+            }
+            auto symbol = dyn.symbolMap.find(name);
+            if (symbol != dyn.symbolMap.end()) {
+                dyn.addRelocation(binding.address(), symbol->second, type, binding.addend());
+                ++boundRelocationCount;
+            }
+        }
+        dyn.buildDynRela();
+
+        stats.count("rebases", rebaseCount);
+        stats.count("bound_relocations", boundRelocationCount);
+        stats.count("inline_shim_bindings", inlineShimBindingCount);
+        stats.count("tlv_descriptors", threadLocals.descriptorKeys.size());
+        stats.count("relocations", dyn.getRelocationCount());
+    }
+
+    void convertUnwindInfo() {
+        CompactUnwindInfo compactUnwindInfo;
+        auto compactUnwindStatus = decodeCompactUnwindTable(*binary, compactUnwindInfo);
+        if (compactUnwindStatus != ParseStatus::Ok)
+            LOG_WARNING("Failed to decode __unwind_info (" << parseStatusToString(compactUnwindStatus) << "), only " << compactUnwindInfo.entries.size() << " entries were decoded");
+
+        unwindRewriter = std::make_unique<UnwindRewriter>(writer.get_base());
+        unwindRewriter->convert(*binary, compactUnwindInfo);
+
+        ehFrameBuilder.build(writer, unwindRewriter->searchMap);
+
+        ehFrameSec = writer.sections.add(".eh_frame");
+        ehFrameSec->set_type(SHT_PROGBITS);
+        ehFrameSec->set_flags(SHF_ALLOC);
+        ehFrameSec->set_addr_align(8);
+        ehFrameSec->set_size(unwindRewriter->size());
+
+        if (options.emitSFrame) {
+            sframeWriter = std::make_unique<SFrameWriter>(writer.get_base());
+            sframeWriter->build(*binary, unwindRewriter->frameLayouts);
+            sframeSec = writer.sections.add(".sframe");
+            sframeSec->set_type(SHT_GNU_SFRAME);
+            sframeSec->set_flags(SHF_ALLOC);
+            sframeSec->set_addr_align(8);
+            sframeSec->set_size(sframeWriter->size());
+        }
+
+        if (options.emitCompactUnwindIndex)
+            compactIndexBuilder.build(writer, *unwindRewriter);
+
+        auto fdeCounts = unwindRewriter->countIndexedFdes();
+        stats.count("compact_entries", compactUnwindInfo.entries.size());
+        stats.count("parsed_fdes", unwindRewriter->parsedFdeCount());
+        stats.count("synthesized_fdes", fdeCounts.synthesized);
+        stats.count("indexed_original_fdes", fdeCounts.original);
+        stats.count("indexed_compact_dwarf_fdes", fdeCounts.compactDwarfReferences);
+        stats.count("eh_frame_bytes", unwindRewriter->size());
+    }
+
+    void layout() {
+        auto cLoadData = writer.segments.add();
+        cLoadData->set_type(PT_LOAD);
+        cLoadData->set_flags(PF_R | PF_W);
+        cLoadData->add_section(dyn.dynamicSec, 8);
+        cLoadData->add_section(dyn.dynstrSec, 8);
+        cLoadData->add_section(dyn.dynsymSec, 8);
+        cLoadData->add_section(dyn.gnuHashSec, 8);
+        cLoadData->add_section(dyn.relaDynSec, 8);
+        cLoadData->add_section(ehFrameSec, 8);
+        cLoadData->add_section(ehFrameBuilder.hdrSec, 8);
+        if (sframeSec)
+            cLoadData->add_section(sframeSec, 8);
+        if (options.emitCompactUnwindIndex)
+            cLoadData->add_section(compactIndexBuilder.sec, 8);
+        cLoadData->add_section(embeddedCode.dataSec, 8);
+        cLoadData->add_section(sectionTable.sec, 8);
+        if (!threadLocals.empty())
+            cLoadData->add_section(threadLocals.sec, 8);
+        cLoadData->set_virtual_address(ourBase);
+        cLoadData->set_physical_address(ourBase);
+        cLoadData->set_align(0x1000);
+
+        auto cLoadText = writer.segments.add();
+        cLoadText->set_type(PT_LOAD);
+        cLoadText->set_flags(PF_R | PF_X);
+        cLoadText->set_align(0x1000);
+        cLoadText->add_section(embeddedCode.textSec, 16);
+        cLoadText->set_virtual_address((Elf64_Addr)-1);
+        cLoadText->set_physical_address((Elf64_Addr)-1);
+
+        cEhFrame = writer.segments.add();
+        cEhFrame->set_type(PT_GNU_EH_FRAME);
+        cEhFrame->set_flags(PF_R);
+        cEhFrame->set_align(4);
+        cEhFrame->set_memory_size(ehFrameBuilder.hdrSec->get_size());
+        cEhFrame->set_file_size(ehFrameBuilder.hdrSec->get_size());
+
+        if (sframeSec) {
+            cSFrame = writer.segments.add();
+            cSFrame->set_type(PT_GNU_SFRAME);
+            cSFrame->set_flags(PF_R);
+            cSFrame->set_align(8);
+            cSFrame->set_memory_size(sframeSec->get_size());
+            cSFrame->set_file_size(sframeSec->get_size());
+        }
+
+        dyn.finalize();
+
+        writer.layout();
+        cEhFrame->set_virtual_address(ehFrameBuilder.hdrSec->get_address());
+        cEhFrame->set_physical_address(ehFrameBuilder.hdrSec->get_address());
+        cEhFrame->set_offset(ehFrameBuilder.hdrSec->get_offset());
+        if (cSFrame) {
+            cSFrame->set_virtual_address(sframeSec->get_address());
+            cSFrame->set_physical_address(sframeSec->get_address());
+            cSFrame->set_offset(sframeSec->get_offset());
+        }
+
+        embeddedCode.fixup(dyn);
+        if (!threadLocals.empty())
+            threadLocals.writeAtFixup(dyn);
+        dyn.fixup();
+    /*
+        section* ehFrameSec = nullptr;
+        for (auto& s : sectionMap) {
+            if (s.second->get_name() == ".eh_frame_bak")
+                ehFrameSec = s.second;
+        }*/
+        unwindRewriter->fixup((uint32_t) (ehFrameSec->get_address() - writer.get_base()));
+        ehFrameSec->set_data((const char*) unwindRewriter->data().data(), unwindRewriter->size());
+        ehFrameBuilder.writeAtFixup(ehFrameSec, unwindRewriter->searchMap);
+        if (sframeSec) {
+            sframeWriter->fixup(sframeSec->get_address());
+            sframeSec->set_data((const char*) sframeWriter->data().data(), sframeWriter->size());
+        }
+        if (options.emitCompactUnwindIndex)
+            compactIndexBuilder.writeAtFixup(writer.get_base(), ehFrameSec);
+        sectionTable.writeAtFixup();
+
+        if (isExe)
+            writer.set_entry(embeddedCode.getSymAddr(embedded_blob::symbol_main));
+
+        stats.count("elf_sections", writer.sections.size());
+        stats.count("elf_segments", writer.segments.size());
+    }
+
+    void save() {
+        writer.save(options.outputPath);
+
+        for (auto& section : writer.sections) {
+            if (!section->get_name().empty())
+                stats.addOutputSection(section->get_name(), section->get_type() == SHT_NOBITS ? 0 : section->get_size());
+        }
+        std::error_code ec;
+        auto outputSize = std::filesystem::file_size(options.outputPath, ec);
+        stats.count("output_file_bytes", ec ? 0 : outputSize);
+
+        if (!Logger::isEnabled(LogLevel::Debug))
+            return;
+        LOG_DEBUG("=================");
+        LOG_DEBUG("Final ELF layout:");
+        LOG_DEBUG("=================");
+        LOG_DEBUG("Sections:");
+        for (auto& section : writer.sections) {
+            LOG_DEBUG(std::hex << section->get_address() << ' ' << section->get_offset() << ' ' << section->get_name());
+        }
+        LOG_DEBUG("Segments:");
+        for (auto& segment : writer.segments) {
+            LOG_DEBUG(std::hex << segment->get_virtual_address() << ' ' << segment->get_offset() << ' ' << segment->get_type());
+        }
+    }
+
+};
+
+Converter::Converter(ConverterOptions options) : state(std::make_unique<State>(std::move(options))) {}
+
+Converter::~Converter() = default;
+
+template <typename Fn>
+static void run_stage(ConversionStats& stats, const char* name, Fn fn) {
+    stats.beginStage(name);
+    fn();
+    stats.endStage();
+}
+
+void Converter::parse() {
+    run_stage(state->stats, "parse", [this] { state->parse(); });
+}
+
+void Converter::convertSections() {
+    run_stage(state->stats, "sections", [this] { state->convertSections(); });
+}
+
+void Converter::buildDynamicSymbols() {
+    run_stage(state->stats, "dynamic_symbols", [this] { state->buildDynamicSymbols(); });
+}
+
+void Converter::buildRelocations() {
+    run_stage(state->stats, "relocations", [this] { state->buildRelocations(); });
+}
+
+void Converter::convertUnwindInfo() {
+    run_stage(state->stats, "unwind", [this] { state->convertUnwindInfo(); });
+}
+
+void Converter::layout() {
+    run_stage(state->stats, "layout", [this] { state->layout(); });
+}
+
+void Converter::save() {
+    run_stage(state->stats, "save", [this] { state->save(); });
+}
+
+const ConverterOptions& Converter::getOptions() const {
+    return state->options;
+}
+
+const ConversionStats& Converter::getStats() const {
+    return state->stats;
+}
+
+void Converter::run() {
+    parse();
+    convertSections();
+    buildDynamicSymbols();
+    buildRelocations();
+    convertUnwindInfo();
+    layout();
+    save();
+}
+
+static Elf_Word convert_section_type(LIEF::MachO::MACHO_SECTION_TYPES type) {
+    switch (type) {
+        case LIEF::MachO::MACHO_SECTION_TYPES::S_MOD_INIT_FUNC_POINTERS:
+            return SHT_INIT_ARRAY;
+        case LIEF::MachO::MACHO_SECTION_TYPES::S_ZEROFILL:
+            return SHT_NOBITS;
+        default:
+            return SHT_PROGBITS;
+    }
+}
+
+static Elf_Word map_prot(LIEF::MachO::VM_PROTECTIONS prot) {
+    Elf_Word ret = 0;
+    if ((size_t) prot & (size_t) LIEF::MachO::VM_PROTECTIONS::VM_PROT_READ)
+        ret |= PF_R;
+    if ((size_t) prot & (size_t) LIEF::MachO::VM_PROTECTIONS::VM_PROT_WRITE)
+        ret |= PF_W;
+    if ((size_t) prot & (size_t) LIEF::MachO::VM_PROTECTIONS::VM_PROT_EXECUTE)
+        ret |= PF_X;
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "stats.h"
+
+struct ConverterOptions {
+    std::string inputPath;
+    std::string outputPath;
+    std::string translationPath; // the translation.txt built into the converter if empty
+    bool emitSFrame = false;
+    bool emitCompactUnwindIndex = false;
+    bool inlineShims = false; // place the shims from macoscompat/shims_inline.cpp in the image instead of importing them
+    bool emitStats = false;
+    std::string statsOutputPath; // stdout if empty
+};
+
+// Converts a single Mach-O image to an ELF. The stages have to be called in the order they are declared in, run()
+// does exactly that; they are exposed separately so that they can be timed individually. Every stage records its
+// resource usage and item counts in getStats().
+class Converter {
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+
+public:
+    explicit Converter(ConverterOptions options);
+    ~Converter();
+
+    void parse();
+    void convertSections();
+    void buildDynamicSymbols();
+    void buildRelocations();
+    void convertUnwindInfo();
+    void layout();
+    void save();
+
+    void run();
+
+    const ConverterOptions& getOptions() const;
+    const ConversionStats& getStats() const;
+
+};
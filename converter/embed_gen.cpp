@@ -0,0 +1,205 @@
+// Build time helper generating headers with data the converter embeds:
+//   embed_gen blob <namespace> <object> <output> .text bytes, .compat.data size, global symbols and fixups of
+//                                                an object linked into .compat.text/.compat.data of every image
+//   embed_gen text <identifier> <input> <output> contents of an arbitrary file
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <elfio/elfio.hpp>
+#include <elfio/elfio_symbols.hpp>
+#include <elfio/elfio_relocation.hpp>
+
+using namespace ELFIO;
+
+static void write_bytes(std::ostream& out, const char* type, std::string const& name, const char* data, std::size_t size) {
+    out << "constexpr " << type << ' ' << name << "[] = {";
+    for (std::size_t i = 0; i < size; i++) {
+        if (i % 16 == 0)
+            out << "\n   ";
+        char buf[8];
+        snprintf(buf, sizeof(buf), " 0x%02x,", (unsigned char) data[i]);
+        out << buf;
+    }
+    out << "\n};\n";
+}
+
+// Only touches the output if it changed, so that dependents are not rebuilt for nothing
+static void write_if_changed(std::string const& path, std::string const& content) {
+    {
+        std::ifstream fs (path, std::ios::binary);
+        if (fs && std::string(std::istreambuf_iterator<char>(fs), {}) == content)
+            return;
+    }
+    std::ofstream fs (path, std::ios::binary);
+    fs << content;
+    if (!fs)
+        throw std::runtime_error("Failed to write " + path);
+}
+
+struct BlobFixups {
+    std::ostringstream entries;
+    std::size_t count = 0;
+    std::size_t dataSize = 0;
+    std::map<std::string, std::size_t> gotSlots;
+
+    void add(Elf64_Addr offset, const char* kind, Elf_Sxword target, std::string const& symbol = std::string()) {
+        entries << "    {" << offset << ", EmbeddedFixupKind::" << kind << ", " << target << ", ";
+        if (symbol.empty())
+            entries << "nullptr";
+        else
+            entries << '"' << symbol << '"';
+        entries << "},\n";
+        ++count;
+    }
+
+    // GOT style references to imports get a pointer slot appended to .compat.data
+    std::size_t getGotSlot(std::string const& name) {
+        auto it = gotSlots.find(name);
+        if (it != gotSlots.end())
+            return it->second;
+        dataSize = (dataSize + 7) & ~(std::size_t) 7;
+        auto slot = dataSize;
+        dataSize += 8;
+        add(slot, "DataAbs64Import", 0, name);
+        gotSlots.emplace(name, slot);
+        return slot;
+    }
+};
+
+// Translates the relocations applying to the given section into fixups the converter understands
+static void add_fixups(BlobFixups& out, elfio& reader, section* relaSec, section* text, section* data) {
+    relocation_section_accessor relocations (reader, relaSec);
+    symbol_section_accessor symbols (reader, reader.sections[relaSec->get_link()]);
+    bool isText = relaSec->get_info() == text->get_index();
+
+    for (Elf_Xword i = 0; i < relocations.get_entries_num(); i++) {
+        Elf64_Addr offset;
+        Elf_Word symbolIndex;
+        unsigned char type;
+        Elf_Sxword addend;
+        if (!relocations.get_entry(i, offset, symbolIndex, type, addend))
+            throw std::runtime_error("Failed to read relocation " + std::to_string(i) + " of " + relaSec->get_name());
+
+        std::string name;
+        Elf64_Addr value;
+        Elf_Xword size;
+        unsigned char bind, symType, other;
+        Elf_Half sectionIndex;
+        if (!symbols.get_symbol(symbolIndex, name, value, size, bind, symType, sectionIndex, other))
+            throw std::runtime_error("Failed to read symbol " + std::to_string(symbolIndex) + " of relocation " + std::to_string(i) + " in " + relaSec->get_name());
+
+        bool isGotReference = type == R_X86_64_GOTPCREL || type == 41 /* R_X86_64_GOTPCRELX */ || type == 42 /* R_X86_64_REX_GOTPCRELX */;
+        if (isText && type == R_X86_64_PC32 && data && sectionIndex == data->get_index())
+            out.add(offset, "TextPcRel32ToData", (Elf_Sxword) (value + addend));
+        else if (isText && isGotReference && sectionIndex == SHN_UNDEF)
+            out.add(offset, "TextPcRel32ToData", (Elf_Sxword) out.getGotSlot(name) + addend);
+        else if (!isText && type == R_X86_64_64 && sectionIndex == SHN_UNDEF && name == "__macho_entry")
+            out.add(offset, "DataAbs64EntryPoint", addend);
+        else if (!isText && type == R_X86_64_64 && sectionIndex == SHN_UNDEF && name == "__image_base")
+            out.add(offset, "DataAbs64ImageBase", addend);
+        else if (!isText && type == R_X86_64_64 && sectionIndex == SHN_UNDEF)
+            out.add(offset, "DataAbs64Import", addend, name);
+        else
+            throw std::runtime_error("Unsupported relocation of type " + std::to_string((int) type) + " against '" + name + "' at " + std::to_string(offset) + " in " + relaSec->get_name());
+    }
+}
+
+static std::string generate_blob(std::string const& ns, std::string const& objectPath) {
+    elfio reader;
+    if (!reader.load(objectPath))
+        throw std::runtime_error("Failed to load " + objectPath);
+
+    section* text = nullptr;
+    section* data = nullptr;
+    section* symtab = nullptr;
+    std::vector<section*> relaSecs;
+    for (auto& sec : reader.sections) {
+        if (sec->get_name() == ".text")
+            text = sec;
+        else if (sec->get_name() == ".compat.data")
+            data = sec;
+        else if (sec->get_type() == SHT_SYMTAB)
+            symtab = sec;
+        else if (sec->get_type() == SHT_RELA)
+            relaSecs.push_back(sec);
+        else if (sec->get_type() == SHT_REL)
+            throw std::runtime_error("SHT_REL relocations are not supported");
+        else if ((sec->get_flags() & SHF_ALLOC) && sec->get_size() > 0 && sec->get_type() != SHT_NOTE)
+            throw std::runtime_error("Unsupported section " + sec->get_name() + ", only .text and .compat.data can be embedded");
+    }
+    if (!text || !symtab)
+        throw std::runtime_error("Missing .text or symbol table in " + objectPath);
+
+    BlobFixups fixups;
+    fixups.dataSize = data ? data->get_size() : 0;
+    for (auto relaSec : relaSecs) {
+        if (relaSec->get_info() == text->get_index() || (data && relaSec->get_info() == data->get_index()))
+            add_fixups(fixups, reader, relaSec, text, data);
+        else if (reader.sections[relaSec->get_info()]->get_flags() & SHF_ALLOC)
+            throw std::runtime_error("Relocations in unsupported section " + relaSec->get_name());
+    }
+
+    std::ostringstream out;
+    out << "// Generated by embed_gen from " << objectPath << ", do not edit\n";
+    out << "#pragma once\n\n#include <array>\n#include <cstddef>\n#include <cstdint>\n#include \"converter/embedded_blob_types.h\"\n\n";
+    out << "namespace " << ns << " {\n\n";
+    write_bytes(out, "uint8_t", "code", text->get_data(), text->get_size());
+    out << '\n';
+    // The data is written by the fixups alone, so only its size is needed
+    out << "constexpr std::size_t data_size = " << fixups.dataSize << ";\n\n";
+    out << "constexpr std::array<EmbeddedFixup, " << fixups.count << "> fixups = {{\n" << fixups.entries.str() << "}};\n\n";
+
+    std::ostringstream symbolEntries;
+    std::size_t symbolCount = 0;
+    symbol_section_accessor symbols (reader, symtab);
+    for (Elf_Xword i = 0; i < symbols.get_symbols_num(); i++) {
+        std::string name;
+        Elf64_Addr value;
+        Elf_Xword size;
+        unsigned char bind, type, other;
+        Elf_Half sectionIndex;
+        symbols.get_symbol(i, name, value, size, bind, type, sectionIndex, other);
+        if (bind != STB_GLOBAL || sectionIndex != text->get_index())
+            continue;
+        out << "constexpr std::size_t symbol_" << name << " = " << value << ";\n";
+        symbolEntries << "    {\"" << name << "\", " << value << "},\n";
+        ++symbolCount;
+    }
+    out << "\nconstexpr std::array<EmbeddedSymbol, " << symbolCount << "> symbols = {{\n" << symbolEntries.str() << "}};\n\n";
+    out << "constexpr EmbeddedBlob blob = {code, sizeof(code), data_size, fixups.data(), fixups.size(), symbols.data(), symbols.size()};\n";
+    out << "\n}\n";
+    return out.str();
+}
+
+static std::string generate_text(std::string const& identifier, std::string const& inputPath) {
+    std::ifstream fs (inputPath, std::ios::binary);
+    if (!fs)
+        throw std::runtime_error("Failed to open " + inputPath);
+    std::string content ((std::istreambuf_iterator<char>(fs)), {});
+
+    std::ostringstream out;
+    out << "// Generated by embed_gen from " << inputPath << ", do not edit\n";
+    out << "#pragma once\n\n#include <cstddef>\n\n";
+    write_bytes(out, "char", identifier, content.data(), content.size());
+    out << "constexpr std::size_t " << identifier << "_size = " << content.size() << ";\n";
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "blob" && argc == 5) {
+        write_if_changed(argv[4], generate_blob(argv[2], argv[3]));
+    } else if (mode == "text" && argc == 5) {
+        write_if_changed(argv[4], generate_text(argv[2], argv[3]));
+    } else {
+        fprintf(stderr, "usage: %s blob <namespace> <object> <output>\n       %s text <identifier> <input> <output>\n", argv[0], argv[0]);
+        return 1;
+    }
+    return 0;
+}
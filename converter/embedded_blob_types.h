@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class EmbeddedFixupKind : uint8_t {
+    // 32-bit displacement in .compat.text, set to (.compat.data + target) - (.compat.text + offset)
+    TextPcRel32ToData,
+    // Pointer in .compat.data, set to the address of the imported symbol plus target
+    DataAbs64Import,
+    // Pointer in .compat.data, set to the entry point of the original Mach-O plus target
+    DataAbs64EntryPoint,
+    // Pointer in .compat.data, set to the load address of the image plus target
+    DataAbs64ImageBase,
+};
+
+// Generated from the relocations of the assembled startup code by embed_gen
+struct EmbeddedFixup {
+    uint32_t offset;
+    EmbeddedFixupKind kind;
+    int64_t target;
+    const char* symbol; // DataAbs64Import only
+};
+
+struct EmbeddedSymbol {
+    const char* name;
+    std::size_t offset;
+};
+
+struct EmbeddedBlob {
+    const uint8_t* code;
+    std::size_t codeSize;
+    std::size_t dataSize;
+    const EmbeddedFixup* fixups;
+    std::size_t fixupCount;
+    const EmbeddedSymbol* symbols;
+    std::size_t symbolCount;
+};
@@ -2,11 +2,13 @@
 #include <cstdio>
 #include <LIEF/LIEF.hpp>
 
+#include "log.h"
 #include "unwind_compact_decoder.h"
 #include "unwind_dwarf.h"
 
 
 int main(int argc, char* argv[]) {
+    Logger::setLevel(LogLevel::Info);
     auto macho = LIEF::MachO::Parser::parse(std::string(argv[1]));
     std::cout << "Binary count: " << macho->size() << '\n';
     auto& binary = *macho->at(0);
@@ -39,7 +41,10 @@ int main(int argc, char* argv[]) {
     std::cout << "==============\n";
 
 
-    auto tab = decodeCompactUnwindTable(binary);
+    CompactUnwindInfo tab;
+    auto status = decodeCompactUnwindTable(binary, tab);
+    if (status != ParseStatus::Ok)
+        std::cout << "Failed to decode the compact unwind table: " << parseStatusToString(status) << '\n';
     for (auto& et : tab.personalities) {
         std::cout << "Personality: " << std::hex << et << '\n';
     }
@@ -0,0 +1,80 @@
+#include "log.h"
+
+#include <cstdio>
+
+static constexpr std::size_t LOG_BUFFER_FLUSH_SIZE = 64 * 1024;
+
+namespace {
+
+// Messages are collected here and written out in large chunks, the destructor takes care of whatever is left when
+// the process exits normally. Errors are written out right away (with everything before them), they usually come
+// right before an abort() or an exception that would skip the destructor.
+struct LogSink {
+    std::string buffer;
+    std::ostringstream message;
+    LogLevel messageLevel = LogLevel::None;
+
+    ~LogSink() {
+        flush();
+    }
+
+    void flush() {
+        if (buffer.empty())
+            return;
+        fwrite(buffer.data(), 1, buffer.size(), stderr);
+        fflush(stderr);
+        buffer.clear();
+    }
+};
+
+LogSink& get_sink() {
+    static LogSink sink;
+    return sink;
+}
+
+}
+
+LogLevel Logger::level = LogLevel::Error;
+
+std::ostream& Logger::begin(LogLevel messageLevel) {
+    auto& sink = get_sink();
+    sink.message.str(std::string());
+    sink.message.clear();
+    sink.message.flags(std::ios_base::dec | std::ios_base::skipws);
+    sink.messageLevel = messageLevel;
+    if (messageLevel == LogLevel::Error)
+        sink.message << "error: ";
+    else if (messageLevel == LogLevel::Warning)
+        sink.message << "warning: ";
+    return sink.message;
+}
+
+void Logger::commit() {
+    auto& sink = get_sink();
+    sink.buffer += sink.message.str();
+    sink.buffer += '\n';
+    if (sink.messageLevel == LogLevel::Error || sink.buffer.size() >= LOG_BUFFER_FLUSH_SIZE)
+        sink.flush();
+}
+
+void Logger::flush() {
+    get_sink().flush();
+}
+
+bool Logger::parseLevel(std::string const& name, LogLevel& out) {
+    static const std::pair<const char*, LogLevel> levels[] = {
+            {"none", LogLevel::None},
+            {"error", LogLevel::Error},
+            {"warning", LogLevel::Warning},
+            {"info", LogLevel::Info},
+            {"debug", LogLevel::Debug},
+            {"trace", LogLevel::Trace},
+    };
+    for (auto const& l : levels) {
+        if (name == l.first) {
+            out = l.second;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+enum class LogLevel : int {
+    None,
+    Error,
+    Warning,
+    Info,
+    Debug,
+    Trace,
+};
+
+// Leveled logger writing to a buffered stderr sink. The LOG_* macros check the level before evaluating their
+// arguments, so a disabled message costs a single comparison even inside hot loops.
+class Logger {
+
+private:
+    static LogLevel level;
+
+public:
+    static void setLevel(LogLevel newLevel) {
+        level = newLevel;
+    }
+
+    static LogLevel getLevel() {
+        return level;
+    }
+
+    static bool isEnabled(LogLevel messageLevel) {
+        return messageLevel <= level;
+    }
+
+    // Returns a cleared stream to format a single message into, finish the message with commit()
+    static std::ostream& begin(LogLevel messageLevel);
+    static void commit();
+
+    static void flush();
+
+    static bool parseLevel(std::string const& name, LogLevel& out);
+
+};
+
+#define LOG_AT(lvl, ...) \
+    do { \
+        if (Logger::isEnabled(lvl)) { \
+            Logger::begin(lvl) << __VA_ARGS__; \
+            Logger::commit(); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_TRACE(...) LOG_AT(LogLevel::Trace, __VA_ARGS__)
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum class ParseStatus {
+    Ok,
+    Truncated,
+    Malformed,
+};
+
+// Non-owning read cursor over a byte span. Callers check the bounds of a whole record once with has() and then use
+// the unchecked readers, the checked ones are meant for variable length data such as LEB128 values.
+class SpanCursor {
+
+private:
+    const uint8_t* begin_;
+    const uint8_t* end_;
+    const uint8_t* cur_;
+
+public:
+    SpanCursor(const uint8_t* data, std::size_t size) : begin_(data), end_(data + size), cur_(data) {}
+
+    std::size_t pos() const { return cur_ - begin_; }
+    std::size_t size() const { return end_ - begin_; }
+    std::size_t remaining() const { return end_ - cur_; }
+    const uint8_t* current() const { return cur_; }
+
+    bool has(std::size_t n) const { return remaining() >= n; }
+
+    bool setpos(std::size_t p) {
+        if (p > size())
+            return false;
+        cur_ = begin_ + p;
+        return true;
+    }
+
+    bool skip(std::size_t n) {
+        if (!has(n))
+            return false;
+        cur_ += n;
+        return true;
+    }
+
+    // Returns a cursor at the same position whose data ends at the given offset, positions stay relative to the
+    // start of this cursor
+    bool limit(std::size_t endPos, SpanCursor& out) const {
+        if (endPos > size() || endPos < pos())
+            return false;
+        out = *this;
+        out.end_ = begin_ + endPos;
+        return true;
+    }
+
+    template <typename T>
+    T peekUnchecked() const {
+        T ret;
+        memcpy(&ret, cur_, sizeof(T));
+        return ret;
+    }
+
+    template <typename T>
+    T readUnchecked() {
+        T ret;
+        memcpy(&ret, cur_, sizeof(T));
+        cur_ += sizeof(T);
+        return ret;
+    }
+
+    template <typename T>
+    bool read(T& out) {
+        if (!has(sizeof(T)))
+            return false;
+        out = readUnchecked<T>();
+        return true;
+    }
+
+    template <typename T>
+    bool readArray(T* out, std::size_t count) {
+        if (count > remaining() / sizeof(T))
+            return false;
+        memcpy(out, cur_, count * sizeof(T));
+        cur_ += count * sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool readVector(std::vector<T>& out, std::size_t count) {
+        if (count > remaining() / sizeof(T))
+            return false;
+        out.resize(count);
+        return readArray(out.data(), count);
+    }
+
+    bool readUleb128(uint64_t& out) {
+        uint64_t ret = 0;
+        unsigned shift = 0;
+        while (cur_ < end_) {
+            uint8_t b = *cur_++;
+            if (shift < 64)
+                ret |= (uint64_t) (b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                out = ret;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readSleb128(int64_t& out) {
+        int64_t ret = 0;
+        unsigned shift = 0;
+        while (cur_ < end_) {
+            uint8_t b = *cur_++;
+            if (shift < 64)
+                ret |= (int64_t) ((uint64_t) (b & 0x7f) << shift);
+            shift += 7;
+            if (!(b & 0x80)) {
+                if (shift < 64 && (b & 0x40))
+                    ret |= -((int64_t) 1 << shift);
+                out = ret;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool skipLeb128() {
+        while (cur_ < end_) {
+            if (!(*cur_++ & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+};
+
+inline const char* parseStatusToString(ParseStatus status) {
+    switch (status) {
+        case ParseStatus::Ok:
+            return "ok";
+        case ParseStatus::Truncated:
+            return "truncated";
+        case ParseStatus::Malformed:
+            return "malformed";
+    }
+    return "unknown";
+}
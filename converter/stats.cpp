@@ -0,0 +1,110 @@
+#include "stats.h"
+
+#include <ctime>
+#include <iomanip>
+#include <sys/resource.h>
+
+static double get_cpu_time_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t get_peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void write_json_string(std::ostream& out, std::string const& str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec << std::setfill(' ');
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void write_json_counters(std::ostream& out, std::vector<ConversionStats::Counter> const& counters, const char* indent) {
+    out << '{';
+    for (size_t i = 0; i < counters.size(); i++) {
+        out << (i ? ",\n" : "\n") << indent << "  ";
+        write_json_string(out, counters[i].name);
+        out << ": " << counters[i].value;
+    }
+    if (!counters.empty())
+        out << '\n' << indent;
+    out << '}';
+}
+
+// Several Mach-O sections can map to the same ELF name (__TEXT,__const and __DATA,__const both become .const), so the
+// sections are a list rather than an object keyed by name
+static void write_json_sections(std::ostream& out, std::vector<ConversionStats::Counter> const& sections, const char* indent) {
+    out << '[';
+    for (size_t i = 0; i < sections.size(); i++) {
+        out << (i ? ",\n" : "\n") << indent << "  {\"name\": ";
+        write_json_string(out, sections[i].name);
+        out << ", \"size\": " << sections[i].value << '}';
+    }
+    if (!sections.empty())
+        out << '\n' << indent;
+    out << ']';
+}
+
+void ConversionStats::beginStage(std::string name) {
+    stages.push_back({std::move(name)});
+    stagePeakRssStart = get_peak_rss_kb();
+    stageCpuStart = get_cpu_time_ms();
+    stageWallStart = std::chrono::steady_clock::now();
+}
+
+void ConversionStats::endStage() {
+    auto wallEnd = std::chrono::steady_clock::now();
+    auto& stage = stages.back();
+    stage.wallMs = std::chrono::duration<double, std::milli>(wallEnd - stageWallStart).count();
+    stage.cpuMs = get_cpu_time_ms() - stageCpuStart;
+    stage.peakRssDeltaKb = get_peak_rss_kb() - stagePeakRssStart;
+}
+
+void ConversionStats::count(std::string name, uint64_t value) {
+    if (stages.empty())
+        return;
+    stages.back().counters.push_back({std::move(name), value});
+}
+
+void ConversionStats::addOutputSection(std::string name, uint64_t size) {
+    outputSections.push_back({std::move(name), size});
+}
+
+void ConversionStats::writeJson(std::ostream& out) const {
+    uint64_t totalOutputBytes = 0;
+    for (auto const& sec : outputSections)
+        totalOutputBytes += sec.value;
+
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"stages\": [";
+    for (size_t i = 0; i < stages.size(); i++) {
+        auto const& stage = stages[i];
+        out << (i ? ",\n" : "\n") << "    {\n      \"name\": ";
+        write_json_string(out, stage.name);
+        out << ",\n      \"wall_ms\": " << stage.wallMs;
+        out << ",\n      \"cpu_ms\": " << stage.cpuMs;
+        out << ",\n      \"peak_rss_delta_kb\": " << stage.peakRssDeltaKb;
+        out << ",\n      \"counts\": ";
+        write_json_counters(out, stage.counters, "      ");
+        out << "\n    }";
+    }
+    if (!stages.empty())
+        out << "\n  ";
+    out << "],\n  \"output_sections\": ";
+    write_json_sections(out, outputSections, "  ");
+    out << ",\n  \"output_section_bytes\": " << totalOutputBytes << "\n}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Collects per-stage resource usage and item counts of a conversion. Counts are attributed to the stage that is
+// running when they are added.
+class ConversionStats {
+
+public:
+    struct Counter {
+        std::string name;
+        uint64_t value;
+    };
+
+    struct Stage {
+        std::string name;
+        double wallMs = 0;
+        double cpuMs = 0;
+        // Growth of the peak resident set size during the stage, 0 if the peak was reached before it
+        uint64_t peakRssDeltaKb = 0;
+        std::vector<Counter> counters;
+    };
+
+private:
+    std::vector<Stage> stages;
+    std::vector<Counter> outputSections;
+
+    std::chrono::steady_clock::time_point stageWallStart;
+    double stageCpuStart = 0;
+    uint64_t stagePeakRssStart = 0;
+
+public:
+    void beginStage(std::string name);
+    void endStage();
+
+    void count(std::string name, uint64_t value);
+    void addOutputSection(std::string name, uint64_t size);
+
+    const std::vector<Stage>& getStages() const {
+        return stages;
+    }
+
+    void writeJson(std::ostream& out) const;
+
+};
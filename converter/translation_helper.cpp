@@ -1,8 +1,16 @@
 #include "translation_helper.h"
 
 #include <fstream>
+#include <iterator>
 
-void TranslationHelper::load(const std::string &path) {
+void TranslationHelper::loadFile(const std::string &path) {
+    std::ifstream fs (path);
+    if (!fs)
+        throw std::runtime_error("Failed to open " + path);
+    load(std::string(std::istreambuf_iterator<char>(fs), {}));
+}
+
+void TranslationHelper::load(std::string_view data) {
     const auto trim = [](std::string str) {
         auto f = str.find_first_not_of(" \t");
         auto l = str.find_last_not_of(" \t");
@@ -14,9 +22,10 @@ void TranslationHelper::load(const std::string &path) {
     std::shared_ptr<LibTranslation> activeTranslation;
     std::string currentTargetLib;
 
-    std::ifstream fs (path);
-    std::string line;
-    while (std::getline(fs, line)) {
+    while (!data.empty()) {
+        auto lineEnd = data.find('\n');
+        std::string line (data.substr(0, lineEnd));
+        data.remove_prefix(lineEnd == std::string_view::npos ? data.size() : lineEnd + 1);
         if (line.empty() || line[0] == '#')
             continue;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <memory>
 #include "LIEF/LIEF.hpp"
@@ -23,7 +24,8 @@ private:
     std::map<LIEF::MachO::DylibCommand const*, std::shared_ptr<LibTranslation>> libTranslationMap;
 
 public:
-    void load(std::string const& path);
+    void load(std::string_view data);
+    void loadFile(std::string const& path);
 
     void registerLibrary(LIEF::MachO::DylibCommand const& library, std::vector<std::string>& referencedSoNames);
 
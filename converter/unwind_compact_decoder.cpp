@@ -1,120 +1,140 @@
 #include <LIEF/LIEF.hpp>
-#include "LIEF/BinaryStream/SpanStream.hpp"
+#include "log.h"
 #include "unwind_compact_decoder.h"
 #include "unwind_compact_structures.h"
 
-static uint32_t findLsda(const unwind_info_section_header_lsda_index_entry* lsdaTab, size_t lsdaCount, uint32_t funcOff);
+static bool findLsda(const unwind_info_section_header_lsda_index_entry* lsdaTab, size_t lsdaCount, uint32_t funcOff, uint32_t& lsda);
 
-CompactUnwindInfo decodeCompactUnwindTable(LIEF::MachO::Binary &binary) {
+ParseStatus decodeCompactUnwindTable(LIEF::MachO::Binary &binary, CompactUnwindInfo& ret) {
     static constexpr size_t UNWIND_COMPRESSED = 3;
     static constexpr size_t UNWIND_UNCOMPRESSED = 2;
 
-    CompactUnwindInfo ret;
-
     const auto *unwind_section = binary.get_section("__unwind_info");
     if (unwind_section == nullptr) {
-        std::cout << "No __unwind_info section\n";
-        return ret;
+        LOG_INFO("No __unwind_info section");
+        return ParseStatus::Ok;
     }
 
-    LIEF::SpanStream vs = unwind_section->content();
+    auto content = unwind_section->content();
+    SpanCursor vs (content.data(), content.size());
 
-    // Get section content
-    const auto hdr = vs.read<unwind_info_section_header>();
-    if (!hdr)
-        throw std::runtime_error("Can't read unwind section header!");
+    unwind_info_section_header hdr;
+    if (!vs.read(hdr))
+        return ParseStatus::Truncated;
 
-    ret.personalities.resize(hdr->personalityArrayCount);
-    vs.setpos(hdr->personalityArraySectionOffset);
-    for (size_t i = 0; i < hdr->personalityArrayCount; i++)
-        ret.personalities[i] = *vs.read<uint32_t>();
+    if (!vs.setpos(hdr.personalityArraySectionOffset) || !vs.readVector(ret.personalities, hdr.personalityArrayCount))
+        return ParseStatus::Truncated;
 
-    uint32_t compact_encodings[256];
-    size_t common_encoding_count = hdr->commonEncodingsArrayCount;
+    uint32_t compact_encodings[256] = {};
+    size_t common_encoding_count = hdr.commonEncodingsArrayCount;
     if (common_encoding_count > 256)
-        throw std::runtime_error("Too many common encodings");
-
-    vs.setpos(hdr->commonEncodingsArraySectionOffset);
-    for (size_t i = 0; i < common_encoding_count; i++)
-        compact_encodings[i] = *vs.read<uint32_t>();
-
-    vs.setpos(hdr->indexSectionOffset);
-
-    for (size_t i = 0; i < hdr->indexCount; ++i) {
-        const auto sectionHdr = vs.read<unwind_info_section_header_index_entry>();
-        auto nextSectionHdr = vs.peek<unwind_info_section_header_index_entry>();
-        if (!sectionHdr)
-            throw std::runtime_error("Can't read function information at index " + std::to_string(i));
-
-        const size_t secondLvlOff = sectionHdr->secondLevelPagesSectionOffset;
-        const size_t lsdaOff = sectionHdr->lsdaIndexArraySectionOffset;
-        const size_t lsdaEnd = i + 1 < hdr->indexCount ? nextSectionHdr->lsdaIndexArraySectionOffset : lsdaOff;
+        return ParseStatus::Malformed;
+    if (!vs.setpos(hdr.commonEncodingsArraySectionOffset) || !vs.readArray(compact_encodings, common_encoding_count))
+        return ParseStatus::Truncated;
+
+    std::vector<unwind_info_section_header_index_entry> index;
+    if (!vs.setpos(hdr.indexSectionOffset) || !vs.readVector(index, hdr.indexCount))
+        return ParseStatus::Truncated;
+
+    for (size_t i = 0; i < index.size(); ++i) {
+        const auto& sectionHdr = index[i];
+
+        const size_t secondLvlOff = sectionHdr.secondLevelPagesSectionOffset;
+        const size_t lsdaOff = sectionHdr.lsdaIndexArraySectionOffset;
+        const size_t lsdaEnd = i + 1 < index.size() ? index[i + 1].lsdaIndexArraySectionOffset : lsdaOff;
+        if (lsdaEnd < lsdaOff || lsdaEnd > content.size())
+            return ParseStatus::Malformed;
         const size_t lsdaCount = (lsdaEnd - lsdaOff) / sizeof(unwind_info_section_header_lsda_index_entry);
-        auto lsdaTab = (const unwind_info_section_header_lsda_index_entry*) ((uintptr_t) unwind_section->content().data() + lsdaOff);
-
-        if (secondLvlOff > 0 && vs.can_read<unwind_info_regular_second_level_page_header>(secondLvlOff)) {
-            const size_t saved_pos = vs.pos();
-
-            vs.setpos(secondLvlOff);
-            const auto lvlHdr = vs.peek<unwind_info_regular_second_level_page_header>(secondLvlOff);
-            if (!lvlHdr) {
-                break;
+        auto lsdaTab = (const unwind_info_section_header_lsda_index_entry*) ((uintptr_t) content.data() + lsdaOff);
+
+        if (secondLvlOff == 0)
+            continue;
+        if (!vs.setpos(secondLvlOff) || !vs.has(sizeof(unwind_info_regular_second_level_page_header)))
+            return ParseStatus::Truncated;
+
+        const auto firstEntry = ret.entries.size();
+        const auto kind = vs.peekUnchecked<uint32_t>();
+//            std::cout << "==== " << kind << '\n';
+        if (kind == UNWIND_COMPRESSED) {
+            unwind_info_compressed_second_level_page_header lvlCompressedHdr;
+            if (!vs.read(lvlCompressedHdr))
+                return ParseStatus::Truncated;
+
+            const size_t encodingCount = common_encoding_count + lvlCompressedHdr.encodingsCount;
+            if (encodingCount > 256)
+                return ParseStatus::Malformed;
+
+            if (!vs.setpos(secondLvlOff + lvlCompressedHdr.encodingsPageOffset) ||
+                !vs.readArray(compact_encodings + common_encoding_count, lvlCompressedHdr.encodingsCount))
+                return ParseStatus::Truncated;
+
+            const size_t entryCount = lvlCompressedHdr.entryCount;
+            if (!vs.setpos(secondLvlOff + lvlCompressedHdr.entryPageOffset) || !vs.has(entryCount * sizeof(uint32_t)))
+                return ParseStatus::Truncated;
+
+            // Bounds were checked for the whole page, the index into compact_encodings is at most 255 and gets
+            // validated once after the loop.
+            ret.entries.resize(firstEntry + entryCount);
+            auto out = &ret.entries[firstEntry];
+            auto in = vs.current();
+            uint32_t maxEncodingIndex = 0;
+            for (size_t j = 0; j < entryCount; ++j) {
+                uint32_t entry;
+                memcpy(&entry, in + j * sizeof(uint32_t), sizeof(uint32_t));
+                maxEncodingIndex = std::max(maxEncodingIndex, entry >> 24);
+                out[j] = {sectionHdr.functionOffset + (entry & 0xffffff), compact_encodings[entry >> 24], 0};
             }
-
-//            std::cout << "==== " << lvlHdr->kind << '\n';
-            if (lvlHdr->kind == UNWIND_COMPRESSED) {
-                const auto lvlCompressedHdr = vs.read<unwind_info_compressed_second_level_page_header>();
-                if (!lvlCompressedHdr)
-                    throw std::runtime_error("Can't read lvlCompressedHdr");
-
-                if (lvlCompressedHdr->encodingsCount + common_encoding_count > 256)
-                    throw std::runtime_error("Too many encodings");
-
-                vs.setpos(secondLvlOff + lvlCompressedHdr->encodingsPageOffset);
-                for (size_t j = 0; j < lvlCompressedHdr->encodingsCount; ++j) {
-                    compact_encodings[common_encoding_count + j] = *vs.read<uint32_t>();
-                }
-
-                vs.setpos(secondLvlOff + lvlCompressedHdr->entryPageOffset);
-                for (size_t j = 0; j < lvlCompressedHdr->entryCount; ++j) {
-                    auto entry = vs.read<uint32_t>();
-                    uint32_t funcOff = sectionHdr->functionOffset + (*entry & 0xffffff);
-                    uint32_t encoding = compact_encodings[*entry >> 24];
-//                    std::cout << std::hex << funcOff << ' ' << encoding << '\n';
-                    uint32_t lsda = encoding & UNWIND_HAS_LSDA ? findLsda(lsdaTab, lsdaCount, funcOff) : 0;
-                    ret.entries.push_back({funcOff, encoding, lsda});
-                }
-            } else if (lvlHdr->kind == UNWIND_UNCOMPRESSED) {
-                const auto lvlRegularHdr = vs.read<unwind_info_regular_second_level_page_header>();
-                if (!lvlRegularHdr)
-                    throw std::runtime_error("Can't read lvlRegularHdr");
-
-                vs.setpos(secondLvlOff + lvlRegularHdr->entryPageOffset);
-                for (size_t j = 0; j < lvlRegularHdr->entryCount; ++j) {
-                    auto entry = vs.read<unwind_info_regular_second_level_entry>();
-//                    std::cout << std::hex << entry->functionOffset << ' ' << entry->encoding << '\n';
-                    uint32_t lsda = entry->encoding & UNWIND_HAS_LSDA ? findLsda(lsdaTab, lsdaCount, entry->functionOffset) : 0;
-                    ret.entries.push_back({entry->functionOffset, entry->encoding, lsda});
-                }
-            } else {
-                throw std::runtime_error("Unknown 2nd level kind: " + std::to_string(lvlHdr->kind));
+            if (entryCount > 0 && maxEncodingIndex >= encodingCount) {
+                ret.entries.resize(firstEntry);
+                return ParseStatus::Malformed;
             }
-
-            vs.setpos(saved_pos);
+        } else if (kind == UNWIND_UNCOMPRESSED) {
+            unwind_info_regular_second_level_page_header lvlRegularHdr;
+            if (!vs.read(lvlRegularHdr))
+                return ParseStatus::Truncated;
+
+            const size_t entryCount = lvlRegularHdr.entryCount;
+            if (!vs.setpos(secondLvlOff + lvlRegularHdr.entryPageOffset) ||
+                !vs.has(entryCount * sizeof(unwind_info_regular_second_level_entry)))
+                return ParseStatus::Truncated;
+
+            ret.entries.resize(firstEntry + entryCount);
+            auto out = &ret.entries[firstEntry];
+            auto in = vs.current();
+            for (size_t j = 0; j < entryCount; ++j) {
+                unwind_info_regular_second_level_entry entry;
+                memcpy(&entry, in + j * sizeof(entry), sizeof(entry));
+                out[j] = {entry.functionOffset, entry.encoding, 0};
+            }
+        } else {
+            return ParseStatus::Malformed;
         }
 
+        // Only pages that are valid as a whole are kept, the caller converts whatever was decoded
+        for (size_t j = firstEntry; j < ret.entries.size(); ++j) {
+            auto& entry = ret.entries[j];
+//            std::cout << std::hex << entry.functionOffset << ' ' << entry.encoding << '\n';
+            // The personality of an entry with an LSDA goes into its CIE
+            auto personality = UNWIND_PERSONALITY(entry.encoding);
+            auto personalityValid = personality <= ret.personalities.size() && (personality != 0 || !(entry.encoding & UNWIND_HAS_LSDA));
+            if (!personalityValid || ((entry.encoding & UNWIND_HAS_LSDA) && !findLsda(lsdaTab, lsdaCount, entry.functionOffset, entry.lsda))) {
+                ret.entries.resize(firstEntry);
+                return ParseStatus::Malformed;
+            }
+        }
     }
 
-    return ret;
+    return ParseStatus::Ok;
 }
 
 
-static uint32_t findLsda(const unwind_info_section_header_lsda_index_entry* lsdaTab, size_t lsdaCount, uint32_t funcOff) {
+static bool findLsda(const unwind_info_section_header_lsda_index_entry* lsdaTab, size_t lsdaCount, uint32_t funcOff, uint32_t& lsda) {
     auto it = std::lower_bound(lsdaTab, lsdaTab + lsdaCount, unwind_info_section_header_lsda_index_entry{funcOff, 0},
                                [&](auto const& a, auto const& b) { return a.functionOffset < b.functionOffset; });
     if (it == lsdaTab + lsdaCount || it->functionOffset != funcOff)
-        throw std::runtime_error("Failed to find the functionOffset in the lsda table!");
-    return it->lsdaOffset;
+        return false;
+    lsda = it->lsdaOffset;
+    return true;
 }
 
 void decodeCompatEncodingPermutation(uint32_t regCount, uint32_t permutation, int registersSaved[6]) {
@@ -14,6 +14,7 @@
 #include <cstdint>
 
 #include <LIEF/LIEF.hpp>
+#include "span_cursor.h"
 
 // architecture independent bits
 enum {
@@ -24,6 +25,9 @@ enum {
 
 #define UNWIND_PERSONALITY(x) (((x) >> 28) & 3u)
 
+#define EXTRACT_BITS(value, mask)                                              \
+  ((value >> __builtin_ctz(mask)) & (((1 << __builtin_popcount(mask))) - 1))
+
 //
 // x86_64
 //
@@ -80,6 +84,6 @@ struct CompactUnwindInfo {
     std::vector<Entry> entries;
 };
 
-CompactUnwindInfo decodeCompactUnwindTable(LIEF::MachO::Binary& binary);
+ParseStatus decodeCompactUnwindTable(LIEF::MachO::Binary& binary, CompactUnwindInfo& ret);
 
 void decodeCompatEncodingPermutation(uint32_t regCount, uint32_t permutation, int registersSaved[6]);
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cstdint>
 
 struct unwind_info_section_header {
@@ -1,244 +1,265 @@
 #include "unwind_dwarf.h"
+#include "log.h"
 
-#include <LIEF/BinaryStream/SpanStream.hpp>
-
-void DwarfUnwindParser::parse(LIEF::MachO::Binary &binary) {
+ParseStatus DwarfUnwindParser::parse(LIEF::MachO::Binary &binary) {
     const auto *ehframe_section = binary.get_section("__eh_frame");
     if (ehframe_section == nullptr) {
-        std::cout << "No __eh_frame section\n";
-        return;
+        LOG_INFO("No __eh_frame section");
+        return ParseStatus::Ok;
     }
 
     sectionBegin = ehframe_section->address();
     sectionEnd = ehframe_section->address() + ehframe_section->size();
 
-    char argStr[256];
     CieInfo cie;
 
-    LIEF::SpanStream vs = ehframe_section->content();
+    auto content = ehframe_section->content();
+    SpanCursor vs (content.data(), content.size());
     uint32_t p = 0;
-    bool isIndirect;
+    validSize = 0;
     while (p < vs.size()) {
         vs.setpos(p);
-        auto length = *vs.read<uint32_t>();
-        auto cieOffset = *vs.read<uint32_t>();
-        std::cout << std::hex << p << ' ' << length << ' ' << cieOffset << ' ';
-        if (cieOffset == 0) {
-            std::cout << "CIE\n";
+        if (!vs.has(4))
+            return ParseStatus::Truncated;
+        auto length = vs.readUnchecked<uint32_t>();
+        if (length == 0) // terminator
+            break;
+        if (length < 4 || length == 0xffffffff) // 64-bit DWARF is never produced for __eh_frame
+            return ParseStatus::Malformed;
+
+        // Everything in the record is read through a cursor that ends with the record
+        SpanCursor record (nullptr, 0);
+        if (!vs.limit(vs.pos() + length, record))
+            return ParseStatus::Truncated;
+        auto cieOffset = record.readUnchecked<uint32_t>();
+        LOG_TRACE(std::hex << p << ' ' << length << ' ' << cieOffset << ' ' << (cieOffset == 0 ? "CIE" : "FDE"));
 
+        // Roll back anything recorded for a record that fails to parse, so that the valid prefix stays consistent
+        auto pcrelUsageCount = pcrelUsages.size();
+        auto fdeCount = fdes.size();
+        ParseStatus status;
+        if (cieOffset == 0) {
             cie = CieInfo();
+            status = readCie(record, cie);
+        } else {
+            status = readFde(record, cie, p);
+        }
+        if (status != ParseStatus::Ok) {
+            pcrelUsages.resize(pcrelUsageCount);
+            fdes.resize(fdeCount);
+            return status;
+        }
 
-            auto version = *vs.read<uint8_t>();
-            if (version != 1 && version != 3) {
-                std::cout << "CIE version is not 1 or 3\n";
-                return;
-            }
-            for (int i = 0; i < sizeof(argStr); i ++) {
-                argStr[i] = *vs.read<char>();
-                if (argStr[i] == 0)
-                    break;
-            }
-            vs.read_uleb128(); // codeAlignFactor
-            vs.read_sleb128(); // dataAlignFactor
-            vs.read_uleb128(); // raReg
+        p += 4 + length;
+        validSize = p;
+    }
+    return ParseStatus::Ok;
+}
 
-            if (argStr[0] == 'z') {
-                vs.read_uleb128(); // argumentation data length
-                for (int i = 0; i < sizeof(argStr) && argStr[i] != 0; i++) {
-                    switch (argStr[i]) {
-                        case 'z':
-                            cie.fdesHaveAugmentationData = true;
-                            break;
-                        case 'P': {
-                            auto personalityEncoding = *vs.read<uint8_t>();
-                            readEncoded(vs, personalityEncoding, isIndirect);
-                            break;
-                        }
-                        case 'L':
-                            cie.lsdaEncoding = *vs.read<uint8_t>();
-                            break;
-                        case 'R':
-                            cie.pointerEncoding = *vs.read<uint8_t>();
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            }
-            readInstructions(vs, cie, p + 4 + length - vs.pos());
-        } else {
-            std::cout << "FDE\n";
-            readEncoded(vs, cie.pointerEncoding, isIndirect); // pcStart
-            readEncoded(vs, cie.pointerEncoding & 0xf, isIndirect); // pcRange
-            if (cie.fdesHaveAugmentationData) {
-                auto augLen = *vs.read_uleb128();
-                auto augEnd = vs.pos() + augLen;
-                if (cie.lsdaEncoding != DW_EH_PE_omit && augLen > 0) {
-                    auto lsdaStart = vs.pos();
-                    if (readEncoded(vs, cie.lsdaEncoding & 0xf, isIndirect) != 0) {
-                        // Reset pointer and re-parse LSDA address.
-                        vs.setpos(lsdaStart);
-                        readEncoded(vs, cie.lsdaEncoding, isIndirect);
-                    }
+ParseStatus DwarfUnwindParser::readCie(SpanCursor& vs, CieInfo& cie) {
+    uint8_t version;
+    if (!vs.read(version))
+        return ParseStatus::Truncated;
+    if (version != 1 && version != 3) {
+        LOG_WARNING("CIE version is not 1 or 3");
+        return ParseStatus::Malformed;
+    }
+
+    auto argStr = (const char*) vs.current();
+    auto argStrEnd = (const char*) memchr(argStr, 0, vs.remaining());
+    if (argStrEnd == nullptr)
+        return ParseStatus::Truncated;
+    vs.skip(argStrEnd - argStr + 1);
+
+    if (!vs.skipLeb128() || // codeAlignFactor
+        !vs.skipLeb128() || // dataAlignFactor
+        !vs.skipLeb128()) // raReg
+        return ParseStatus::Truncated;
+
+    bool isIndirect;
+    uint64_t value;
+    if (argStr[0] == 'z') {
+        if (!vs.skipLeb128()) // argumentation data length
+            return ParseStatus::Truncated;
+        for (auto c = argStr; c != argStrEnd; c++) {
+            switch (*c) {
+                case 'z':
+                    cie.fdesHaveAugmentationData = true;
+                    break;
+                case 'P': {
+                    uint8_t personalityEncoding;
+                    if (!vs.read(personalityEncoding))
+                        return ParseStatus::Truncated;
+                    auto status = readEncoded(vs, personalityEncoding, value, isIndirect);
+                    if (status != ParseStatus::Ok)
+                        return status;
+                    break;
                 }
-                vs.setpos(augEnd);
+                case 'L':
+                    if (!vs.read(cie.lsdaEncoding))
+                        return ParseStatus::Truncated;
+                    break;
+                case 'R':
+                    if (!vs.read(cie.pointerEncoding))
+                        return ParseStatus::Truncated;
+                    break;
+                default:
+                    break;
             }
-
-            readInstructions(vs, cie, p + 4 + length - vs.pos());
         }
+    }
+    return readInstructions(vs, cie);
+}
 
-        p += 4 + length;
+ParseStatus DwarfUnwindParser::readFde(SpanCursor& vs, CieInfo const& cie, uint32_t offset) {
+    bool isIndirect;
+    uint64_t pcStart, pcRange, lsda;
+    auto status = readEncoded(vs, cie.pointerEncoding, pcStart, isIndirect);
+    if (status == ParseStatus::Ok)
+        status = readEncoded(vs, cie.pointerEncoding & 0xf, pcRange, isIndirect);
+    if (status != ParseStatus::Ok)
+        return status;
+    fdes.push_back({offset, pcStart, pcRange});
+
+    if (cie.fdesHaveAugmentationData) {
+        uint64_t augLen;
+        if (!vs.readUleb128(augLen) || augLen > vs.remaining())
+            return ParseStatus::Truncated;
+        auto augEnd = vs.pos() + augLen;
+        if (cie.lsdaEncoding != DW_EH_PE_omit && augLen > 0) {
+            auto lsdaStart = vs.pos();
+            status = readEncoded(vs, cie.lsdaEncoding & 0xf, lsda, isIndirect);
+            if (status != ParseStatus::Ok)
+                return status;
+            if (lsda != 0) {
+                // Reset pointer and re-parse LSDA address.
+                vs.setpos(lsdaStart);
+                status = readEncoded(vs, cie.lsdaEncoding, lsda, isIndirect);
+                if (status != ParseStatus::Ok)
+                    return status;
+            }
+        }
+        vs.setpos(augEnd);
     }
+
+    return readInstructions(vs, cie);
 }
 
-void DwarfUnwindParser::readInstructions(LIEF::BinaryStream& stream, DwarfUnwindParser::CieInfo& cieInfo, size_t size) {
-    auto instructionsEnd = stream.pos() + size;
-    while (stream.pos() < instructionsEnd) {
-        uint64_t reg;
-        uint64_t reg2;
-        int64_t offset;
-        uint64_t length;
-        uint8_t opcode = *stream.read<uint8_t>();
-        uint8_t operand;
+ParseStatus DwarfUnwindParser::readInstructions(SpanCursor& stream, DwarfUnwindParser::CieInfo const& cieInfo) {
+    // The instructions are only validated and skipped, the operand kinds are all that matters here
+    while (stream.remaining() > 0) {
+        uint64_t length, value;
+        bool ok = true;
         bool isIndirect;
+        uint8_t opcode = stream.readUnchecked<uint8_t>();
         switch (opcode) {
             case DW_CFA_nop:
                 break;
-            case DW_CFA_set_loc:
-                readEncoded(stream, cieInfo.pointerEncoding, isIndirect);
+            case DW_CFA_set_loc: {
+                auto status = readEncoded(stream, cieInfo.pointerEncoding, value, isIndirect);
+                if (status != ParseStatus::Ok)
+                    return status;
                 break;
+            }
             case DW_CFA_advance_loc1:
-                stream.setpos(stream.pos() + 1);
+                ok = stream.skip(1);
                 break;
             case DW_CFA_advance_loc2:
-                stream.setpos(stream.pos() + 2);
+                ok = stream.skip(2);
                 break;
             case DW_CFA_advance_loc4:
-                stream.setpos(stream.pos() + 4);
-                break;
-            case DW_CFA_offset_extended:
-                stream.read_uleb128();
-                stream.read_uleb128();
+                ok = stream.skip(4);
                 break;
             case DW_CFA_restore_extended:
-                stream.read_uleb128();
-                break;
             case DW_CFA_undefined:
-                stream.read_uleb128();
-                break;
             case DW_CFA_same_value:
-                stream.read_uleb128();
-                break;
-            case DW_CFA_register:
-                stream.read_uleb128();
-                stream.read_uleb128();
-                break;
-            case DW_CFA_def_cfa:
-                stream.read_uleb128();
-                stream.read_uleb128();
-                break;
             case DW_CFA_def_cfa_register:
-                stream.read_uleb128();
-                break;
             case DW_CFA_def_cfa_offset:
-                stream.read_uleb128();
-                break;
-            case DW_CFA_def_cfa_expression://TODO:?
-            case DW_CFA_expression://TODO:?
-                length = *stream.read_uleb128();
-                stream.setpos(stream.pos() + length);
-                length = *stream.read_uleb128();
-                stream.setpos(stream.pos() + length);
+            case DW_CFA_def_cfa_offset_sf:
+            case DW_CFA_GNU_args_size:
+                ok = stream.skipLeb128();
                 break;
+            case DW_CFA_offset_extended:
+            case DW_CFA_register:
+            case DW_CFA_def_cfa:
             case DW_CFA_offset_extended_sf:
-                stream.read_uleb128();
-                stream.read_sleb128();
-                break;
             case DW_CFA_def_cfa_sf:
-                stream.read_uleb128();
-                stream.read_sleb128();
-                break;
-            case DW_CFA_def_cfa_offset_sf:
-                stream.read_sleb128();
-                break;
             case DW_CFA_val_offset:
-                stream.read_uleb128();
-                stream.read_uleb128();
-                break;
             case DW_CFA_val_offset_sf:
-                stream.read_uleb128();
-                stream.read_sleb128();
-                break;
             case DW_CFA_val_expression:
-                stream.read_uleb128();
-                stream.read_uleb128();
-                break;
-            case DW_CFA_GNU_args_size:
-                stream.read_uleb128();
-                break;
             case DW_CFA_GNU_negative_offset_extended:
-                stream.read_uleb128();
-                stream.read_uleb128();
+                ok = stream.skipLeb128() && stream.skipLeb128();
+                break;
+            case DW_CFA_def_cfa_expression://TODO:?
+            case DW_CFA_expression://TODO:?
+                ok = stream.readUleb128(length) && length <= stream.remaining() && stream.skip(length) &&
+                     stream.readUleb128(length) && length <= stream.remaining() && stream.skip(length);
                 break;
 
             default:
-                operand = opcode & 0x3F;
                 switch (opcode & 0xC0) {
                     case DW_CFA_offset:
-                        reg = operand;
-                        stream.read_uleb128();
+                        ok = stream.skipLeb128();
                         break;
                     case DW_CFA_advance_loc:
-                        break;
                     case DW_CFA_restore:
-                        reg = operand;
                         break;
                     default:
-                        throw std::runtime_error("unknown CFA opcode");
+                        return ParseStatus::Malformed;
                 }
         }
+        if (!ok)
+            return ParseStatus::Truncated;
     }
-
+    return ParseStatus::Ok;
 }
 
-uint64_t DwarfUnwindParser::readEncoded(LIEF::BinaryStream& stream, uint8_t encoding, bool& isIndirect) {
-    uint64_t result;
+ParseStatus DwarfUnwindParser::readEncoded(SpanCursor& stream, uint8_t encoding, uint64_t& result, bool& isIndirect) {
     uint64_t addr = sectionBegin + stream.pos();
+    int64_t signedResult;
+    bool ok;
 
     // first get value
     switch (encoding & 0x0F) {
         case DW_EH_PE_ptr:
-            result = *stream.read<uint64_t>();
+        case DW_EH_PE_udata8:
+            ok = stream.read(result);
             break;
         case DW_EH_PE_uleb128:
-            result = *stream.read_uleb128();
+            ok = stream.readUleb128(result);
             break;
         case DW_EH_PE_udata2:
-            result = *stream.read<uint16_t>();
+            ok = stream.has(2);
+            result = ok ? stream.readUnchecked<uint16_t>() : 0;
             break;
         case DW_EH_PE_udata4:
-            result = *stream.read<uint32_t>();
-            break;
-        case DW_EH_PE_udata8:
-            result = *stream.read<uint64_t>();
+            ok = stream.has(4);
+            result = ok ? stream.readUnchecked<uint32_t>() : 0;
             break;
         case DW_EH_PE_sleb128:
-            result = (uint64_t) *stream.read<int64_t>();
+            ok = stream.readSleb128(signedResult);
+            result = (uint64_t) signedResult;
             break;
         case DW_EH_PE_sdata2:
             // Sign extend from signed 16-bit value.
-            result = (uint64_t) *stream.read<int16_t>();
+            ok = stream.has(2);
+            result = ok ? (uint64_t) stream.readUnchecked<int16_t>() : 0;
             break;
         case DW_EH_PE_sdata4:
             // Sign extend from signed 32-bit value.
-            result = (uint64_t) *stream.read<int32_t>();
+            ok = stream.has(4);
+            result = ok ? (uint64_t) stream.readUnchecked<int32_t>() : 0;
             break;
         case DW_EH_PE_sdata8:
-            result = (uint64_t) *stream.read<int64_t>();
+            ok = stream.read(signedResult);
+            result = (uint64_t) signedResult;
             break;
         default:
-            throw std::runtime_error("unknown pointer encoding");
+            LOG_WARNING("unknown pointer encoding");
+            return ParseStatus::Malformed;
     }
+    if (!ok)
+        return ParseStatus::Truncated;
 
     // then add relative offset
     switch (encoding & 0x70) {
@@ -247,26 +268,22 @@ uint64_t DwarfUnwindParser::readEncoded(LIEF::BinaryStream& stream, uint8_t enco
             break;
         case DW_EH_PE_pcrel:
             result += addr;
-            std::cout << "Encountered pcrel: " << std::hex << (addr - sectionBegin) << ' ' << result << ' ' << (encoding&0xf) << '\n';
+            LOG_TRACE("Encountered pcrel: " << std::hex << (addr - sectionBegin) << ' ' << result << ' ' << (encoding&0xf));
             pcrelUsages.push_back({addr - sectionBegin, (uint8_t) (encoding & 0xf)});
             break;
-        case DW_EH_PE_textrel:
-            throw std::runtime_error("DW_EH_PE_textrel pointer encoding not supported");
-        case DW_EH_PE_datarel:
-            throw std::runtime_error("DW_EH_PE_datarel pointer encoding not supported");
-        case DW_EH_PE_funcrel:
-            throw std::runtime_error("DW_EH_PE_funcrel pointer encoding not supported");
-        case DW_EH_PE_aligned:
-            throw std::runtime_error("DW_EH_PE_aligned pointer encoding not supported");
         default:
-            throw std::runtime_error("unknown pointer encoding");
+            // DW_EH_PE_textrel, DW_EH_PE_datarel, DW_EH_PE_funcrel and DW_EH_PE_aligned are not supported
+            LOG_WARNING("unsupported pointer encoding: " << std::hex << (encoding & 0x70));
+            return ParseStatus::Malformed;
     }
 
     isIndirect = (encoding & DW_EH_PE_indirect);
     if (encoding & DW_EH_PE_indirect) {
-        if (result >= sectionBegin && result < sectionEnd)
-            throw std::runtime_error("DW_EH_PE_indirect pointer encoding to the eh_frame section is not supported");
+        if (result >= sectionBegin && result < sectionEnd) {
+            LOG_WARNING("DW_EH_PE_indirect pointer encoding to the eh_frame section is not supported");
+            return ParseStatus::Malformed;
+        }
     }
 
-    return result;
-}
\ No newline at end of file
+    return ParseStatus::Ok;
+}
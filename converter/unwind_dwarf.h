@@ -1,8 +1,8 @@
 #pragma once
 
 #include <LIEF/LIEF.hpp>
-#include <LIEF/BinaryStream/BinaryStream.hpp>
 #include "dwarf2.h"
+#include "span_cursor.h"
 
 class DwarfUnwindParser {
 
@@ -18,14 +18,25 @@ private:
         uint8_t encoding;
     };
 
-    uint64_t readEncoded(LIEF::BinaryStream& stream, uint8_t encoding, bool& isIndirect);
+    struct FdeInfo {
+        uint32_t offset;
+        uint64_t pcStart;
+        uint64_t pcRange;
+    };
+
+    ParseStatus readEncoded(SpanCursor& stream, uint8_t encoding, uint64_t& result, bool& isIndirect);
 
-    void readInstructions(LIEF::BinaryStream& stream, CieInfo& cie, size_t size);
+    ParseStatus readCie(SpanCursor& stream, CieInfo& cie);
+    ParseStatus readFde(SpanCursor& stream, CieInfo const& cie, uint32_t offset);
+    ParseStatus readInstructions(SpanCursor& stream, CieInfo const& cie);
 
 public:
     uint64_t sectionBegin = 0, sectionEnd = 0;
+    // Size of the prefix of the section made of records that were parsed successfully
+    uint32_t validSize = 0;
     std::vector<EncodedValueInfo> pcrelUsages;
+    std::vector<FdeInfo> fdes;
 
-    void parse(LIEF::MachO::Binary &binary);
+    ParseStatus parse(LIEF::MachO::Binary &binary);
 
 };
\ No newline at end of file
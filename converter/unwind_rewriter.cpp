@@ -1,14 +1,20 @@
 #include "unwind_compact_decoder.h"
+#include "unwind_compact_structures.h"
 #include "dwarf2.h"
 #include "unwind_registers.h"
 #include "unwind_rewriter.h"
+#include "log.h"
 
 void UnwindRewriter::convert(LIEF::MachO::Binary& bin, CompactUnwindInfo const& info) {
-    dwarfParser.parse(bin);
+    auto status = dwarfParser.parse(bin);
+    if (status != ParseStatus::Ok)
+        LOG_WARNING("Failed to parse __eh_frame (" << parseStatusToString(status) << "), only keeping the first " << std::hex << dwarfParser.validSize << " bytes");
 
+    // Only the records that were parsed (and so will get their pcrel values fixed up) are kept, this also removes
+    // the null terminator
     auto origEhFrame = bin.get_section("__eh_frame");
-    auto origEhFrameContent = origEhFrame->content();
-    writer.write(origEhFrameContent.subspan(0, origEhFrameContent.size() - 4)); // remove the null terminator
+    if (origEhFrame)
+        writer.write(origEhFrame->content().subspan(0, dwarfParser.validSize));
 
     LIEF::MachO::Section const* section = nullptr;
     auto count = info.entries.size();
@@ -25,11 +31,11 @@ void UnwindRewriter::convert(LIEF::MachO::Binary& bin, CompactUnwindInfo const&
             }
         }
 
-        size_t fend = section ? (section->address() + section->size()) : (size_t)-1;
+        size_t fend = section ? (section->address() + section->size() - base) : (size_t)-1;
         if (i + 1 < count && info.entries[i + 1].functionOffset < fend)
             fend = info.entries[i + 1].functionOffset;
         if (fend == (size_t)-1) {
-            std::cout << "Could not guess function size for " << std::hex << faddr << std::dec << " (" << i << ")\n";
+            LOG_WARNING("Could not guess function size for " << std::hex << faddr << std::dec << " (" << i << ")");
             continue;
         }
 
@@ -40,7 +46,9 @@ void UnwindRewriter::convert(LIEF::MachO::Binary& bin, CompactUnwindInfo const&
                 convertEntry(bin, info, entry, fend - faddr);
                 continue;
             case UNWIND_X86_64_MODE_DWARF:
-                searchMap.emplace_back(entry.functionOffset, entry.encoding & UNWIND_X86_64_DWARF_SECTION_OFFSET);
+                if ((entry.encoding & UNWIND_X86_64_DWARF_SECTION_OFFSET) >= dwarfParser.validSize)
+                    continue;
+                fdeIndex.push_back({entry.functionOffset, (uint32_t) (fend - faddr), entry.encoding & UNWIND_X86_64_DWARF_SECTION_OFFSET, FdeSource::CompactDwarfReference});
                 continue;
             default:
                 continue;
@@ -48,7 +56,114 @@ void UnwindRewriter::convert(LIEF::MachO::Binary& bin, CompactUnwindInfo const&
     }
 
     writer.write<uint32_t>(0);
-    std::sort(searchMap.begin(), searchMap.end());
+    buildSearchMap();
+}
+
+void UnwindRewriter::buildSearchMap() {
+    // The original FDEs are copied verbatim to the start of the new section, so their offsets stay valid. Indexing all
+    // of them (and not only the ones referenced by compact entries) keeps every lookup on the .eh_frame_hdr fast path.
+    for (auto const& fde : dwarfParser.fdes) {
+        if (fde.pcStart < base || fde.pcRange == 0)
+            continue;
+        fdeIndex.push_back({(uint32_t) (fde.pcStart - base), (uint32_t) fde.pcRange, fde.offset, FdeSource::Original});
+    }
+
+    std::sort(fdeIndex.begin(), fdeIndex.end(), [](auto const& a, auto const& b) {
+        if (a.functionOffset != b.functionOffset)
+            return a.functionOffset < b.functionOffset;
+        return a.source < b.source;
+    });
+
+    // The unwinder only checks the range of the closest preceding entry, so drop any entry starting inside the
+    // previous one.
+    std::vector<FdeIndexEntry> uniqueEntries;
+    uniqueEntries.reserve(fdeIndex.size());
+    uint64_t prevStart = 0, prevEnd = 0;
+    for (auto const& e : fdeIndex) {
+        if (!uniqueEntries.empty() && (e.functionOffset == prevStart || e.functionOffset < prevEnd))
+            continue;
+        uniqueEntries.push_back(e);
+        prevStart = e.functionOffset;
+        prevEnd = (uint64_t) e.functionOffset + e.functionLength;
+    }
+    fdeIndex = std::move(uniqueEntries);
+
+    searchMap.clear();
+    searchMap.reserve(fdeIndex.size());
+    for (auto const& e : fdeIndex)
+        searchMap.emplace_back(e.functionOffset, e.fdeOffset);
+}
+
+UnwindRewriter::FdeCounts UnwindRewriter::countIndexedFdes() const {
+    FdeCounts ret;
+    for (auto const& e : fdeIndex) {
+        switch (e.source) {
+            case FdeSource::Synthesized:
+                ++ret.synthesized;
+                break;
+            case FdeSource::Original:
+                ++ret.original;
+                break;
+            case FdeSource::CompactDwarfReference:
+                ++ret.compactDwarfReferences;
+                break;
+        }
+    }
+    return ret;
+}
+
+std::vector<uint8_t> UnwindRewriter::buildCompactIndex() const {
+    static constexpr uint32_t UNWIND_SECOND_LEVEL_REGULAR = 2;
+    static constexpr size_t PAGE_ENTRY_COUNT = (4096 - sizeof(unwind_info_regular_second_level_page_header)) / sizeof(unwind_info_regular_second_level_entry);
+
+    // Every function becomes a DWARF mode entry pointing at its FDE in the new .eh_frame, gaps are closed with an
+    // entry without unwind info so that lookups past the end of a function fail just like the range check in FDEs.
+    std::vector<unwind_info_regular_second_level_entry> entries;
+    for (size_t i = 0; i < fdeIndex.size(); i++) {
+        auto const& e = fdeIndex[i];
+        uint32_t encoding = e.fdeOffset <= UNWIND_X86_64_DWARF_SECTION_OFFSET ? (UNWIND_X86_64_MODE_DWARF | e.fdeOffset) : 0;
+        entries.push_back({e.functionOffset, encoding});
+        auto end = e.functionOffset + e.functionLength;
+        if (i + 1 == fdeIndex.size() || fdeIndex[i + 1].functionOffset > end)
+            entries.push_back({end, 0});
+    }
+
+    uint32_t pageCount = (entries.size() + PAGE_ENTRY_COUNT - 1) / PAGE_ENTRY_COUNT;
+    uint32_t indexOffset = sizeof(unwind_info_section_header);
+    uint32_t lsdaOffset = indexOffset + (pageCount + 1) * sizeof(unwind_info_section_header_index_entry);
+
+    LIEF::vector_iostream out;
+    out.write<uint32_t>(1); // version
+    out.write<uint32_t>(indexOffset); // commonEncodingsArraySectionOffset
+    out.write<uint32_t>(0); // commonEncodingsArrayCount
+    out.write<uint32_t>(indexOffset); // personalityArraySectionOffset
+    out.write<uint32_t>(0); // personalityArrayCount
+    out.write<uint32_t>(indexOffset);
+    out.write<uint32_t>(pageCount + 1);
+
+    uint32_t pageOffset = lsdaOffset;
+    for (uint32_t i = 0; i < pageCount; i++) {
+        auto count = std::min(PAGE_ENTRY_COUNT, entries.size() - i * PAGE_ENTRY_COUNT);
+        out.write<uint32_t>(entries[i * PAGE_ENTRY_COUNT].functionOffset);
+        out.write<uint32_t>(pageOffset);
+        out.write<uint32_t>(lsdaOffset);
+        pageOffset += sizeof(unwind_info_regular_second_level_page_header) + count * sizeof(unwind_info_regular_second_level_entry);
+    }
+    out.write<uint32_t>(entries.empty() ? 0 : entries.back().functionOffset);
+    out.write<uint32_t>(0);
+    out.write<uint32_t>(lsdaOffset);
+
+    for (uint32_t i = 0; i < pageCount; i++) {
+        auto count = std::min(PAGE_ENTRY_COUNT, entries.size() - i * PAGE_ENTRY_COUNT);
+        out.write<uint32_t>(UNWIND_SECOND_LEVEL_REGULAR);
+        out.write<uint16_t>(sizeof(unwind_info_regular_second_level_page_header));
+        out.write<uint16_t>(count);
+        for (size_t j = 0; j < count; j++) {
+            out.write<uint32_t>(entries[i * PAGE_ENTRY_COUNT + j].functionOffset);
+            out.write<uint32_t>(entries[i * PAGE_ENTRY_COUNT + j].encoding);
+        }
+    }
+    return out.raw();
 }
 
 void UnwindRewriter::writeCie(uint32_t personality) {
@@ -74,7 +189,7 @@ void UnwindRewriter::writeCie(uint32_t personality) {
         // P
         writer.write<uint8_t>(DW_EH_PE_indirect | DW_EH_PE_pcrel | DW_EH_PE_sdata4); // personalityEncoding
         relocations.push_back(writer.tellp());
-        printf("personality %x %x\n", (uint32_t)writer.tellp(), personality);
+        LOG_DEBUG("personality " << std::hex << (uint32_t)writer.tellp() << ' ' << personality);
         writer.write<int32_t>(personality - (uint32_t)writer.tellp()); // personality
         // L
         writer.write<uint8_t>(DW_EH_PE_pcrel | DW_EH_PE_sdata4); // lsdaEncoding
@@ -103,7 +218,7 @@ void UnwindRewriter::convertEntry(LIEF::MachO::Binary& bin, const CompactUnwindI
     writeCie(hasLsda ? info.personalities.at(UNWIND_PERSONALITY(entry.encoding) - 1) : 0);
 
     auto pLength = writer.tellp();
-    searchMap.emplace_back(entry.functionOffset, (uint32_t) pLength);
+    fdeIndex.push_back({entry.functionOffset, (uint32_t) length, (uint32_t) pLength, FdeSource::Synthesized});
     writer.write<uint32_t>(0); // length
     writer.write<uint32_t>(writer.tellp() - pCie); // cieOffset
 
@@ -121,19 +236,21 @@ void UnwindRewriter::convertEntry(LIEF::MachO::Binary& bin, const CompactUnwindI
     }
 
     // Instructions
+    uint32_t stackSize = 0;
     switch (entry.encoding & UNWIND_X86_64_MODE_MASK) {
         case UNWIND_X86_64_MODE_RBP_FRAME:
             convertRbpFrameEncoding(entry.encoding);
             break;
         case UNWIND_X86_64_MODE_STACK_IMMD:
-            convertFramelessEncoding(bin, entry, false);
+            stackSize = convertFramelessEncoding(bin, entry, false);
             break;
         case UNWIND_X86_64_MODE_STACK_IND:
-            convertFramelessEncoding(bin, entry, true);
+            stackSize = convertFramelessEncoding(bin, entry, true);
             break;
         default:
             break;
     }
+    frameLayouts.push_back({entry.functionOffset, (uint32_t) length, entry.encoding, stackSize});
     writer.align(8);
 
     auto p = writer.tellp();
@@ -142,9 +259,6 @@ void UnwindRewriter::convertEntry(LIEF::MachO::Binary& bin, const CompactUnwindI
     writer.seekp(p);
 }
 
-#define EXTRACT_BITS(value, mask)                                              \
-  ((value >> __builtin_ctz(mask)) & (((1 << __builtin_popcount(mask))) - 1))
-
 static inline uint32_t compactRegisterMap[] = {
         0, UNW_X86_64_RBX, UNW_X86_64_R12, UNW_X86_64_R13, UNW_X86_64_R14, UNW_X86_64_R15, UNW_X86_64_RBP
 };
@@ -176,7 +290,7 @@ void UnwindRewriter::convertRbpFrameEncoding(uint32_t encoding) {
     }
 }
 
-void UnwindRewriter::convertFramelessEncoding(LIEF::MachO::Binary& bin, CompactUnwindInfo::Entry entry, bool indirectStackSize) {
+uint32_t UnwindRewriter::convertFramelessEncoding(LIEF::MachO::Binary& bin, CompactUnwindInfo::Entry entry, bool indirectStackSize) {
     auto encoding = entry.encoding;
     uint32_t stackSizeEncoded =
             EXTRACT_BITS(encoding, UNWIND_X86_64_FRAMELESS_STACK_SIZE);
@@ -210,6 +324,7 @@ void UnwindRewriter::convertFramelessEncoding(LIEF::MachO::Binary& bin, CompactU
         writer.write_sleb128(savedRegisters--);
     }
 
+    return stackSize;
 }
 
 void UnwindRewriter::fixup(uint32_t addr) {
@@ -224,7 +339,7 @@ void UnwindRewriter::fixup(uint32_t addr) {
             auto& val = (uint32_t&) p[e.address];
             val += addr - dwarfParser.sectionBegin;
         } else {
-            std::cout << "cannot fixup original dwarf relocation: " << std::hex << enc << std::dec << '\n';
+            LOG_WARNING("cannot fixup original dwarf relocation: " << std::hex << enc);
         }
     }
 }
\ No newline at end of file
@@ -9,21 +9,49 @@ public:
     using addr_t = uint64_t;
 
 private:
+    enum class FdeSource : uint8_t {
+        Synthesized, Original, CompactDwarfReference
+    };
+
+    struct FdeIndexEntry {
+        uint32_t functionOffset;
+        uint32_t functionLength;
+        uint32_t fdeOffset;
+        FdeSource source;
+    };
+
     const addr_t base;
     LIEF::vector_iostream writer;
     std::vector<uint32_t> relocations;
 
     DwarfUnwindParser dwarfParser;
+    std::vector<FdeIndexEntry> fdeIndex;
 
     void writeCie(uint32_t personality);
 
     void convertEntry(LIEF::MachO::Binary& bin, CompactUnwindInfo const& info, CompactUnwindInfo::Entry entry, size_t length);
 
     void convertRbpFrameEncoding(uint32_t encoding);
-    void convertFramelessEncoding(LIEF::MachO::Binary& bin, CompactUnwindInfo::Entry entry, bool indirectStackSize);
+    uint32_t convertFramelessEncoding(LIEF::MachO::Binary& bin, CompactUnwindInfo::Entry entry, bool indirectStackSize);
+
+    void buildSearchMap();
 
 public:
+    struct FrameLayout {
+        uint32_t functionOffset;
+        uint32_t functionLength;
+        uint32_t encoding;
+        uint32_t stackSize; // frameless encodings only, already resolved for UNWIND_X86_64_MODE_STACK_IND
+    };
+
+    struct FdeCounts {
+        std::size_t synthesized = 0;
+        std::size_t original = 0;
+        std::size_t compactDwarfReferences = 0;
+    };
+
     std::vector<std::pair<uint32_t, uint32_t>> searchMap;
+    std::vector<FrameLayout> frameLayouts;
 
     explicit UnwindRewriter(addr_t base) : base(base) {}
 
@@ -39,4 +67,14 @@ public:
 
     void fixup(uint32_t addr);
 
+    std::size_t parsedFdeCount() const {
+        return dwarfParser.fdes.size();
+    }
+
+    // Number of FDEs in the search map by where they come from
+    FdeCounts countIndexedFdes() const;
+
+    // Builds an __unwind_info style two-level table (regular pages only) mapping every indexed function to its FDE
+    std::vector<uint8_t> buildCompactIndex() const;
+
 };
\ No newline at end of file
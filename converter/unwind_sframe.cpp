@@ -0,0 +1,139 @@
+#include "unwind_sframe.h"
+
+static constexpr std::size_t SFRAME_HEADER_SIZE = 28;
+static constexpr std::size_t SFRAME_FDE_SIZE = 20;
+
+static uint8_t getOffsetSize(int32_t v) {
+    if (v >= INT8_MIN && v <= INT8_MAX)
+        return SFRAME_FRE_OFFSET_1B;
+    if (v >= INT16_MIN && v <= INT16_MAX)
+        return SFRAME_FRE_OFFSET_2B;
+    return SFRAME_FRE_OFFSET_4B;
+}
+
+void SFrameWriter::build(LIEF::MachO::Binary& bin, std::vector<UnwindRewriter::FrameLayout> const& layouts) {
+    fdes.reserve(layouts.size());
+    for (auto const& layout : layouts) {
+        FdeEntry fde {layout.functionOffset, layout.functionLength, (uint32_t) fres.tellp(), 0, 0};
+        if (layout.functionLength <= 0xff)
+            fde.info = SFRAME_FRE_TYPE_ADDR1;
+        else if (layout.functionLength <= 0xffff)
+            fde.info = SFRAME_FRE_TYPE_ADDR2;
+        else
+            fde.info = SFRAME_FRE_TYPE_ADDR4;
+        fde.info |= SFRAME_FDE_TYPE_PCINC << 4;
+
+        switch (layout.encoding & UNWIND_X86_64_MODE_MASK) {
+            case UNWIND_X86_64_MODE_RBP_FRAME:
+                addRbpFrame(bin, fde);
+                break;
+            case UNWIND_X86_64_MODE_STACK_IMMD:
+            case UNWIND_X86_64_MODE_STACK_IND:
+                addFramelessFrame(fde, layout);
+                break;
+            default:
+                continue;
+        }
+        fdes.push_back(fde);
+    }
+
+    std::sort(fdes.begin(), fdes.end(), [](auto const& a, auto const& b) { return a.functionOffset < b.functionOffset; });
+}
+
+void SFrameWriter::addFre(FdeEntry& fde, uint32_t startOffset, uint8_t baseReg, int32_t cfaOffset, bool hasFpOffset, int32_t fpOffset) {
+    switch (fde.info & 0xf) {
+        case SFRAME_FRE_TYPE_ADDR1:
+            fres.write<uint8_t>(startOffset);
+            break;
+        case SFRAME_FRE_TYPE_ADDR2:
+            fres.write<uint16_t>(startOffset);
+            break;
+        default:
+            fres.write<uint32_t>(startOffset);
+            break;
+    }
+
+    auto offsetSize = std::max(getOffsetSize(cfaOffset), hasFpOffset ? getOffsetSize(fpOffset) : (uint8_t) 0);
+    auto offsetCount = hasFpOffset ? 2 : 1;
+    fres.write<uint8_t>((offsetSize << 5) | (offsetCount << 1) | baseReg);
+    for (int i = 0; i < offsetCount; i++) {
+        auto v = i == 0 ? cfaOffset : fpOffset;
+        if (offsetSize == SFRAME_FRE_OFFSET_1B)
+            fres.write<int8_t>(v);
+        else if (offsetSize == SFRAME_FRE_OFFSET_2B)
+            fres.write<int16_t>(v);
+        else
+            fres.write<int32_t>(v);
+    }
+    ++fde.freCount;
+}
+
+void SFrameWriter::addRbpFrame(LIEF::MachO::Binary& bin, FdeEntry& fde) {
+    // Compact encodings only describe the state after the prologue (as do the FDEs synthesized from them), but the
+    // standard push rbp; mov rbp, rsp sequence is easy to recognize and makes samples taken in the prologue correct.
+    auto prologue = bin.get_content_from_virtual_address(base + fde.functionOffset, 4);
+    bool hasStandardPrologue = fde.functionLength > 4 && prologue.size() == 4 && prologue[0] == 0x55 &&
+            prologue[1] == 0x48 && ((prologue[2] == 0x89 && prologue[3] == 0xe5) || (prologue[2] == 0x8b && prologue[3] == 0xec));
+
+    if (hasStandardPrologue) {
+        addFre(fde, 0, SFRAME_BASE_REG_SP, 8);
+        addFre(fde, 1, SFRAME_BASE_REG_SP, 16, true, -16);
+        addFre(fde, 4, SFRAME_BASE_REG_FP, 16, true, -16);
+    } else {
+        addFre(fde, 0, SFRAME_BASE_REG_FP, 16, true, -16);
+    }
+}
+
+void SFrameWriter::addFramelessFrame(FdeEntry& fde, UnwindRewriter::FrameLayout const& layout) {
+    uint32_t regCount =
+            EXTRACT_BITS(layout.encoding, UNWIND_X86_64_FRAMELESS_STACK_REG_COUNT);
+    uint32_t permutation =
+            EXTRACT_BITS(layout.encoding, UNWIND_X86_64_FRAMELESS_STACK_REG_PERMUTATION);
+
+    int registersSaved[6];
+    decodeCompatEncodingPermutation(regCount, permutation, registersSaved);
+
+    for (uint32_t i = 0; i < regCount; ++i) {
+        if (registersSaved[i] == UNWIND_X86_64_REG_RBP) {
+            addFre(fde, 0, SFRAME_BASE_REG_SP, (int32_t) layout.stackSize, true, -8 * (int32_t) (1 + regCount - i));
+            return;
+        }
+    }
+    addFre(fde, 0, SFRAME_BASE_REG_SP, (int32_t) layout.stackSize);
+}
+
+std::size_t SFrameWriter::size() const {
+    return SFRAME_HEADER_SIZE + fdes.size() * SFRAME_FDE_SIZE + fres.size();
+}
+
+void SFrameWriter::fixup(addr_t sectionAddr) {
+    uint32_t freCount = 0;
+    for (auto const& fde : fdes)
+        freCount += fde.freCount;
+
+    writer.reserve(size());
+
+    writer.write<uint16_t>(SFRAME_MAGIC);
+    writer.write<uint8_t>(SFRAME_VERSION_2);
+    writer.write<uint8_t>(SFRAME_F_FDE_SORTED);
+    writer.write<uint8_t>(SFRAME_ABI_AMD64_ENDIAN_LITTLE);
+    writer.write<int8_t>(0); // cfa fixed fp offset
+    writer.write<int8_t>(-8); // cfa fixed ra offset
+    writer.write<uint8_t>(0); // auxiliary header length
+    writer.write<uint32_t>(fdes.size());
+    writer.write<uint32_t>(freCount);
+    writer.write<uint32_t>(fres.size());
+    writer.write<uint32_t>(0); // fde offset
+    writer.write<uint32_t>(fdes.size() * SFRAME_FDE_SIZE); // fre offset
+
+    for (auto const& fde : fdes) {
+        writer.write<int32_t>((int32_t) (base + fde.functionOffset - sectionAddr));
+        writer.write<uint32_t>(fde.functionLength);
+        writer.write<uint32_t>(fde.freOffset);
+        writer.write<uint32_t>(fde.freCount);
+        writer.write<uint8_t>(fde.info);
+        writer.write<uint8_t>(0); // rep size
+        writer.write<uint16_t>(0); // padding
+    }
+    writer.write(fres.raw());
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <LIEF/iostream.hpp>
+#include "unwind_compact_decoder.h"
+#include "unwind_rewriter.h"
+
+// GNU SFrame (version 2) constants, see binutils include/sframe.h
+enum {
+    SHT_GNU_SFRAME                  = 0x6ffffff4,
+    PT_GNU_SFRAME                   = 0x6474e554,
+
+    SFRAME_MAGIC                    = 0xdee2,
+    SFRAME_VERSION_2                = 2,
+    SFRAME_F_FDE_SORTED             = 0x1,
+    SFRAME_ABI_AMD64_ENDIAN_LITTLE  = 3,
+
+    SFRAME_FRE_TYPE_ADDR1           = 0,
+    SFRAME_FRE_TYPE_ADDR2           = 1,
+    SFRAME_FRE_TYPE_ADDR4           = 2,
+    SFRAME_FDE_TYPE_PCINC           = 0,
+
+    SFRAME_BASE_REG_FP              = 0,
+    SFRAME_BASE_REG_SP              = 1,
+
+    SFRAME_FRE_OFFSET_1B            = 0,
+    SFRAME_FRE_OFFSET_2B            = 1,
+    SFRAME_FRE_OFFSET_4B            = 2,
+};
+
+// Writes a .sframe section describing the functions converted from compact unwind encodings, which lets stack
+// walkers use a table lookup instead of interpreting the .eh_frame CFI. DWARF mode functions are not covered and
+// stay .eh_frame only.
+class SFrameWriter {
+
+public:
+    using addr_t = uint64_t;
+
+private:
+    struct FdeEntry {
+        uint32_t functionOffset;
+        uint32_t functionLength;
+        uint32_t freOffset;
+        uint32_t freCount;
+        uint8_t info;
+    };
+
+    const addr_t base;
+    std::vector<FdeEntry> fdes;
+    LIEF::vector_iostream fres;
+    LIEF::vector_iostream writer;
+
+    void addFre(FdeEntry& fde, uint32_t startOffset, uint8_t baseReg, int32_t cfaOffset, bool hasFpOffset = false, int32_t fpOffset = 0);
+
+    void addRbpFrame(LIEF::MachO::Binary& bin, FdeEntry& fde);
+    void addFramelessFrame(FdeEntry& fde, UnwindRewriter::FrameLayout const& layout);
+
+public:
+    explicit SFrameWriter(addr_t base) : base(base) {}
+
+    void build(LIEF::MachO::Binary& bin, std::vector<UnwindRewriter::FrameLayout> const& layouts);
+
+    std::size_t size() const;
+
+    const std::vector<uint8_t>& data() {
+        return writer.raw();
+    }
+
+    void fixup(addr_t sectionAddr);
+
+};
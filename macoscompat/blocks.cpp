@@ -0,0 +1,176 @@
+#include <cstdlib>
+#include <cstring>
+#include "blocks.h"
+
+// Minimal Blocks runtime (libsystem_blocks): moving blocks and __block variables to the heap and reference counting
+// them. There is no Objective-C runtime, captured objects are copied as plain pointers.
+
+enum {
+    BLOCK_DEALLOCATING = 0x0001,
+    BLOCK_REFCOUNT_MASK = 0xfffe,
+    BLOCK_NEEDS_FREE = 1 << 24,
+    BLOCK_HAS_COPY_DISPOSE = 1 << 25,
+    BLOCK_IS_GLOBAL = 1 << 28,
+};
+
+enum {
+    BLOCK_BYREF_LAYOUT_EXTENDED = 1 << 28,
+    BLOCK_BYREF_NEEDS_FREE = 1 << 24,
+    BLOCK_BYREF_HAS_COPY_DISPOSE = 1 << 25,
+};
+
+enum {
+    BLOCK_FIELD_IS_OBJECT = 3,
+    BLOCK_FIELD_IS_BLOCK = 7,
+    BLOCK_FIELD_IS_BYREF = 8,
+    BLOCK_FIELD_IS_WEAK = 16,
+    BLOCK_BYREF_CALLER = 128,
+};
+
+struct Block_byref {
+    void* isa;
+    Block_byref* forwarding;
+    int32_t flags;
+    uint32_t size;
+};
+
+// Follows Block_byref with BLOCK_BYREF_HAS_COPY_DISPOSE
+struct Block_byref_2 {
+    void (*keep)(Block_byref* dst, Block_byref* src);
+    void (*destroy)(Block_byref* byref);
+};
+
+// Follows Block_byref_2 with BLOCK_BYREF_LAYOUT_EXTENDED
+struct Block_byref_3 {
+    const char* layout;
+};
+
+// The reference count lives in the flags and counts in steps of two, once it reaches the mask it stays there
+static void latching_incr(int32_t* where) {
+    auto old = __atomic_load_n(where, __ATOMIC_RELAXED);
+    while ((old & BLOCK_REFCOUNT_MASK) != BLOCK_REFCOUNT_MASK) {
+        if (__atomic_compare_exchange_n(where, &old, old + 2, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+// Returns true when the last reference was dropped
+static bool latching_decr(int32_t* where) {
+    auto old = __atomic_load_n(where, __ATOMIC_RELAXED);
+    while (true) {
+        if ((old & BLOCK_REFCOUNT_MASK) == BLOCK_REFCOUNT_MASK || (old & BLOCK_REFCOUNT_MASK) == 0)
+            return false;
+        bool last = (old & BLOCK_REFCOUNT_MASK) == 2;
+        auto desired = last ? ((old - 2) | BLOCK_DEALLOCATING) : old - 2;
+        if (__atomic_compare_exchange_n(where, &old, desired, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return last;
+    }
+}
+
+static Block_byref* byref_copy(const void* arg) {
+    auto src = (Block_byref*) arg;
+    if ((src->forwarding->flags & BLOCK_REFCOUNT_MASK) == 0) {
+        // Still on the stack: one reference for the heap copy and one for the stack frame that is about to forward to it
+        auto copy = (Block_byref*) malloc(src->size);
+        if (!copy)
+            abort();
+        copy->isa = nullptr;
+        copy->flags = src->flags | BLOCK_BYREF_NEEDS_FREE | 4;
+        copy->forwarding = copy;
+        copy->size = src->size;
+        src->forwarding = copy;
+        if (src->flags & BLOCK_BYREF_HAS_COPY_DISPOSE) {
+            auto src2 = (Block_byref_2*) (src + 1);
+            auto copy2 = (Block_byref_2*) (copy + 1);
+            *copy2 = *src2;
+            if (src->flags & BLOCK_BYREF_LAYOUT_EXTENDED)
+                *(Block_byref_3*) (copy2 + 1) = *(Block_byref_3*) (src2 + 1);
+            src2->keep(copy, src);
+        } else {
+            memmove(copy + 1, src + 1, src->size - sizeof(Block_byref));
+        }
+    } else if (src->forwarding->flags & BLOCK_BYREF_NEEDS_FREE) {
+        latching_incr(&src->forwarding->flags);
+    }
+    return src->forwarding;
+}
+
+static void byref_release(const void* arg) {
+    auto byref = ((Block_byref*) arg)->forwarding;
+    if (!(byref->flags & BLOCK_BYREF_NEEDS_FREE) || !latching_decr(&byref->flags))
+        return;
+    if (byref->flags & BLOCK_BYREF_HAS_COPY_DISPOSE)
+        ((Block_byref_2*) (byref + 1))->destroy(byref);
+    free(byref);
+}
+
+extern "C" {
+
+void* _NSConcreteStackBlock[32];
+void* _NSConcreteMallocBlock[32];
+void* _NSConcreteGlobalBlock[32];
+
+void* _Block_copy(const void* arg) {
+    if (!arg)
+        return nullptr;
+    auto block = (Block_layout*) arg;
+    if (block->flags & BLOCK_NEEDS_FREE) {
+        latching_incr(&block->flags);
+        return block;
+    }
+    if (block->flags & BLOCK_IS_GLOBAL)
+        return block;
+
+    auto copy = (Block_layout*) malloc(block->descriptor->size);
+    if (!copy)
+        return nullptr;
+    memmove(copy, block, block->descriptor->size);
+    copy->flags &= ~(BLOCK_REFCOUNT_MASK | BLOCK_DEALLOCATING);
+    copy->flags |= BLOCK_NEEDS_FREE | 2;
+    copy->isa = _NSConcreteMallocBlock;
+    if (block->flags & BLOCK_HAS_COPY_DISPOSE)
+        block->descriptor->copy(copy, block);
+    return copy;
+}
+
+void _Block_release(const void* arg) {
+    auto block = (Block_layout*) arg;
+    if (!block || !(block->flags & BLOCK_NEEDS_FREE) || !latching_decr(&block->flags))
+        return;
+    if (block->flags & BLOCK_HAS_COPY_DISPOSE)
+        block->descriptor->dispose(block);
+    free(block);
+}
+
+// Called from the copy helpers the compiler generates, for every captured variable that needs more than a memcpy
+void _Block_object_assign(void* dest, const void* object, int flags) {
+    switch (flags & (BLOCK_FIELD_IS_OBJECT | BLOCK_FIELD_IS_BLOCK | BLOCK_FIELD_IS_BYREF | BLOCK_FIELD_IS_WEAK | BLOCK_BYREF_CALLER)) {
+        case BLOCK_FIELD_IS_BLOCK:
+            *(void**) dest = _Block_copy(object);
+            break;
+        case BLOCK_FIELD_IS_BYREF:
+        case BLOCK_FIELD_IS_BYREF | BLOCK_FIELD_IS_WEAK:
+            *(void**) dest = byref_copy(object);
+            break;
+        default:
+            // Objects (nothing to retain without a runtime) and the variables inside a __block one
+            *(const void**) dest = object;
+            break;
+    }
+}
+
+void _Block_object_dispose(const void* object, int flags) {
+    switch (flags & (BLOCK_FIELD_IS_OBJECT | BLOCK_FIELD_IS_BLOCK | BLOCK_FIELD_IS_BYREF | BLOCK_FIELD_IS_WEAK | BLOCK_BYREF_CALLER)) {
+        case BLOCK_FIELD_IS_BLOCK:
+            _Block_release(object);
+            break;
+        case BLOCK_FIELD_IS_BYREF:
+        case BLOCK_FIELD_IS_BYREF | BLOCK_FIELD_IS_WEAK:
+            byref_release(object);
+            break;
+        default:
+            break;
+    }
+}
+
+}
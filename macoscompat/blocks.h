@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+// Layout of a block literal as emitted by clang, see the Blocks ABI. Only the parts the runtime and dispatch look at.
+
+extern "C" {
+
+struct Block_descriptor {
+    unsigned long reserved;
+    unsigned long size;
+    // Only present with BLOCK_HAS_COPY_DISPOSE
+    void (*copy)(void* dst, const void* src);
+    void (*dispose)(const void* block);
+};
+
+struct Block_layout {
+    void* isa;
+    int32_t flags;
+    int32_t reserved;
+    void* invoke; // the first argument is always the block itself
+    Block_descriptor* descriptor;
+};
+
+void* _Block_copy(const void* block);
+void _Block_release(const void* block);
+
+}
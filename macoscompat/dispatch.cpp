@@ -0,0 +1,808 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "blocks.h"
+#include "futex_semaphore.h"
+#include "mpsc_queue.h"
+#include "work_stealing_deque.h"
+
+// The libdispatch subset ported code relies on: global and serial queues, groups, apply, once and semaphores.
+// Everything runs on one work-stealing pool with a worker per CPU the process may actually use. Workers push what they
+// submit onto their own deque and steal from each other; submissions from other threads go to per-worker MPSC inboxes
+// that any idle worker may drain. Serial queues are an MPSC queue of their own, drained by a single pool task at a time.
+// A worker that goes to sleep in a wait hands its place to a stand-in thread, like libdispatch overcommits, so that
+// whatever it waits for still gets to run; stand-ins park again once the pool is back above one runnable worker per CPU.
+// Queue priorities, barriers, the main queue and sources are not supported.
+
+#define KERN_OPERATION_TIMED_OUT 49
+
+extern "C" {
+
+typedef void (*dispatch_function_t)(void*);
+typedef uint64_t dispatch_time_t;
+
+#define DISPATCH_TIME_NOW (0ull)
+#define DISPATCH_TIME_FOREVER (~0ull)
+
+}
+
+namespace {
+
+constexpr std::size_t DequeCapacity = 1024;
+constexpr int IdleSpinRounds = 64;
+constexpr int SerialDrainBatch = 32; // items a serial queue runs before it goes back to the end of the line
+constexpr std::size_t ApplyChunksPerThread = 8;
+constexpr unsigned MaxStandInWorkers = 64; // threads beyond one per CPU that may run in place of blocked workers
+
+long futex_wait(void* addr, uint32_t expected, const struct timespec* deadline) {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline
+    return syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, expected, deadline, nullptr,
+                   FUTEX_BITSET_MATCH_ANY);
+}
+
+void futex_wake(void* addr, int count) {
+    syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, nullptr, nullptr, 0);
+}
+
+uint64_t monotonic_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+struct timespec to_timespec(dispatch_time_t time) {
+    return {(time_t) (time / 1000000000), (long) (time % 1000000000)};
+}
+
+
+struct Task : MpscNode {
+    void (*invoke)(Task* task);
+};
+
+struct alignas(64) Worker {
+    WorkStealingDeque<Task, DequeCapacity> deque;
+    MpscQueue inbox;
+    std::atomic<bool> inboxLock {false}; // held by whoever is popping the inbox
+    uint32_t rng = 0;
+};
+
+thread_local Worker* currentWorker __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// Smallest CPU quota (in CPUs) of the cgroup the process is in and its ancestors, 0 when there is none
+double cgroup_cpu_quota() {
+    const auto readQuota = [](std::string const& dir, bool v2) -> double {
+        if (v2) {
+            std::ifstream fs (dir + "/cpu.max");
+            std::string quota;
+            uint64_t period;
+            if (fs >> quota >> period && quota != "max" && period != 0)
+                return std::stod(quota) / (double) period;
+            return 0;
+        }
+        std::ifstream quotaFs (dir + "/cpu.cfs_quota_us"), periodFs (dir + "/cpu.cfs_period_us");
+        int64_t quota;
+        uint64_t period;
+        if (quotaFs >> quota && periodFs >> period && quota > 0 && period != 0)
+            return (double) quota / (double) period;
+        return 0;
+    };
+
+    double ret = 0;
+    std::ifstream fs ("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(fs, line)) {
+        // hierarchy-ID:controller-list:cgroup-path
+        auto first = line.find(':');
+        auto second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+        auto controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        bool v2 = line.compare(0, first, "0") == 0 && controllers == ",,";
+        if (!v2 && controllers.find(",cpu,") == std::string::npos)
+            continue;
+        auto path = line.substr(second + 1);
+        while (true) {
+            auto quota = readQuota((v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpu") + path, v2);
+            if (quota > 0 && (ret == 0 || quota < ret))
+                ret = quota;
+            if (path.empty() || path == "/")
+                break;
+            path.resize(std::max<std::size_t>(path.rfind('/'), 1));
+        }
+    }
+    return ret;
+}
+
+unsigned available_cpus() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        cpus = CPU_COUNT(&set);
+    auto quota = cgroup_cpu_quota();
+    if (quota > 0)
+        cpus = std::min(cpus, (long) std::ceil(quota));
+    return (unsigned) std::max(cpus, 1L);
+}
+
+class WorkPool {
+
+    unsigned workerCount; // workers meant to be runnable at a time
+    unsigned capacity;
+    std::unique_ptr<Worker[]> workers;
+    std::atomic<unsigned> started {0};
+    std::atomic<uint32_t> nextInbox {0};
+    alignas(64) std::atomic<uint32_t> wakeEpoch {0};
+    std::atomic<uint32_t> sleeping {0};
+    alignas(64) std::atomic<int> runnable {0}; // started workers that are neither blocked in a wait nor parked
+    std::atomic<int> parked {0};
+    FutexSemaphore unpark;
+
+    static Task* popInbox(Worker& worker) {
+        if (worker.inboxLock.load(std::memory_order_relaxed) || worker.inboxLock.exchange(true, std::memory_order_acquire))
+            return nullptr;
+        auto task = static_cast<Task*>(worker.inbox.pop());
+        worker.inboxLock.store(false, std::memory_order_release);
+        return task;
+    }
+
+    static void* workerMain(void* arg) {
+        auto self = (Worker*) arg;
+        currentWorker = self;
+        pthread_setname_np(pthread_self(), "dispatch-worker");
+        auto& pool = *instance();
+        while (true) {
+            auto task = self->deque.pop();
+            if (!task && pool.parkIfSurplus())
+                continue;
+            if (!task)
+                task = pool.find(self);
+            for (int i = 0; !task && i < IdleSpinRounds; i++) {
+                __builtin_ia32_pause();
+                task = pool.find(self);
+            }
+            if (!task) {
+                // Announce the sleep before the last look, a submitter either sees us or we see its task
+                auto epoch = pool.wakeEpoch.load(std::memory_order_acquire);
+                pool.sleeping.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                task = pool.find(self);
+                if (!task)
+                    futex_wait(&pool.wakeEpoch, epoch, nullptr);
+                pool.sleeping.fetch_sub(1, std::memory_order_relaxed);
+                if (!task)
+                    continue;
+            }
+            task->invoke(task);
+        }
+        return nullptr;
+    }
+
+    // Parks the calling worker while more than one per CPU are runnable, returns whether it did
+    bool parkIfSurplus() {
+        auto v = runnable.load(std::memory_order_relaxed);
+        while (v > (int) workerCount) {
+            if (runnable.compare_exchange_weak(v, v - 1, std::memory_order_relaxed)) {
+                parked.fetch_add(1, std::memory_order_release);
+                while (unpark.wait(nullptr) != FutexSemaphore::WaitResult::Success) {
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool startWorker(Worker& worker) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        bool ret = pthread_create(&thread, &attr, workerMain, &worker) == 0;
+        pthread_attr_destroy(&attr);
+        return ret;
+    }
+
+    // Gets one more worker running, a parked one if there is one
+    void addStandIn() {
+        auto v = parked.load(std::memory_order_relaxed);
+        while (v > 0) {
+            if (parked.compare_exchange_weak(v, v - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                runnable.fetch_add(1, std::memory_order_relaxed);
+                unpark.signal();
+                return;
+            }
+        }
+        auto slot = started.load(std::memory_order_relaxed);
+        do {
+            if (slot >= capacity)
+                return; // out of stand-ins, the waiter blocks the pool like any other thread would
+        } while (!started.compare_exchange_weak(slot, slot + 1, std::memory_order_release, std::memory_order_relaxed));
+        runnable.fetch_add(1, std::memory_order_relaxed);
+        if (!startWorker(workers[slot]))
+            runnable.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    WorkPool() : workerCount(available_cpus()), capacity(workerCount + MaxStandInWorkers), workers(new Worker[capacity]) {
+        for (unsigned i = 0; i < capacity; i++)
+            workers[i].rng = i * 0x9e3779b9u + 1;
+        started.store(workerCount, std::memory_order_relaxed);
+        runnable.store((int) workerCount, std::memory_order_relaxed);
+        for (unsigned i = 0; i < workerCount; i++) {
+            if (!startWorker(workers[i]))
+                abort();
+        }
+    }
+
+public:
+    // Created on first use and never destroyed, the workers outlive static destructors
+    static WorkPool* instance() {
+        static WorkPool* pool = new WorkPool();
+        return pool;
+    }
+
+    unsigned size() const {
+        return workerCount;
+    }
+
+    void submit(Task* task) {
+        auto self = currentWorker;
+        if (!self || !self->deque.push(task)) {
+            auto& target = self ? *self : workers[nextInbox.fetch_add(1, std::memory_order_relaxed) % workerCount];
+            target.inbox.push(task);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) != 0) {
+            wakeEpoch.fetch_add(1, std::memory_order_release);
+            futex_wake(&wakeEpoch, 1);
+        }
+    }
+
+    // A worker calls these around a wait that is going to sleep, someone else runs in its place meanwhile
+    void blocked() {
+        if (runnable.fetch_sub(1, std::memory_order_relaxed) <= (int) workerCount)
+            addStandIn();
+    }
+
+    void unblocked() {
+        runnable.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Own work first (newest first, it is the most likely to be in cache), then steal the oldest work of others
+    Task* find(Worker* self) {
+        if (auto task = self->deque.pop())
+            return task;
+        if (auto task = popInbox(*self))
+            return task;
+        self->rng ^= self->rng << 13;
+        self->rng ^= self->rng >> 17;
+        self->rng ^= self->rng << 5;
+        auto count = started.load(std::memory_order_acquire);
+        auto start = self->rng % count;
+        for (unsigned i = 0; i < count; i++) {
+            auto& victim = workers[(start + i) % count];
+            if (&victim == self)
+                continue;
+            if (auto task = victim.deque.steal())
+                return task;
+            if (auto task = popInbox(victim))
+                return task;
+        }
+        return nullptr;
+    }
+
+};
+
+WorkPool& pool() {
+    return *WorkPool::instance();
+}
+
+// Hands the place of a worker over to a stand-in for as long as it is in a wait that may sleep
+struct BlockingScope {
+    bool worker = currentWorker != nullptr;
+
+    BlockingScope() {
+        if (worker)
+            pool().blocked();
+    }
+
+    ~BlockingScope() {
+        if (worker)
+            pool().unblocked();
+    }
+};
+
+
+// Counters that can be waited on until they drop to zero. The top bit records a sleeping waiter, so that the last
+// decrement only makes a syscall when there is somebody to wake.
+constexpr uint32_t CounterWaiters = 0x80000000u;
+
+bool counter_decrement(std::atomic<uint32_t>& counter) {
+    auto v = counter.load(std::memory_order_relaxed);
+    uint32_t next;
+    do {
+        next = (v & ~CounterWaiters) == 1 ? 0 : v - 1;
+    } while (!counter.compare_exchange_weak(v, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+    if (next == 0 && (v & CounterWaiters))
+        futex_wake(&counter, INT_MAX);
+    return next == 0;
+}
+
+// Returns false if the deadline passed first. A worker never runs other tasks while it waits, they might need a lock its
+// caller holds; it hands its place to a stand-in before it goes to sleep instead.
+bool counter_wait(std::atomic<uint32_t>& counter, const struct timespec* deadline) {
+    std::optional<BlockingScope> blocking;
+    while (true) {
+        auto v = counter.load(std::memory_order_acquire);
+        if ((v & ~CounterWaiters) == 0)
+            return true;
+        if (!(v & CounterWaiters) && !counter.compare_exchange_weak(v, v | CounterWaiters, std::memory_order_relaxed))
+            continue;
+        if (!blocking)
+            blocking.emplace();
+        if (futex_wait(&counter, v | CounterWaiters, deadline) != 0 && errno == ETIMEDOUT)
+            return false;
+    }
+}
+
+
+struct DispatchObject {
+    std::atomic<int32_t> refs {1};
+    bool immortal = false;
+
+    virtual ~DispatchObject() = default;
+
+    void retain() {
+        if (!immortal)
+            refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (!immortal && refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+};
+
+struct DispatchGroup;
+
+struct DispatchQueue : DispatchObject {
+    enum class Kind {
+        Concurrent,
+        Serial,
+    };
+
+    Kind kind;
+    std::string label;
+
+    DispatchQueue(Kind kind, const char* label) : kind(kind), label(label ? label : "") {}
+
+    void async(Task* task);
+};
+
+class SerialQueue : public DispatchQueue {
+
+    struct DrainTask : Task {
+        SerialQueue* queue;
+    };
+
+    MpscQueue items;
+    std::atomic<uint32_t> pending {0};
+    DrainTask drainTask;
+
+    // Only ever scheduled once at a time, so this is the single consumer of items
+    static void drain(Task* task) {
+        auto queue = static_cast<DrainTask*>(task)->queue;
+        for (int i = 0; i < SerialDrainBatch; i++) {
+            Task* item;
+            while (!(item = static_cast<Task*>(queue->items.pop())))
+                __builtin_ia32_pause(); // counted but not linked in yet
+            item->invoke(item);
+            if (queue->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                queue->release();
+                return;
+            }
+        }
+        pool().submit(&queue->drainTask);
+    }
+
+public:
+    explicit SerialQueue(const char* label) : DispatchQueue(Kind::Serial, label) {
+        drainTask.invoke = drain;
+        drainTask.queue = this;
+    }
+
+    void enqueue(Task* task) {
+        items.push(task);
+        if (pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            retain(); // held by the drain task until the queue runs empty
+            pool().submit(&drainTask);
+        }
+    }
+
+    // Runs work on the calling thread if the queue is idle, like libdispatch does for dispatch_sync; false if it is busy.
+    // The queue counts as draining meanwhile, so whatever is enqueued in the meantime waits and is drained afterwards.
+    bool runInlineIfIdle(dispatch_function_t work, void* context) {
+        uint32_t expected = 0;
+        if (!pending.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        work(context);
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            retain();
+            pool().submit(&drainTask);
+        }
+        return true;
+    }
+};
+
+void DispatchQueue::async(Task* task) {
+    if (kind == Kind::Serial)
+        static_cast<SerialQueue*>(this)->enqueue(task);
+    else
+        pool().submit(task);
+}
+
+struct GlobalQueue : DispatchQueue {
+    GlobalQueue() : DispatchQueue(Kind::Concurrent, "com.apple.root.default-qos") {
+        immortal = true;
+    }
+} globalQueue;
+
+struct DispatchGroup : DispatchObject {
+    std::atomic<uint32_t> count {0};
+    std::mutex notifyLock;
+    std::vector<std::pair<DispatchQueue*, Task*>> notifications;
+
+    void enter() {
+        // A group with work outstanding keeps itself alive
+        if ((count.fetch_add(1, std::memory_order_acquire) & ~CounterWaiters) == 0)
+            retain();
+    }
+
+    void leave() {
+        if (!counter_decrement(count))
+            return;
+        std::vector<std::pair<DispatchQueue*, Task*>> ready;
+        {
+            std::lock_guard<std::mutex> lock (notifyLock);
+            ready.swap(notifications);
+        }
+        for (auto const& [queue, task] : ready) {
+            queue->async(task);
+            queue->release();
+        }
+        release();
+    }
+};
+
+struct AsyncTask : Task {
+    dispatch_function_t function;
+    void* context;
+    DispatchGroup* group;
+
+    AsyncTask(dispatch_function_t function, void* context, DispatchGroup* group) : function(function), context(context), group(group) {
+        invoke = run;
+    }
+
+    static void run(Task* task) {
+        auto self = static_cast<AsyncTask*>(task);
+        self->function(self->context);
+        if (self->group)
+            self->group->leave();
+        delete self;
+    }
+};
+
+struct SyncTask : Task {
+    dispatch_function_t function;
+    void* context;
+    std::atomic<uint32_t> pending {1};
+
+    static void run(Task* task) {
+        auto self = static_cast<SyncTask*>(task);
+        self->function(self->context);
+        counter_decrement(self->pending);
+    }
+};
+
+struct ApplyState;
+
+struct ApplyTask : Task {
+    ApplyState* state;
+
+    static void run(Task* task);
+};
+
+// Shared by the caller and its helpers, whoever is last frees it. Helpers that only get to run after all chunks are
+// taken find nothing to do, the caller only waits for chunks that are being worked on.
+struct ApplyState {
+    void (*work)(void*, size_t);
+    void* context;
+    size_t iterations;
+    size_t chunk;
+    std::atomic<size_t> next {0};
+    std::atomic<uint32_t> unfinishedChunks {0};
+    std::atomic<uint32_t> refs {0};
+    std::unique_ptr<ApplyTask[]> helpers;
+
+    void run() {
+        size_t i;
+        while ((i = next.fetch_add(chunk, std::memory_order_relaxed)) < iterations) {
+            auto end = std::min(i + chunk, iterations);
+            for (; i < end; i++)
+                work(context, i);
+            counter_decrement(unfinishedChunks);
+        }
+    }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+};
+
+void ApplyTask::run(Task* task) {
+    auto state = static_cast<ApplyTask*>(task)->state;
+    state->run();
+    state->release();
+}
+
+struct DispatchSemaphore : DispatchObject {
+    FutexSemaphore semaphore;
+};
+
+struct DispatchQueueAttr {
+    int reserved;
+};
+
+// dispatch_once_t: 0 before, ~0 after, in between the thread running the initializer owns it
+constexpr intptr_t OnceDone = ~(intptr_t) 0;
+constexpr intptr_t OnceRunning = 1;
+constexpr intptr_t OnceRunningWithWaiters = 2;
+
+__attribute__((noinline)) void once_slow(std::atomic<intptr_t>* state, void* context, dispatch_function_t function) {
+    intptr_t v = 0;
+    if (state->compare_exchange_strong(v, OnceRunning, std::memory_order_acquire)) {
+        function(context);
+        if (state->exchange(OnceDone, std::memory_order_acq_rel) == OnceRunningWithWaiters)
+            futex_wake(state, INT_MAX);
+        return;
+    }
+    // The futex covers the low half of the predicate, which is enough to tell the states apart
+    std::optional<BlockingScope> blocking;
+    while (v != OnceDone) {
+        if (v == OnceRunning && !state->compare_exchange_weak(v, OnceRunningWithWaiters, std::memory_order_acquire))
+            continue;
+        if (!blocking)
+            blocking.emplace();
+        futex_wait(state, (uint32_t) OnceRunningWithWaiters, nullptr);
+        v = state->load(std::memory_order_acquire);
+    }
+}
+
+void invoke_block(void* block) {
+    ((void (*)(void*)) ((Block_layout*) block)->invoke)(block);
+}
+
+void invoke_block_and_release(void* block) {
+    invoke_block(block);
+    _Block_release(block);
+}
+
+void invoke_apply_block(void* block, size_t index) {
+    ((void (*)(void*, size_t)) ((Block_layout*) block)->invoke)(block, index);
+}
+
+}
+
+extern "C" {
+
+DispatchQueueAttr _dispatch_queue_attr_concurrent;
+
+dispatch_time_t dispatch_time(dispatch_time_t when, int64_t delta) {
+    if (when == DISPATCH_TIME_FOREVER)
+        return DISPATCH_TIME_FOREVER;
+    auto base = (int64_t) (when == DISPATCH_TIME_NOW ? monotonic_ns() : when);
+    int64_t ret;
+    if (__builtin_add_overflow(base, delta, &ret))
+        return delta > 0 ? DISPATCH_TIME_FOREVER : 1;
+    return ret > 0 ? (dispatch_time_t) ret : 1; // 0 would be DISPATCH_TIME_NOW
+}
+
+DispatchQueue* dispatch_get_global_queue(long identifier, unsigned long flags) {
+    // Every priority shares the one pool
+    return &globalQueue;
+}
+
+DispatchQueue* dispatch_queue_create(const char* label, DispatchQueueAttr* attr) {
+    if (attr == &_dispatch_queue_attr_concurrent)
+        return new DispatchQueue(DispatchQueue::Kind::Concurrent, label);
+    return new SerialQueue(label);
+}
+
+const char* dispatch_queue_get_label(DispatchQueue* queue) {
+    return queue ? queue->label.c_str() : "";
+}
+
+void dispatch_retain(DispatchObject* object) {
+    object->retain();
+}
+
+void dispatch_release(DispatchObject* object) {
+    object->release();
+}
+
+void dispatch_async_f(DispatchQueue* queue, void* context, dispatch_function_t work) {
+    queue->async(new AsyncTask(work, context, nullptr));
+}
+
+void dispatch_async(DispatchQueue* queue, void* block) {
+    dispatch_async_f(queue, _Block_copy(block), invoke_block_and_release);
+}
+
+void dispatch_sync_f(DispatchQueue* queue, void* context, dispatch_function_t work) {
+    if (queue->kind != DispatchQueue::Kind::Serial) {
+        work(context);
+        return;
+    }
+    auto serial = static_cast<SerialQueue*>(queue);
+    if (serial->runInlineIfIdle(work, context))
+        return;
+    SyncTask task;
+    task.invoke = SyncTask::run;
+    task.function = work;
+    task.context = context;
+    queue->async(&task);
+    counter_wait(task.pending, nullptr);
+}
+
+void dispatch_sync(DispatchQueue* queue, void* block) {
+    dispatch_sync_f(queue, block, invoke_block);
+}
+
+void dispatch_apply_f(size_t iterations, DispatchQueue* queue, void* context, void (*work)(void*, size_t)) {
+    // A null queue is DISPATCH_APPLY_AUTO
+    auto threads = std::min<size_t>(pool().size(), iterations);
+    if ((queue && queue->kind == DispatchQueue::Kind::Serial) || threads <= 1) {
+        for (size_t i = 0; i < iterations; i++)
+            work(context, i);
+        return;
+    }
+
+    // The calling thread takes part, so one helper less than there are CPUs
+    auto state = new ApplyState();
+    state->work = work;
+    state->context = context;
+    state->iterations = iterations;
+    state->chunk = std::max<size_t>(iterations / (threads * ApplyChunksPerThread), 1);
+    state->unfinishedChunks.store((uint32_t) ((iterations + state->chunk - 1) / state->chunk), std::memory_order_relaxed);
+    auto helperCount = (uint32_t) threads - 1;
+    state->refs.store(helperCount + 1, std::memory_order_relaxed);
+    state->helpers.reset(new ApplyTask[helperCount]);
+    for (uint32_t i = 0; i < helperCount; i++) {
+        state->helpers[i].invoke = ApplyTask::run;
+        state->helpers[i].state = state;
+        pool().submit(&state->helpers[i]);
+    }
+    state->run();
+    counter_wait(state->unfinishedChunks, nullptr);
+    state->release();
+}
+
+void dispatch_apply(size_t iterations, DispatchQueue* queue, void* block) {
+    dispatch_apply_f(iterations, queue, block, invoke_apply_block);
+}
+
+void dispatch_once_f(intptr_t* predicate, void* context, dispatch_function_t function) {
+    auto state = reinterpret_cast<std::atomic<intptr_t>*>(predicate);
+    if (__builtin_expect(state->load(std::memory_order_acquire) == OnceDone, 1))
+        return;
+    once_slow(state, context, function);
+}
+
+void dispatch_once(intptr_t* predicate, void* block) {
+    auto state = reinterpret_cast<std::atomic<intptr_t>*>(predicate);
+    if (__builtin_expect(state->load(std::memory_order_acquire) == OnceDone, 1))
+        return;
+    once_slow(state, block, invoke_block);
+}
+
+DispatchGroup* dispatch_group_create() {
+    return new DispatchGroup();
+}
+
+void dispatch_group_enter(DispatchGroup* group) {
+    group->enter();
+}
+
+void dispatch_group_leave(DispatchGroup* group) {
+    group->leave();
+}
+
+void dispatch_group_async_f(DispatchGroup* group, DispatchQueue* queue, void* context, dispatch_function_t work) {
+    group->enter();
+    queue->async(new AsyncTask(work, context, group));
+}
+
+void dispatch_group_async(DispatchGroup* group, DispatchQueue* queue, void* block) {
+    dispatch_group_async_f(group, queue, _Block_copy(block), invoke_block_and_release);
+}
+
+void dispatch_group_notify_f(DispatchGroup* group, DispatchQueue* queue, void* context, dispatch_function_t work) {
+    auto task = new AsyncTask(work, context, nullptr);
+    {
+        std::lock_guard<std::mutex> lock (group->notifyLock);
+        if ((group->count.load(std::memory_order_acquire) & ~CounterWaiters) != 0) {
+            queue->retain();
+            group->notifications.emplace_back(queue, task);
+            return;
+        }
+    }
+    queue->async(task);
+}
+
+void dispatch_group_notify(DispatchGroup* group, DispatchQueue* queue, void* block) {
+    dispatch_group_notify_f(group, queue, _Block_copy(block), invoke_block_and_release);
+}
+
+long dispatch_group_wait(DispatchGroup* group, dispatch_time_t timeout) {
+    if (timeout == DISPATCH_TIME_FOREVER)
+        return counter_wait(group->count, nullptr) ? 0 : KERN_OPERATION_TIMED_OUT;
+    auto deadline = to_timespec(timeout == DISPATCH_TIME_NOW ? 0 : timeout);
+    return counter_wait(group->count, &deadline) ? 0 : KERN_OPERATION_TIMED_OUT;
+}
+
+DispatchSemaphore* dispatch_semaphore_create(long value) {
+    if (value < 0)
+        return nullptr;
+    auto ret = new DispatchSemaphore();
+    ret->semaphore.init((uint32_t) std::min<long>(value, INT32_MAX));
+    return ret;
+}
+
+long dispatch_semaphore_signal(DispatchSemaphore* semaphore) {
+    // The woken thread commonly releases the semaphore right away, keep it alive until the wake is done
+    semaphore->retain();
+    long ret = semaphore->semaphore.signal() ? 1 : 0;
+    semaphore->release();
+    return ret;
+}
+
+long dispatch_semaphore_wait(DispatchSemaphore* semaphore, dispatch_time_t timeout) {
+    // Spin and poll first, a worker only hands its place over when it is about to sleep
+    struct timespec poll {0, 0};
+    if (semaphore->semaphore.wait(&poll) == FutexSemaphore::WaitResult::Success)
+        return 0;
+    if (timeout == DISPATCH_TIME_NOW)
+        return KERN_OPERATION_TIMED_OUT;
+    BlockingScope blocking;
+    while (true) {
+        FutexSemaphore::WaitResult result;
+        if (timeout == DISPATCH_TIME_FOREVER) {
+            result = semaphore->semaphore.wait(nullptr);
+        } else {
+            auto now = monotonic_ns();
+            auto remaining = to_timespec(timeout > now ? timeout - now : 0);
+            result = semaphore->semaphore.wait(&remaining);
+        }
+        if (result == FutexSemaphore::WaitResult::Success)
+            return 0;
+        if (result != FutexSemaphore::WaitResult::Interrupted)
+            return KERN_OPERATION_TIMED_OUT;
+    }
+}
+
+}
@@ -1,78 +1,388 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <climits>
+#include <memory>
 #include <array>
+#include <atomic>
 #include <vector>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <dlfcn.h>
 #include <link.h>
+#include <pthread.h>
 #include <fcntl.h>
+#include <unistd.h>
 
-extern "C" {
+// dyld's image list. The first snapshot is built by a constructor of this library, which runs before the code of any
+// converted image, and is replaced only by darwin_dlopen and darwin_dlclose when they changed the set of loaded
+// objects. Snapshots are immutable and published through an atomic pointer, so every query is a load and an index,
+// without locks or allocations, which makes them safe from signal handlers. Replaced snapshots are never freed, as a
+// reader may still hold one. Objects loaded behind dyld's back (by the host's dlopen) are not seen until the next
+// darwin_dlopen or darwin_dlclose. The header is the ELF header of the object, the Mach-O one does not survive the
+// conversion.
+struct DyldImage {
+    const void* header;
+    intptr_t slide;
+    const char* name;
+};
 
-uint64_t system___stack_chk_guard = 0;
+struct DyldImageTable {
+    unsigned long long adds, subs;
+    uint32_t count;
+    DyldImage images[];
+};
 
-void dyld_stub_binder() {
-    //
+using DyldAddImageFn = void (*)(const void* header, intptr_t slide);
+
+static std::atomic<const DyldImageTable*> currentImages {nullptr};
+static std::mutex imagesUpdateMutex;
+static std::vector<DyldAddImageFn> addImageCallbacks;
+
+struct DyldImageCollector {
+    std::vector<DyldImage> images;
+    unsigned long long adds = 0, subs = 0;
+};
+
+static int collect_dyld_image(struct dl_phdr_info* info, size_t size, void* data) {
+    auto& collector = *(DyldImageCollector*) data;
+    collector.adds = info->dlpi_adds;
+    collector.subs = info->dlpi_subs;
+
+    const void* header = nullptr;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        auto& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD && phdr.p_offset == 0) {
+            header = (const void*) (info->dlpi_addr + phdr.p_vaddr);
+            break;
+        }
+    }
+
+    const char* name = info->dlpi_name;
+    char path[PATH_MAX];
+    if (collector.images.empty()) {
+        // The main executable has no name in the link map
+        auto len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        path[len > 0 ? len : 0] = 0;
+        name = path;
+    }
+    collector.images.push_back({header, (intptr_t) info->dlpi_addr, strdup(name ? name : "")});
+    return 0;
 }
-intptr_t _dyld_get_image_vmaddr_slide(uint32_t index) {
-    if (index != 0) {
-        fprintf(stderr, "_dyld_get_image_vmaddr_slide: only supported for index 0\n");
-        abort();
+
+static int read_load_counters(struct dl_phdr_info* info, size_t size, void* data) {
+    auto counters = (unsigned long long*) data;
+    counters[0] = info->dlpi_adds;
+    counters[1] = info->dlpi_subs;
+    return 1;
+}
+
+// Requires imagesUpdateMutex, returns the new snapshot
+static const DyldImageTable* build_images() {
+    DyldImageCollector collector;
+    dl_iterate_phdr(collect_dyld_image, &collector);
+
+    auto table = (DyldImageTable*) malloc(sizeof(DyldImageTable) + collector.images.size() * sizeof(DyldImage));
+    table->adds = collector.adds;
+    table->subs = collector.subs;
+    table->count = (uint32_t) collector.images.size();
+    std::copy(collector.images.begin(), collector.images.end(), table->images);
+    currentImages.store(table, std::memory_order_release);
+    return table;
+}
+
+static void update_images() {
+    std::vector<DyldImage> added;
+    std::vector<DyldAddImageFn> callbacks;
+    {
+        std::lock_guard lock (imagesUpdateMutex);
+        auto old = currentImages.load(std::memory_order_acquire);
+        unsigned long long counters[2];
+        dl_iterate_phdr(read_load_counters, counters);
+        if (old && old->adds == counters[0] && old->subs == counters[1])
+            return;
+        auto table = build_images();
+        for (uint32_t i = 0; i < table->count; i++) {
+            auto const& image = table->images[i];
+            if (std::none_of(old->images, old->images + old->count, [&](auto const& o) { return o.header == image.header; }))
+                added.push_back(image);
+        }
+        callbacks = addImageCallbacks;
+    }
+    for (auto const& image : added) {
+        for (auto callback : callbacks)
+            callback(image.header, image.slide);
     }
+}
 
-    auto mainExe = (struct link_map*) dlopen(nullptr, RTLD_LAZY);
-    dlclose(mainExe);
-    return (intptr_t) mainExe->l_addr;
+__attribute__((constructor(101)))
+static void init_images() {
+    std::lock_guard lock (imagesUpdateMutex);
+    build_images();
 }
 
-const char* getsectdata(const char* segname, const char* sectname, unsigned long* size) {
-    // TODO: Support segname, maybe use some alternative section table?
+static const DyldImageTable* get_images() {
+    return currentImages.load(std::memory_order_acquire);
+}
 
+static const DyldImage* get_image(uint32_t index) {
+    auto images = get_images();
+    if (index >= images->count)
+        return nullptr;
+    return &images->images[index];
+}
+
+// Emitted by the converter, keep in sync with converter/converter.cpp (SectionTableBuilder)
+#define PT_COMPAT_SECTIONS 0x6d326502
+
+struct compat_section_table_header {
+    uint32_t version;
+    uint32_t count;
+};
+
+struct compat_section_table_entry {
+    char segname[16];
+    char sectname[16];
+    uint64_t addr;
+    uint64_t size;
+};
+
+struct SectionInfo {
+    uintptr_t address;
+    unsigned long size;
+};
+
+static std::unordered_map<std::string, SectionInfo> sectionIndex;
+static std::once_flag sectionIndexOnce;
+
+static std::string section_key(const char* segname, const char* sectname) {
+    std::string ret (segname, strnlen(segname, 16));
+    ret += ',';
+    ret.append(sectname, strnlen(sectname, 16));
+    return ret;
+}
+
+// Images converted before the section table existed only have ELF section headers, which are not mapped. They are read
+// from the file once, with the ELF names mapped back (.foo -> __foo) and without segment names.
+static void build_section_index_from_file(uintptr_t slide) {
     auto mainExeFile = fopen("/proc/self/exe", "rb");
     if (mainExeFile == nullptr)
-        return nullptr;
+        return;
+    std::unique_ptr<FILE, int (*)(FILE*)> fileGuard (mainExeFile, fclose);
 
     Elf64_Ehdr ehdr {};
     if (fread(&ehdr, sizeof(ehdr), 1, mainExeFile) != 1)
-        return nullptr;
+        return;
 
     std::vector<uint8_t> sectionData (ehdr.e_shnum * ehdr.e_shentsize);
     fseek(mainExeFile, ehdr.e_shoff, SEEK_SET);
     if (fread(sectionData.data(), ehdr.e_shentsize, ehdr.e_shnum, mainExeFile) != ehdr.e_shnum)
-        return nullptr;
+        return;
 
     const auto getSection = [&](int index) { return (Elf64_Shdr*) (sectionData.data() + index * ehdr.e_shentsize); };
-    std::vector<uint8_t> shstr (getSection(ehdr.e_shstrndx)->sh_size);
+    std::vector<char> shstr (getSection(ehdr.e_shstrndx)->sh_size + 1);
     fseek(mainExeFile, getSection(ehdr.e_shstrndx)->sh_offset, SEEK_SET);
-    if (fread(shstr.data(), 1, shstr.size(), mainExeFile) != shstr.size())
+    if (fread(shstr.data(), 1, shstr.size() - 1, mainExeFile) != shstr.size() - 1)
+        return;
+
+    for (int i = 0; i < ehdr.e_shnum; i++) {
+        auto section = getSection(i);
+        if (!(section->sh_flags & SHF_ALLOC) || section->sh_name >= shstr.size())
+            continue;
+        std::string name = &shstr[section->sh_name];
+        if (name.size() > 1 && name[0] == '.')
+            name = "__" + name.substr(1);
+        sectionIndex.emplace(section_key("", name.c_str()), SectionInfo {slide + section->sh_addr, (unsigned long) section->sh_size});
+    }
+}
+
+static int find_main_section_table(struct dl_phdr_info* info, size_t size, void* data) {
+    // The first object reported is the main executable
+    auto& table = *(std::pair<const compat_section_table_header*, uintptr_t>*) data;
+    table.second = info->dlpi_addr;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_COMPAT_SECTIONS)
+            table.first = (const compat_section_table_header*) (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+    }
+    return 1;
+}
+
+static void build_section_index() {
+    std::pair<const compat_section_table_header*, uintptr_t> table {nullptr, 0};
+    dl_iterate_phdr(find_main_section_table, &table);
+    auto [header, slide] = table;
+    if (!header || header->version != 1) {
+        build_section_index_from_file(slide);
+        return;
+    }
+
+    auto entries = (const compat_section_table_entry*) (header + 1);
+    sectionIndex.reserve(header->count);
+    for (uint32_t i = 0; i < header->count; i++) {
+        auto const& e = entries[i];
+        sectionIndex.emplace(section_key(e.segname, e.sectname), SectionInfo {slide + e.addr, (unsigned long) e.size});
+    }
+}
+
+extern "C" {
+
+uint64_t system___stack_chk_guard = 0;
+
+void dyld_stub_binder() {
+    //
+}
+uint32_t _dyld_image_count() {
+    return get_images()->count;
+}
+
+const void* _dyld_get_image_header(uint32_t index) {
+    auto image = get_image(index);
+    return image ? image->header : nullptr;
+}
+
+intptr_t _dyld_get_image_vmaddr_slide(uint32_t index) {
+    auto image = get_image(index);
+    return image ? image->slide : 0;
+}
+
+const char* _dyld_get_image_name(uint32_t index) {
+    auto image = get_image(index);
+    return image ? image->name : nullptr;
+}
+
+void _dyld_register_func_for_add_image(DyldAddImageFn func) {
+    const DyldImageTable* images;
+    {
+        std::lock_guard lock (imagesUpdateMutex);
+        addImageCallbacks.push_back(func);
+        images = get_images();
+    }
+    // Images loaded from now on are reported by update_images
+    for (uint32_t i = 0; i < images->count; i++)
+        func(images->images[i].header, images->images[i].slide);
+}
+
+int _NSGetExecutablePath(char* buf, uint32_t* bufsize) {
+    auto images = get_images();
+    auto len = strlen(images->images[0].name);
+    if (len + 1 > *bufsize) {
+        *bufsize = len + 1;
+        return -1;
+    }
+    memcpy(buf, images->images[0].name, len + 1);
+    return 0;
+}
+
+void* darwin_dlopen(const char* path, int mode) {
+    printf("dlopen: %s\n", path);
+    int host_mode = 0;
+    if (mode & 1) host_mode |= RTLD_LAZY;
+    if (mode & 2) host_mode |= RTLD_NOW;
+    if (mode & 4) host_mode |= RTLD_LOCAL;
+    if (mode & 8) host_mode |= RTLD_GLOBAL;
+    if (mode & 0x10) host_mode |= RTLD_NOLOAD;
+    if (mode & 0x80) host_mode |= RTLD_NODELETE;
+    auto ret = dlopen(path, host_mode);
+    if (ret)
+        update_images();
+    return ret;
+}
+
+int darwin_dlclose(void* handle) {
+    auto ret = dlclose(handle);
+    if (ret == 0)
+        update_images();
+    return ret;
+}
+
+const char* getsectdata(const char* segname, const char* sectname, unsigned long* size) {
+    std::call_once(sectionIndexOnce, build_section_index);
+
+    auto it = sectionIndex.find(section_key(segname, sectname));
+    if (it == sectionIndex.end())
+        it = sectionIndex.find(section_key("", sectname)); // images without a section table have no segment names
+    if (it == sectionIndex.end()) {
+        *size = 0; // like Darwin, callers may check the size instead of the pointer
         return nullptr;
+    }
+    *size = it->second.size;
+    return (const char*) it->second.address;
+}
 
-    std::string tmpStr;
-    if (sectname[0] == '_' && sectname[1] == '_') {
-        tmpStr = &sectname[1];
-        tmpStr[0] = '.';
-        sectname = tmpStr.c_str();
+// Written by the converter (ThreadLocalBuilder), keep in sync
+struct compat_tlv_image {
+    std::atomic<uint64_t> slot;
+    const uint8_t* templateAddress;
+    uint64_t templateSize;
+    uint64_t totalSizeAndAlignment; // log2 of the largest TLV section alignment in the top byte, 0 in older images
+};
+
+#define TLV_MAX_IMAGES 64
+#define TLV_ALIGNMENT_SHIFT 56
+#define TLV_MIN_ALIGNMENT 16
+
+// Per thread copy of the TLV template of each image, indexed by slot. Read by _tlv_bootstrap in dyld.s through the
+// initial-exec model, so the lookup is a single %fs relative load.
+__attribute__((tls_model("initial-exec"))) thread_local void* _tlv_blocks[TLV_MAX_IMAGES + 1];
+// What was allocated for each block, which starts a bit later to match the template's offset from the alignment
+__attribute__((tls_model("initial-exec"))) thread_local void* tlvAllocations[TLV_MAX_IMAGES + 1];
+
+static std::atomic<uint64_t> tlvNextSlot {1};
+static pthread_key_t tlvCleanupKey;
+static std::once_flag tlvCleanupKeyOnce;
+
+static void tlv_free_blocks(void*) {
+    for (std::size_t i = 0; i <= TLV_MAX_IMAGES; i++) {
+        free(tlvAllocations[i]);
+        tlvAllocations[i] = nullptr;
+        _tlv_blocks[i] = nullptr;
     }
+}
 
-    for (int i = 0; i < ehdr.e_shnum; i++) {
-        auto section = getSection(i);
-        auto name = (const char*) &shstr[section->sh_name];
-        if (!strcmp(name, sectname)) {
-            auto ret = (const char*) section->sh_addr;
-            *size = section->sh_size;
-            return ret;
+void* _tlv_bootstrap_impl(compat_tlv_image* image) {
+    auto slot = image->slot.load(std::memory_order_acquire);
+    if (slot == 0) {
+        auto newSlot = tlvNextSlot.fetch_add(1, std::memory_order_relaxed);
+        if (newSlot > TLV_MAX_IMAGES) {
+            fprintf(stderr, "_tlv_bootstrap: too many images with thread local variables\n");
+            abort();
         }
+        // Another thread may have assigned one meanwhile, its slot wins and ours stays unused
+        if (image->slot.compare_exchange_strong(slot, newSlot, std::memory_order_acq_rel))
+            slot = newSlot;
     }
 
-    return nullptr;
+    std::call_once(tlvCleanupKeyOnce, [] { pthread_key_create(&tlvCleanupKey, tlv_free_blocks); });
+    pthread_setspecific(tlvCleanupKey, (void*) 1);
+
+    // Variables are addressed relative to the template start, which need not be aligned as much as the sections after
+    // it; the block keeps the template's distance from the alignment
+    auto totalSize = image->totalSizeAndAlignment & ((1ull << TLV_ALIGNMENT_SHIFT) - 1);
+    auto alignment = std::max<uint64_t>(1ull << (image->totalSizeAndAlignment >> TLV_ALIGNMENT_SHIFT), TLV_MIN_ALIGNMENT);
+    auto skew = (uintptr_t) image->templateAddress & (alignment - 1);
+    auto allocationSize = (skew + std::max<uint64_t>(totalSize, 1) + alignment - 1) & ~(alignment - 1);
+    auto allocation = (uint8_t*) aligned_alloc(alignment, allocationSize);
+    if (!allocation) {
+        fprintf(stderr, "_tlv_bootstrap: failed to allocate %llu bytes\n", (unsigned long long) allocationSize);
+        abort();
+    }
+    auto block = allocation + skew;
+    memcpy(block, image->templateAddress, image->templateSize);
+    memset(block + image->templateSize, 0, totalSize - image->templateSize);
+    tlvAllocations[slot] = allocation;
+    _tlv_blocks[slot] = block;
+    return block;
 }
 
-static thread_local char buf[0x1000];
-void* _tlv_bootstrap_impl(){ //TODO:
-    auto ret = buf;
-    return ret;
+int __cxa_thread_atexit_impl(void (*func)(void*), void* obj, void* dsoSymbol);
+
+// Registers the destructor of a C++ thread_local object, called by the code clang generates on Darwin. glibc keeps the
+// object that contains dsoSymbol loaded until the destructor has run, which has to be the image of the destructor.
+void _tlv_atexit(void (*termFunc)(void* objAddr), void* objAddr) {
+    __cxa_thread_atexit_impl(termFunc, objAddr, (void*) termFunc);
 }
 
 }
\ No newline at end of file
@@ -45,14 +45,19 @@
 
 
 # returns address of TLV in %rax, all other registers preserved
+# The converter points the key of every descriptor to its image's compat_tlv_image record (see dyld.cpp), whose first
+# field is the image's slot in _tlv_blocks, or 0 before the first access. _tlv_blocks[0] is always NULL.
 	.globl _tlv_bootstrap
 _tlv_bootstrap:
-#	movq	8(%rdi),%rax			# get key from descriptor
-#	movq	%gs:0x0(,%rax,8),%rax	# get thread value
-#	testq	%rax,%rax				# if NULL, lazily allocate
-#	je		LlazyAllocate
-#	addq	16(%rdi),%rax			# add offset from descriptor
-#	ret
+	movq	8(%rdi),%rax			# get image record from descriptor
+	movq	(%rax),%rax				# get slot of the image
+	shlq	$3,%rax
+	addq	_tlv_blocks@gottpoff(%rip),%rax
+	movq	%fs:(%rax),%rax			# get thread value
+	testq	%rax,%rax				# if NULL, lazily allocate
+	je		LlazyAllocate
+	addq	16(%rdi),%rax			# add offset from descriptor
+	ret
 LlazyAllocate:
 	pushq		%rbp
 	movq		%rsp,%rbp
@@ -127,10 +132,9 @@ Lz:	movq		%rcx, (%r8)
 	xsave		(%rsp)
 
 Lalloc:
-#	movq		RDI_SAVE_RBP(%rbp),%rdi
-#	movq		8(%rdi),%rdi		        # get key from descriptor
-#	call		_instantiateTLVs_thunk      # instantiateTLVs(key)
-	call		_tlv_bootstrap_impl
+	movq		RDI_SAVE_RBP(%rbp),%rdi
+	movq		8(%rdi),%rdi		        # get image record from descriptor
+	call		_tlv_bootstrap_impl			# instantiate the TLVs of the image for this thread
 
 	cmpl		$0, _hasXSave(%rip)
 	jne			Lxrstror
@@ -0,0 +1,38 @@
+# Startup code placed in .compat.text of every converted image, the converter links the assembled bytes in at build
+# time (see embed_gen). Code may only reference .compat.data, which is placed in a separate segment of the output.
+# Pointers in .compat.data are filled by dynamic relocations, undefined symbols are imported except for the two below
+# which the converter resolves itself:
+#   __macho_entry   entry point of the original Mach-O
+#   __image_base    address the image was loaded at (its ELF header)
+
+.intel_syntax noprefix
+
+.section .compat.data, "aw"
+.p2align 3
+libc_start_main_ptr:    .quad __libc_start_main
+entry_ptr:              .quad __macho_entry
+cxa_finalize_ptr:       .quad __cxa_finalize
+image_base_ptr:         .quad __image_base
+
+.text
+
+.globl main
+main:
+    endbr64
+    xor     ebp, ebp
+    mov     r9, rdx         # rtld_fini
+    pop     rsi             # argc
+    mov     rdx, rsp        # ubp_av
+    and     rsp, 0xFFFFFFFFFFFFFFF0
+    push    rax
+    push    rsp             # stack_end
+    xor     r8d, r8d        # fini
+    xor     ecx, ecx        # init
+    mov     rdi, qword ptr [rip + entry_ptr]
+    call    qword ptr [rip + libc_start_main_ptr]
+    hlt
+
+.globl finalize
+finalize:
+    mov     rdi, qword ptr [rip + image_base_ptr]
+    jmp     qword ptr [rip + cxa_finalize_ptr]
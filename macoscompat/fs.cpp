@@ -2,9 +2,16 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
+#include <cstddef>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include "shim_translation.h"
 
 extern "C" {
 
@@ -55,40 +62,193 @@ struct darwin_dirent {
 };
 
 
-int alphasort$INODE64(const struct darwin_dirent **, const struct darwin_dirent **) {
-    abort();
+// Directory streams read entries with getdents64 into their own buffer and convert one entry at a time into the
+// Darwin layout, so readdir does not allocate. dirfd() is a macro reading the first field in older SDKs, hence fd first.
+struct darwin_DIR {
+    int fd;
+    size_t pos;
+    size_t end;
+    long nextOffset; // telldir() cookie of the entry readdir returns next
+    darwin_dirent entry;
+    alignas(8) char buf[32768];
+};
+
+static constexpr size_t DARWIN_DIRENT_HEADER_SIZE = offsetof(darwin_dirent, d_name);
+
+static uint16_t darwin_dirent_size(size_t namlen) {
+    return (uint16_t) ((DARWIN_DIRENT_HEADER_SIZE + namlen + 1 + 7) & ~(size_t) 7);
 }
-int scandir$INODE64(const char* dirp, struct darwin_dirent*** namelist, int (*filter)(const struct darwin_dirent *),
-                     int (*compar)(const struct darwin_dirent **, const struct darwin_dirent **)) {
-    if (filter != nullptr) {
-        fprintf(stderr, "scandir: filter is not supported\n");
-        abort();
+
+static void convertDirent(struct dirent64 const& host, darwin_dirent* res) {
+    auto namlen = strlen(host.d_name); // at most NAME_MAX
+    res->d_ino = host.d_ino;
+    res->d_seekoff = host.d_off;
+    res->d_reclen = darwin_dirent_size(namlen);
+    res->d_namlen = (uint16_t) namlen;
+    res->d_type = host.d_type; // the DT_* values are the same
+    memcpy(res->d_name, host.d_name, namlen);
+    res->d_name[namlen] = 0;
+}
+
+static darwin_DIR* darwin_open_dir_fd(int fd) {
+    auto dir = (darwin_DIR*) malloc(sizeof(darwin_DIR));
+    if (!dir)
+        return nullptr;
+    dir->fd = fd;
+    dir->pos = dir->end = 0;
+    dir->nextOffset = 0;
+    return dir;
+}
+
+// Returns the next host entry or nullptr at the end or on error, error is set to the errno of a failed read and 0
+// otherwise; errno itself says nothing about the end of the stream
+static const struct dirent64* darwin_next_host_dirent(darwin_DIR* dir, int& error) {
+    error = 0;
+    if (dir->pos >= dir->end) {
+        auto n = getdents64(dir->fd, dir->buf, sizeof(dir->buf));
+        if (n < 0)
+            error = errno;
+        if (n <= 0)
+            return nullptr;
+        dir->pos = 0;
+        dir->end = (size_t) n;
     }
-    if (compar != alphasort$INODE64) {
-        fprintf(stderr, "scandir: only alphasort is supported\n");
-        abort();
+    auto host = (const struct dirent64*) (dir->buf + dir->pos);
+    dir->pos += host->d_reclen;
+    dir->nextOffset = host->d_off;
+    return host;
+}
+
+darwin_DIR* opendir$INODE64(const char* name) {
+    int fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    auto ret = darwin_open_dir_fd(fd);
+    if (!ret)
+        close(fd);
+    return ret;
+}
+
+darwin_DIR* fdopendir$INODE64(int fd) {
+    struct stat st {};
+    if (fstat(fd, &st) != 0)
+        return nullptr;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return nullptr;
     }
+    return darwin_open_dir_fd(fd);
+}
 
-    struct dirent64** host_namelist = nullptr;
-    int ret = scandir64(dirp, &host_namelist, nullptr, alphasort64);
-    if (ret < 0)
-        return ret;
-    if (host_namelist) {
-        auto ret_namelist = (struct darwin_dirent**) malloc(sizeof(darwin_dirent) * ret);
-        *namelist = ret_namelist;
-        for (int i = 0; i < ret; i++) {
-            ret_namelist[i] = new darwin_dirent;
-            ret_namelist[i]->d_ino = host_namelist[i]->d_ino;
-            ret_namelist[i]->d_seekoff = host_namelist[i]->d_off;
-            ret_namelist[i]->d_reclen = host_namelist[i]->d_reclen;
-            ret_namelist[i]->d_namlen = strlen(host_namelist[i]->d_name);
-            ret_namelist[i]->d_type = host_namelist[i]->d_type;
-            strncpy(ret_namelist[i]->d_name, host_namelist[i]->d_name, __DARWIN_MAXPATHLEN);
+int darwin_closedir(darwin_DIR* dir) {
+    int ret = close(dir->fd);
+    free(dir);
+    return ret;
+}
+
+int darwin_dirfd(darwin_DIR* dir) {
+    return dir->fd;
+}
+
+darwin_dirent* readdir$INODE64(darwin_DIR* dir) {
+    int error;
+    auto host = darwin_next_host_dirent(dir, error);
+    if (!host)
+        return nullptr;
+    convertDirent(*host, &dir->entry);
+    return &dir->entry;
+}
+
+int readdir_r$INODE64(darwin_DIR* dir, darwin_dirent* entry, darwin_dirent** result) {
+    int savedErrno = errno;
+    int error;
+    auto host = darwin_next_host_dirent(dir, error);
+    errno = savedErrno;
+    if (!host) {
+        *result = nullptr;
+        return error;
+    }
+    convertDirent(*host, entry);
+    *result = entry;
+    return 0;
+}
+
+long telldir$INODE64(darwin_DIR* dir) {
+    return dir->nextOffset;
+}
+
+void seekdir$INODE64(darwin_DIR* dir, long loc) {
+    lseek(dir->fd, loc, SEEK_SET);
+    dir->pos = dir->end = 0;
+    dir->nextOffset = loc;
+}
+
+void rewinddir$INODE64(darwin_DIR* dir) {
+    seekdir$INODE64(dir, 0);
+}
+
+int alphasort$INODE64(const struct darwin_dirent** a, const struct darwin_dirent** b) {
+    return strcoll((*a)->d_name, (*b)->d_name);
+}
+
+// The filter sees a scratch entry, only accepted entries are copied out. Every entry is its own allocation of just its
+// record length, callers free() them one by one.
+int scandir$INODE64(const char* dirp, struct darwin_dirent*** namelist, int (*filter)(const struct darwin_dirent *),
+                     int (*compar)(const struct darwin_dirent **, const struct darwin_dirent **)) {
+    auto dir = opendir$INODE64(dirp);
+    if (!dir)
+        return -1;
+
+    darwin_dirent** list = nullptr;
+    size_t count = 0, capacity = 0;
+    bool failed = false;
+    int error;
+    // The filter may well leave errno set, only a failed read counts
+    while (auto host = darwin_next_host_dirent(dir, error)) {
+        convertDirent(*host, &dir->entry);
+        if (filter && !filter(&dir->entry))
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            auto newList = (darwin_dirent**) realloc(list, capacity * sizeof(darwin_dirent*));
+            if (!newList) {
+                failed = true;
+                break;
+            }
+            list = newList;
         }
+        auto entry = (darwin_dirent*) malloc(dir->entry.d_reclen);
+        if (!entry) {
+            failed = true;
+            break;
+        }
+        memcpy(entry, &dir->entry, dir->entry.d_reclen);
+        list[count++] = entry;
     }
-    return ret;
+    darwin_closedir(dir);
+
+    if (failed || error != 0) {
+        for (size_t i = 0; i < count; i++)
+            free(list[i]);
+        free(list);
+        errno = failed ? ENOMEM : error;
+        return -1;
+    }
+    if (compar && count > 1)
+        qsort(list, count, sizeof(darwin_dirent*), (int (*)(const void*, const void*)) compar);
+    *namelist = list;
+    return (int) count;
 }
 
+// Everything darwin_stat needs except the birth time: STATX_BTIME can cost an extra round trip on network and FUSE
+// filesystems, so st_birthtimespec is only filled in when the filesystem returns it anyway. AT_STATX_DONT_SYNC lets
+// those filesystems answer from cached attributes, which is what Darwin's stat does as well.
+#define DARWIN_STATX_MASK STATX_BASIC_STATS
+#define DARWIN_STATX_FLAGS AT_STATX_DONT_SYNC
+
+#define DARWIN_AT_FDCWD -2
+#define DARWIN_AT_SYMLINK_NOFOLLOW 0x0020
+
 static void convertStat(struct statx const& host, struct darwin_stat* res) {
     res->st_dev = (host.stx_dev_major << 24) | host.stx_dev_minor;
     res->st_mode = host.stx_mode;
@@ -100,49 +260,150 @@ static void convertStat(struct statx const& host, struct darwin_stat* res) {
     res->st_atimespec = {host.stx_atime.tv_sec, host.stx_atime.tv_nsec};
     res->st_mtimespec = {host.stx_mtime.tv_sec, host.stx_mtime.tv_nsec};
     res->st_ctimespec = {host.stx_ctime.tv_sec, host.stx_ctime.tv_nsec};
-    res->st_birthtimespec = {host.stx_btime.tv_sec, host.stx_btime.tv_nsec};
+    if (host.stx_mask & STATX_BTIME)
+        res->st_birthtimespec = {host.stx_btime.tv_sec, host.stx_btime.tv_nsec};
+    else
+        res->st_birthtimespec = {0, 0};
     res->st_size = host.stx_size;
     res->st_blocks = host.stx_blocks;
     res->st_blksize = host.stx_blksize;
     res->st_flags = 0;
     res->st_gen = 0;
+    res->st_lspare = 0;
+    res->st_qspare[0] = res->st_qspare[1] = 0;
 }
 
-int fstat$INODE64(int fd, struct darwin_stat* res) {
-    struct statx host {};
-    int ret = statx(fd, "", AT_EMPTY_PATH, STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_UID|STATX_GID|STATX_ATIME|STATX_MTIME|STATX_CTIME|STATX_INO|STATX_SIZE|STATX_BLOCKS|STATX_BASIC_STATS|STATX_BTIME, &host);
+static int darwin_statx(int dirfd, const char* path, int flags, struct darwin_stat* res) {
+    struct statx host;
+    int ret = statx(dirfd, path, flags | DARWIN_STATX_FLAGS, DARWIN_STATX_MASK, &host);
     if (ret)
         return ret;
     convertStat(host, res);
     return 0;
 }
+
+int fstat$INODE64(int fd, struct darwin_stat* res) {
+    return darwin_statx(fd, "", AT_EMPTY_PATH, res);
+}
 int stat$INODE64(const char* path, struct darwin_stat* res) {
-    struct statx host {};
-    int ret = statx(AT_FDCWD, path, 0, STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_UID|STATX_GID|STATX_ATIME|STATX_MTIME|STATX_CTIME|STATX_INO|STATX_SIZE|STATX_BLOCKS|STATX_BASIC_STATS|STATX_BTIME, &host);
-    if (ret)
-        return ret;
-    convertStat(host, res);
+    return darwin_statx(AT_FDCWD, path, 0, res);
+}
+int lstat$INODE64(const char* path, struct darwin_stat* res) {
+    return darwin_statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, res);
+}
+int fstatat$INODE64(int fd, const char* path, struct darwin_stat* res, int flag) {
+    if (flag & ~DARWIN_AT_SYMLINK_NOFOLLOW) {
+        errno = EINVAL;
+        return -1;
+    }
+    return darwin_statx(fd == DARWIN_AT_FDCWD ? AT_FDCWD : fd, path, (flag & DARWIN_AT_SYMLINK_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0, res);
+}
+
+#define DARWIN_MFSTYPENAMELEN 16
+
+#define DARWIN_MNT_RDONLY 0x00000001
+#define DARWIN_MNT_SYNCHRONOUS 0x00000002
+#define DARWIN_MNT_NOEXEC 0x00000004
+#define DARWIN_MNT_NOSUID 0x00000008
+#define DARWIN_MNT_NODEV 0x00000010
+#define DARWIN_MNT_LOCAL 0x00001000
+#define DARWIN_MNT_NOATIME 0x10000000
+
+struct darwin_statfs {
+    uint32_t f_bsize;
+    int32_t f_iosize;
+    uint64_t f_blocks;
+    uint64_t f_bfree;
+    uint64_t f_bavail;
+    uint64_t f_files;
+    uint64_t f_ffree;
+    int32_t f_fsid[2];
+    darwin_id_t f_owner;
+    uint32_t f_type;
+    uint32_t f_flags;
+    uint32_t f_fssubtype;
+    char f_fstypename[DARWIN_MFSTYPENAMELEN];
+    char f_mntonname[__DARWIN_MAXPATHLEN];
+    char f_mntfromname[__DARWIN_MAXPATHLEN];
+    uint32_t f_flags_ext;
+    uint32_t f_reserved[7];
+};
+
+// Fills in the names from the /proc/self/mountinfo line of the mount with the given device
+static void fill_mount_names(dev_t dev, struct darwin_statfs* res) {
+    auto mountInfo = fopen("/proc/self/mountinfo", "re");
+    if (!mountInfo)
+        return;
+    char* line = nullptr;
+    size_t lineSize = 0;
+    while (getline(&line, &lineSize, mountInfo) > 0) {
+        // id parent major:minor root mountpoint options [optional fields] - fstype source superoptions
+        unsigned major, minor;
+        char mountPoint[__DARWIN_MAXPATHLEN];
+        if (sscanf(line, "%*d %*d %u:%u %*s %1023s", &major, &minor, mountPoint) != 3 || makedev(major, minor) != dev)
+            continue;
+        auto separator = strstr(line, " - ");
+        char fsType[DARWIN_MFSTYPENAMELEN] = {}, source[__DARWIN_MAXPATHLEN] = {};
+        if (!separator || sscanf(separator, " - %15s %1023s", fsType, source) < 1)
+            continue;
+        // Later lines are mounted over earlier ones
+        strcpy(res->f_mntonname, mountPoint);
+        strcpy(res->f_fstypename, fsType);
+        strcpy(res->f_mntfromname, source);
+    }
+    free(line);
+    fclose(mountInfo);
+
+    if (strncmp(res->f_fstypename, "nfs", 3) != 0 && strcmp(res->f_fstypename, "cifs") != 0 && strncmp(res->f_fstypename, "smb", 3) != 0)
+        res->f_flags |= DARWIN_MNT_LOCAL;
+}
+
+static void convertStatfs(struct statfs const& host, dev_t dev, struct darwin_statfs* res) {
+    memset(res, 0, sizeof(*res));
+    res->f_bsize = (uint32_t) host.f_bsize;
+    res->f_iosize = (int32_t) host.f_bsize;
+    res->f_blocks = host.f_blocks;
+    res->f_bfree = host.f_bfree;
+    res->f_bavail = host.f_bavail;
+    res->f_files = host.f_files;
+    res->f_ffree = host.f_ffree;
+    memcpy(res->f_fsid, &host.f_fsid, sizeof(res->f_fsid));
+    res->f_type = (uint32_t) host.f_type;
+    if (host.f_flags & ST_RDONLY) res->f_flags |= DARWIN_MNT_RDONLY;
+    if (host.f_flags & ST_SYNCHRONOUS) res->f_flags |= DARWIN_MNT_SYNCHRONOUS;
+    if (host.f_flags & ST_NOEXEC) res->f_flags |= DARWIN_MNT_NOEXEC;
+    if (host.f_flags & ST_NOSUID) res->f_flags |= DARWIN_MNT_NOSUID;
+    if (host.f_flags & ST_NODEV) res->f_flags |= DARWIN_MNT_NODEV;
+    if (host.f_flags & ST_NOATIME) res->f_flags |= DARWIN_MNT_NOATIME;
+    fill_mount_names(dev, res);
+}
+
+int fstatfs$INODE64(int fd, struct darwin_statfs* res) {
+    struct statfs host;
+    struct stat st;
+    if (fstatfs(fd, &host) != 0 || fstat(fd, &st) != 0)
+        return -1;
+    convertStatfs(host, st.st_dev, res);
     return 0;
 }
+int statfs$INODE64(const char* path, struct darwin_statfs* res) {
+    struct statfs host;
+    struct stat st;
+    if (statfs(path, &host) != 0 || stat(path, &st) != 0)
+        return -1;
+    convertStatfs(host, st.st_dev, res);
+    return 0;
+}
+int darwin_fstatfs64(int fd, struct darwin_statfs* res) {
+    return fstatfs$INODE64(fd, res);
+}
+int darwin_statfs64(const char* path, struct darwin_statfs* res) {
+    return statfs$INODE64(path, res);
+}
 
 
 int darwin_open(const char *file, int oflag, mode_t mode) {
-    int host_oflag = 0;
-
-    if (oflag & 1) host_oflag |= O_WRONLY;
-    if (oflag & 2) host_oflag |= O_RDWR;
-    if (oflag & 4) host_oflag |= O_NONBLOCK;
-    if (oflag & 8) host_oflag |= O_APPEND;
-//    if (oflag & 0x10) host_oflag |= O_SHLOCK;
-//    if (oflag & 0x20) host_oflag |= O_EXLOCK;
-    if (oflag & 0x40) host_oflag |= O_ASYNC;
-    if (oflag & 0x80) host_oflag |= O_SYNC;
-    if (oflag & 0x100) host_oflag |= O_NOFOLLOW;
-    if (oflag & 0x200) host_oflag |= O_CREAT;
-    if (oflag & 0x400) host_oflag |= O_TRUNC;
-    if (oflag & 0x800) host_oflag |= O_EXCL;
-
-    return open(file, host_oflag, mode);
+    return darwin_open_impl(file, oflag, mode);
 }
 
 }
\ No newline at end of file
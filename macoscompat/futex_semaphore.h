@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Counting semaphore with the semantics of a Mach semaphore. The count and a termination flag share the futex word,
+// so signal and wait stay in userspace unless somebody actually has to sleep, and destroy can wake every waiter
+// without the chance of one of them going to sleep after the fact. terminate only returns once every waiter has seen
+// the flag, so the memory can be init'ed for the next user right away.
+struct FutexSemaphore {
+
+    enum class WaitResult {
+        Success,
+        TimedOut,
+        Interrupted,
+        Terminated,
+    };
+
+private:
+    static constexpr uint32_t Terminated = 0x80000000u;
+    static constexpr int SpinCount = 100;
+
+    std::atomic<uint32_t> value {0};
+    std::atomic<uint32_t> waiters {0}; // asleep or about to be, signal only wakes if there are any
+    std::atomic<uint32_t> inWait {0}; // past the fast path of wait, terminate waits for them to leave
+
+    static long futex(std::atomic<uint32_t>* addr, int op, uint32_t val, const struct timespec* timeout, uint32_t val3) {
+        return syscall(SYS_futex, (uint32_t*) addr, op | FUTEX_PRIVATE_FLAG, val, timeout, nullptr, val3);
+    }
+
+    // Takes one unit if there is one, v is updated to the current value
+    bool tryTake(uint32_t& v) {
+        while (v != 0 && !(v & Terminated)) {
+            if (value.compare_exchange_weak(v, v - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+public:
+    void init(uint32_t initialValue) {
+        value.store(initialValue, std::memory_order_release);
+    }
+
+    // Returns whether a waiter was woken
+    bool signal() {
+        value.fetch_add(1, std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) == 0)
+            return false;
+        return futex(&value, FUTEX_WAKE, 1, nullptr, 0) > 0;
+    }
+
+    void terminate() {
+        value.fetch_or(Terminated, std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) != 0)
+            futex(&value, FUTEX_WAKE, INT_MAX, nullptr, 0);
+        // A reused semaphore would hand its units to the old waiters or hide the flag from them
+        while (inWait.load(std::memory_order_acquire) != 0)
+            sched_yield();
+    }
+
+    // Waits until the count can be decremented. A timeout is relative like in Mach and measured on CLOCK_MONOTONIC,
+    // nullptr waits forever and a zero timeout only polls.
+    WaitResult wait(const struct timespec* timeout) {
+        auto v = value.load(std::memory_order_relaxed);
+        if (tryTake(v))
+            return WaitResult::Success;
+        inWait.fetch_add(1, std::memory_order_seq_cst);
+        auto result = waitSlow(timeout);
+        inWait.fetch_sub(1, std::memory_order_release);
+        return result;
+    }
+
+private:
+    WaitResult waitSlow(const struct timespec* timeout) {
+        auto v = value.load(std::memory_order_seq_cst);
+        if (tryTake(v))
+            return WaitResult::Success;
+        for (int i = 0; i < SpinCount && !(v & Terminated); i++) {
+            __builtin_ia32_pause();
+            v = value.load(std::memory_order_relaxed);
+            if (tryTake(v))
+                return WaitResult::Success;
+        }
+        if (v & Terminated)
+            return WaitResult::Terminated;
+        if (timeout && timeout->tv_sec == 0 && timeout->tv_nsec == 0)
+            return WaitResult::TimedOut;
+
+        // FUTEX_WAIT_BITSET takes an absolute deadline, so the wait is not extended by spurious or stolen wakeups
+        struct timespec deadline {};
+        if (timeout) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout->tv_sec;
+            deadline.tv_nsec += timeout->tv_nsec;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += deadline.tv_nsec / 1000000000;
+                deadline.tv_nsec %= 1000000000;
+            }
+        }
+
+        auto result = WaitResult::Success;
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        while (true) {
+            v = value.load(std::memory_order_seq_cst);
+            if (tryTake(v))
+                break;
+            if (v & Terminated) {
+                result = WaitResult::Terminated;
+                break;
+            }
+            if (futex(&value, FUTEX_WAIT_BITSET, v, timeout ? &deadline : nullptr, FUTEX_BITSET_MATCH_ANY) == 0)
+                continue;
+            if (errno == ETIMEDOUT) {
+                result = WaitResult::TimedOut;
+                break;
+            }
+            if (errno == EINTR) {
+                result = WaitResult::Interrupted;
+                break;
+            }
+            // EAGAIN: the value changed before we got to sleep
+        }
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return result;
+    }
+
+};
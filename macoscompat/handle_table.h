@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Maps 32-bit handles (as used for Mach ports) to objects of type T without any locks. Pages are allocated on first
+// use and never freed or moved, so a lookup is a couple of loads and never waits for an allocation. Freed slots are
+// kept on a tagged Treiber stack and reused. Every allocation and free bumps the slot's generation, which is odd while
+// the slot is in use and part of the handle, so that stale handles are rejected instead of aliasing the new object.
+// Handle 0 is never returned.
+template <typename T, uint32_t PerPage = 256, uint32_t PageCount = 1024>
+struct HandleTable {
+
+private:
+    static_assert((PerPage & (PerPage - 1)) == 0);
+
+    static constexpr uint32_t IndexBits = 32 - __builtin_clz(PerPage * PageCount);
+    static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+    static constexpr uint32_t GenerationMask = UINT32_MAX >> IndexBits;
+    static_assert(IndexBits < 32);
+
+    struct Slot {
+        T value;
+        std::atomic<uint32_t> generation {0};
+        std::atomic<uint32_t> next {0}; // free list link, index + 1
+    };
+
+    struct Page {
+        Slot slots[PerPage];
+    };
+
+    std::atomic<Page*> pages[PageCount] = {};
+    std::atomic<uint32_t> nextUnusedIndex {0};
+    std::atomic<uint64_t> freeHead {0}; // ABA tag << 32 | (index + 1)
+
+    Page* getPage(uint32_t pageIndex) {
+        auto page = pages[pageIndex].load(std::memory_order_acquire);
+        if (page)
+            return page;
+        auto newPage = new Page();
+        if (pages[pageIndex].compare_exchange_strong(page, newPage, std::memory_order_acq_rel))
+            return newPage;
+        delete newPage; // lost the race, page is the winner's
+        return page;
+    }
+
+    Slot& slotAt(uint32_t index) const {
+        return pages[index / PerPage].load(std::memory_order_acquire)->slots[index % PerPage];
+    }
+
+    uint32_t popFree() {
+        auto head = freeHead.load(std::memory_order_acquire);
+        while ((uint32_t) head != 0) {
+            auto index = (uint32_t) head - 1;
+            // The slot may be popped and pushed again meanwhile, the tag makes the CAS fail in that case
+            uint64_t newHead = ((head >> 32) + 1) << 32 | slotAt(index).next.load(std::memory_order_relaxed);
+            if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel))
+                return index;
+        }
+        return UINT32_MAX;
+    }
+
+    void pushFree(uint32_t index) {
+        auto& slot = slotAt(index);
+        auto head = freeHead.load(std::memory_order_relaxed);
+        do {
+            slot.next.store((uint32_t) head, std::memory_order_relaxed);
+        } while (!freeHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | (index + 1), std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    }
+
+    uint32_t makeHandle(uint32_t index, uint32_t generation) const {
+        return (generation << IndexBits) | (index + 1);
+    }
+
+public:
+    HandleTable() = default;
+    HandleTable(HandleTable const&) = delete;
+    HandleTable& operator=(HandleTable const&) = delete;
+
+    ~HandleTable() {
+        for (auto& page : pages)
+            delete page.load(std::memory_order_relaxed);
+    }
+
+    // Returns the handle of a free slot and stores its object in value, or 0 if the table is full. The object keeps
+    // whatever state it was left in by the previous user of the slot.
+    uint32_t allocate(T*& value) {
+        auto index = popFree();
+        if (index == UINT32_MAX) {
+            index = nextUnusedIndex.fetch_add(1, std::memory_order_relaxed);
+            if (index >= PerPage * PageCount) {
+                nextUnusedIndex.fetch_sub(1, std::memory_order_relaxed);
+                return 0;
+            }
+            getPage(index / PerPage);
+        }
+
+        auto page = pages[index / PerPage].load(std::memory_order_acquire);
+        auto& slot = page->slots[index % PerPage];
+        // The slot is exclusively ours until the handle is returned
+        auto generation = (slot.generation.load(std::memory_order_relaxed) + 1) & GenerationMask;
+        slot.generation.store(generation, std::memory_order_release);
+        value = &slot.value;
+        return makeHandle(index, generation);
+    }
+
+    // Wait-free, returns nullptr for handles that were never allocated or are freed already
+    T* get(uint32_t handle) const {
+        auto index = (handle & IndexMask) - 1;
+        if (index >= PerPage * PageCount)
+            return nullptr;
+        auto page = pages[index / PerPage].load(std::memory_order_acquire);
+        if (!page)
+            return nullptr;
+        auto& slot = page->slots[index % PerPage];
+        auto generation = slot.generation.load(std::memory_order_acquire);
+        if (!(generation & 1) || makeHandle(index, generation) != handle)
+            return nullptr;
+        return &slot.value;
+    }
+
+    // Returns false if the handle is not currently allocated
+    bool free(uint32_t handle) {
+        auto index = (handle & IndexMask) - 1;
+        if (!get(handle))
+            return false;
+        auto page = pages[index / PerPage].load(std::memory_order_acquire);
+        auto& slot = page->slots[index % PerPage];
+        auto generation = handle >> IndexBits;
+        // Only one of several concurrent frees of the same handle gets to bump the generation
+        if (!slot.generation.compare_exchange_strong(generation, (generation + 1) & GenerationMask, std::memory_order_acq_rel))
+            return false;
+        pushFree(index);
+        return true;
+    }
+
+};
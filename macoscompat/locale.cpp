@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <locale.h>
+#include <strings.h>
+
+// Darwin numbers the locale categories and masks differently, everything else about the locale objects is left to the
+// host. Collation is special cased: in the C locale and in all of Darwin's UTF-8 locales it is plain code point order
+// (there are no collation rules for them), which for UTF-8 is byte order. Whether the locale in use collates like that
+// is decided when it is installed, so that strcoll and friends go straight to the (vectorized) comparisons of libc.
+// The ctype of Darwin's own locale code (the rune tables behind the ctype inlines and the UTF-8 converters) follows the
+// host locale's codeset the same way: UTF-8 gets Darwin's UTF-8 ctype, everything else the C one.
+
+extern "C" {
+#define XLOCALE_CTYPE_GLOBAL (-1)
+#define XLOCALE_CTYPE_C 0
+#define XLOCALE_CTYPE_UTF8 1
+void __xlocale_set_global_ctype(int ctype);
+void __xlocale_set_thread_ctype(int ctype);
+}
+
+namespace {
+
+enum class Collation : uint8_t {
+    FollowGlobal, // the thread uses the global locale
+    Trivial,
+    Rules,
+};
+
+std::atomic<bool> globalCollationTrivial {true}; // every process starts in the C locale
+thread_local Collation threadCollation __attribute__((tls_model("initial-exec"))) = Collation::FollowGlobal;
+
+enum {
+    DARWIN_LC_ALL = 0,
+    DARWIN_LC_COLLATE = 1,
+    DARWIN_LC_CTYPE = 2,
+    DARWIN_LC_MONETARY = 3,
+    DARWIN_LC_NUMERIC = 4,
+    DARWIN_LC_TIME = 5,
+    DARWIN_LC_MESSAGES = 6,
+};
+
+int darwin_category_to_host(int category) {
+    switch (category) {
+        case DARWIN_LC_ALL: return LC_ALL;
+        case DARWIN_LC_COLLATE: return LC_COLLATE;
+        case DARWIN_LC_CTYPE: return LC_CTYPE;
+        case DARWIN_LC_MONETARY: return LC_MONETARY;
+        case DARWIN_LC_NUMERIC: return LC_NUMERIC;
+        case DARWIN_LC_TIME: return LC_TIME;
+        case DARWIN_LC_MESSAGES: return LC_MESSAGES;
+        default: return -1;
+    }
+}
+
+int darwin_mask_to_host(int mask) {
+    int hostMask = 0;
+    if (mask & (1 << 0)) hostMask |= LC_COLLATE_MASK;
+    if (mask & (1 << 1)) hostMask |= LC_CTYPE_MASK;
+    if (mask & (1 << 2)) hostMask |= LC_MESSAGES_MASK;
+    if (mask & (1 << 3)) hostMask |= LC_MONETARY_MASK;
+    if (mask & (1 << 4)) hostMask |= LC_NUMERIC_MASK;
+    if (mask & (1 << 5)) hostMask |= LC_TIME_MASK;
+    return hostMask;
+}
+
+bool has_utf8_codeset(const char* name) {
+    auto codeset = name ? strchr(name, '.') : nullptr;
+    if (!codeset)
+        return false;
+    codeset++;
+    auto length = strcspn(codeset, "@");
+    return (length == 5 && strncasecmp(codeset, "UTF-8", 5) == 0) || (length == 4 && strncasecmp(codeset, "utf8", 4) == 0);
+}
+
+bool is_trivial_collation(const char* name) {
+    if (name && (strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0))
+        return true;
+    return has_utf8_codeset(name);
+}
+
+int darwin_ctype(const char* name) {
+    return has_utf8_codeset(name) ? XLOCALE_CTYPE_UTF8 : XLOCALE_CTYPE_C;
+}
+
+bool current_collation_trivial() {
+    auto collation = threadCollation;
+    if (collation == Collation::FollowGlobal)
+        return globalCollationTrivial.load(std::memory_order_relaxed);
+    return collation == Collation::Trivial;
+}
+
+}
+
+extern "C" {
+
+char* darwin_setlocale(int category, const char* locale) {
+    int hostCategory = darwin_category_to_host(category);
+    if (hostCategory == -1)
+        return nullptr;
+    auto ret = setlocale(hostCategory, locale);
+    if (ret && locale && (hostCategory == LC_ALL || hostCategory == LC_COLLATE))
+        globalCollationTrivial.store(is_trivial_collation(setlocale(LC_COLLATE, nullptr)), std::memory_order_relaxed);
+    if (ret && locale && (hostCategory == LC_ALL || hostCategory == LC_CTYPE))
+        __xlocale_set_global_ctype(darwin_ctype(setlocale(LC_CTYPE, nullptr)));
+    return ret;
+}
+
+locale_t darwin_newlocale(int mask, const char* locale, locale_t base) {
+    return newlocale(darwin_mask_to_host(mask), locale, base);
+}
+
+locale_t darwin_uselocale(locale_t locale) {
+    auto ret = uselocale(locale);
+    if (ret && locale) {
+        if (locale == LC_GLOBAL_LOCALE) {
+            threadCollation = Collation::FollowGlobal;
+            __xlocale_set_thread_ctype(XLOCALE_CTYPE_GLOBAL);
+        } else {
+            threadCollation = is_trivial_collation(locale->__names[LC_COLLATE]) ? Collation::Trivial : Collation::Rules;
+            __xlocale_set_thread_ctype(darwin_ctype(locale->__names[LC_CTYPE]));
+        }
+    }
+    return ret;
+}
+
+int darwin_strcoll(const char* s1, const char* s2) {
+    if (current_collation_trivial())
+        return strcmp(s1, s2);
+    return strcoll(s1, s2);
+}
+
+size_t darwin_strxfrm(char* dst, const char* src, size_t n) {
+    if (!current_collation_trivial())
+        return strxfrm(dst, src, n);
+    auto length = strlen(src);
+    if (n != 0) {
+        auto copy = length < n ? length : n - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return length;
+}
+
+int darwin_wcscoll(const wchar_t* s1, const wchar_t* s2) {
+    if (current_collation_trivial())
+        return wcscmp(s1, s2);
+    return wcscoll(s1, s2);
+}
+
+size_t darwin_wcsxfrm(wchar_t* dst, const wchar_t* src, size_t n) {
+    if (!current_collation_trivial())
+        return wcsxfrm(dst, src, n);
+    auto length = wcslen(src);
+    if (n != 0) {
+        auto copy = length < n ? length : n - 1;
+        wmemcpy(dst, src, copy);
+        dst[copy] = L'\0';
+    }
+    return length;
+}
+
+}
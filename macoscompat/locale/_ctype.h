@@ -136,8 +136,8 @@ __maskrune(__darwin_ct_rune_t _c, unsigned long _f)
      * ___runetype(_c) is unsigned long
      * retval is int
      */
-    return (int)((_c < 0 || _c >= _CACHED_RUNES) ? (__uint32_t)___runetype(_c) :
-                 __current_locale()->__lc_ctype->_CurrentRuneLocale.__runetype[_c]) & (__uint32_t)_f;
+    return (int)(__builtin_expect((__uint32_t)_c < _CACHED_RUNES, 1) ?
+                 __current_runelocale()->__runetype[_c] : (__uint32_t)___runetype(_c)) & (__uint32_t)_f;
 }
 
 /*
@@ -149,15 +149,15 @@ __maskrune(__darwin_ct_rune_t _c, unsigned long _f)
 __DARWIN_CTYPE_inline __darwin_ct_rune_t
 __toupper(__darwin_ct_rune_t _c)
 {
-    return (_c < 0 || _c >= _CACHED_RUNES) ? ___toupper(_c) :
-           __current_locale()->__lc_ctype->_CurrentRuneLocale.__mapupper[_c];
+    return __builtin_expect((__uint32_t)_c < _CACHED_RUNES, 1) ?
+           __current_runelocale()->__mapupper[_c] : ___toupper(_c);
 }
 
 __DARWIN_CTYPE_inline __darwin_ct_rune_t
 __tolower(__darwin_ct_rune_t _c)
 {
-    return (_c < 0 || _c >= _CACHED_RUNES) ? ___tolower(_c) :
-           __current_locale()->__lc_ctype->_CurrentRuneLocale.__maplower[_c];
+    return __builtin_expect((__uint32_t)_c < _CACHED_RUNES, 1) ?
+           __current_runelocale()->__maplower[_c] : ___tolower(_c);
 }
 
 #endif /* !_CTYPE_H_ */
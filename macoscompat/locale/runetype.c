@@ -0,0 +1,84 @@
+/*
+ * Rune types and case mappings past _CACHED_RUNES.  Those only come out
+ * of the UTF-8 converters (the NONE encoding never produces them), so they
+ * are classified by Unicode like in Darwin's UTF-8 locales, from the
+ * checked in tables in runetype_data.h (see runetype_gen).  A lookup is
+ * three dependent loads and no search.
+ */
+
+#include "xlocale_private.h"
+#include "_ctype.h"
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t	__type;
+	int32_t		__lower;	/* tolower(c) - c */
+	int32_t		__upper;	/* toupper(c) - c */
+} _RuneRecord;
+
+#include "runetype_data.h"
+
+static inline const _RuneRecord *
+_rune_record(__darwin_ct_rune_t c)
+{
+	size_t block = (size_t)_rune_index[c >> _RUNE_TABLE_SHIFT] <<
+	    _RUNE_TABLE_SHIFT;
+
+	return (&_rune_records[_rune_blocks[block |
+	    (c & ((1 << _RUNE_TABLE_SHIFT) - 1))]]);
+}
+
+unsigned long
+___runetype(__darwin_ct_rune_t c)
+{
+	if (c < 0)
+		return (0);
+	if (c < _CACHED_RUNES)
+		return (__current_runelocale()->__runetype[c]);
+	if (c >= _RUNE_TABLE_COUNT)
+		return (0);
+	return (_rune_record(c)->__type);
+}
+
+__darwin_ct_rune_t
+___tolower(__darwin_ct_rune_t c)
+{
+	if (c < 0)
+		return (c);
+	if (c < _CACHED_RUNES)
+		return (__current_runelocale()->__maplower[c]);
+	if (c >= _RUNE_TABLE_COUNT)
+		return (c);
+	return (c + _rune_record(c)->__lower);
+}
+
+__darwin_ct_rune_t
+___toupper(__darwin_ct_rune_t c)
+{
+	if (c < 0)
+		return (c);
+	if (c < _CACHED_RUNES)
+		return (__current_runelocale()->__mapupper[c]);
+	if (c >= _RUNE_TABLE_COUNT)
+		return (c);
+	return (c + _rune_record(c)->__upper);
+}
+
+/*
+ * Classifies the single byte runes past ASCII by Unicode, like Darwin's
+ * UTF-8 locales do: there they are the Latin-1 code points.
+ */
+void
+__runelocale_fill_unicode(_RuneLocale *rl)
+{
+	__darwin_ct_rune_t c;
+
+	for (c = 0x80; c < _CACHED_RUNES; c++) {
+		const _RuneRecord *r = _rune_record(c);
+
+		rl->__runetype[c] = r->__type;
+		rl->__maplower[c] = c + r->__lower;
+		rl->__mapupper[c] = c + r->__upper;
+	}
+}
@@ -0,0 +1,176 @@
+// Maintainer tool generating the rune type and case mapping tables for runes past _CACHED_RUNES:
+//   runetype_gen <unicode version> <output>
+// The properties are taken from the C.UTF-8 locale of the host C library, whose Unicode version has to be given. The
+// output is checked in as macoscompat/locale/runetype_data.h (build target runetype_data), so that builds do not
+// depend on the build host; regenerate it only to move to another Unicode version. Every rune maps to a record {type, lower delta, upper delta}, the records are deduplicated and
+// looked up through a two-level table of record indices with identical blocks shared. As long as there are at most 256
+// distinct records (there are about 200) the whole thing is some 50 KiB.
+
+#include <clocale>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <gnu/libc-version.h>
+#include <wchar.h>
+#include <wctype.h>
+
+// Darwin's rune type bits, as in _ctype.h
+enum : uint32_t {
+    _CTYPE_A = 0x00000100,
+    _CTYPE_C = 0x00000200,
+    _CTYPE_D = 0x00000400,
+    _CTYPE_G = 0x00000800,
+    _CTYPE_L = 0x00001000,
+    _CTYPE_P = 0x00002000,
+    _CTYPE_S = 0x00004000,
+    _CTYPE_U = 0x00008000,
+    _CTYPE_X = 0x00010000,
+    _CTYPE_B = 0x00020000,
+    _CTYPE_R = 0x00040000,
+    _CTYPE_I = 0x00080000,
+    _CTYPE_Q = 0x00200000,
+    _CTYPE_SW0 = 0x20000000,
+    _CTYPE_SW1 = 0x40000000,
+    _CTYPE_SW2 = 0x80000000,
+};
+
+static constexpr uint32_t RuneCount = 0x110000;
+static constexpr uint32_t BlockShift = 8;
+static constexpr uint32_t BlockSize = 1u << BlockShift;
+
+struct Record {
+    uint32_t type;
+    int32_t lowerDelta;
+    int32_t upperDelta;
+
+    bool operator<(Record const& o) const {
+        return std::tie(type, lowerDelta, upperDelta) < std::tie(o.type, o.lowerDelta, o.upperDelta);
+    }
+};
+
+static bool is_ideogram(uint32_t c) {
+    return (c >= 0x3400 && c <= 0x4dbf) || (c >= 0x4e00 && c <= 0x9fff) || (c >= 0xf900 && c <= 0xfaff) ||
+           (c >= 0x20000 && c <= 0x3fffd);
+}
+
+static bool is_phonogram(uint32_t c) {
+    return (c >= 0x3040 && c <= 0x30ff) || (c >= 0x1100 && c <= 0x11ff) || (c >= 0xac00 && c <= 0xd7a3);
+}
+
+// Same classes as the UTF-8 locales of Darwin, the digit value in the low byte is only used for ASCII
+static uint32_t rune_type(uint32_t c) {
+    auto wc = (wint_t) c;
+    uint32_t type = 0;
+    if (iswalpha(wc)) type |= _CTYPE_A;
+    if (iswcntrl(wc)) type |= _CTYPE_C;
+    if (iswdigit(wc)) type |= _CTYPE_D;
+    if (iswgraph(wc)) type |= _CTYPE_G;
+    if (iswlower(wc)) type |= _CTYPE_L;
+    if (iswpunct(wc)) type |= _CTYPE_P;
+    if (iswspace(wc)) type |= _CTYPE_S;
+    if (iswupper(wc)) type |= _CTYPE_U;
+    if (iswxdigit(wc)) type |= _CTYPE_X;
+    if (iswblank(wc)) type |= _CTYPE_B;
+    if (iswprint(wc)) {
+        type |= _CTYPE_R;
+        int width = wcwidth((wchar_t) c);
+        if (width == 0)
+            type |= _CTYPE_SW0;
+        else if (width == 1)
+            type |= _CTYPE_SW1;
+        else if (width == 2)
+            type |= _CTYPE_SW2;
+    }
+    if (is_ideogram(c) && (type & _CTYPE_A))
+        type |= _CTYPE_I;
+    if (is_phonogram(c) && (type & _CTYPE_A))
+        type |= _CTYPE_Q;
+    return type;
+}
+
+static std::string generate(std::string const& unicodeVersion) {
+    if (!setlocale(LC_CTYPE, "C.UTF-8"))
+        throw std::runtime_error("The C.UTF-8 locale is not available");
+
+    std::map<Record, uint16_t> recordIndex;
+    std::vector<Record> records;
+    std::vector<uint16_t> runeRecords (RuneCount);
+    for (uint32_t c = 0; c < RuneCount; c++) {
+        Record record {rune_type(c), (int32_t) towlower((wint_t) c) - (int32_t) c, (int32_t) towupper((wint_t) c) - (int32_t) c};
+        auto it = recordIndex.find(record);
+        if (it == recordIndex.end()) {
+            if (records.size() > UINT16_MAX)
+                throw std::runtime_error("Too many distinct rune records");
+            it = recordIndex.emplace(record, (uint16_t) records.size()).first;
+            records.push_back(record);
+        }
+        runeRecords[c] = it->second;
+    }
+
+    std::map<std::vector<uint16_t>, uint16_t> blockIndex;
+    std::vector<uint16_t> blocks;
+    std::vector<uint16_t> index;
+    for (uint32_t c = 0; c < RuneCount; c += BlockSize) {
+        std::vector<uint16_t> block (runeRecords.begin() + c, runeRecords.begin() + c + BlockSize);
+        auto it = blockIndex.find(block);
+        if (it == blockIndex.end()) {
+            it = blockIndex.emplace(block, (uint16_t) blockIndex.size()).first;
+            blocks.insert(blocks.end(), block.begin(), block.end());
+        }
+        index.push_back(it->second);
+    }
+
+    std::ostringstream out;
+    out << "/* Generated by runetype_gen from Unicode " << unicodeVersion << " (glibc " << gnu_get_libc_version()
+        << " C.UTF-8), do not edit */\n\n";
+    out << "#define\t_RUNE_TABLE_SHIFT\t" << BlockShift << "\n";
+    out << "#define\t_RUNE_TABLE_COUNT\t0x" << std::hex << RuneCount << std::dec << "\n\n";
+    out << "static const _RuneRecord _rune_records[" << records.size() << "] = {\n";
+    for (auto const& r : records)
+        out << "\t{0x" << std::hex << r.type << std::dec << ", " << r.lowerDelta << ", " << r.upperDelta << "},\n";
+    out << "};\n\n";
+    out << "static const uint16_t _rune_index[" << index.size() << "] = {";
+    for (std::size_t i = 0; i < index.size(); i++)
+        out << (i % 16 == 0 ? "\n\t" : " ") << index[i] << ",";
+    out << "\n};\n\n";
+    out << "typedef " << (records.size() <= 256 ? "uint8_t" : "uint16_t") << " _RuneBlockEntry;\n\n";
+    out << "static const _RuneBlockEntry _rune_blocks[" << blocks.size() << "] = {";
+    for (std::size_t i = 0; i < blocks.size(); i++)
+        out << (i % 16 == 0 ? "\n\t" : " ") << blocks[i] << ",";
+    out << "\n};\n";
+    return out.str();
+}
+
+// Only touches the output if it changed, so that dependents are not rebuilt for nothing
+static void write_if_changed(std::string const& path, std::string const& content) {
+    {
+        std::ifstream fs (path, std::ios::binary);
+        if (fs && std::string(std::istreambuf_iterator<char>(fs), {}) == content)
+            return;
+    }
+    std::ofstream fs (path, std::ios::binary);
+    fs << content;
+    if (!fs)
+        throw std::runtime_error("Failed to write " + path);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <unicode version> <output>\n", argv[0]);
+        return 1;
+    }
+    try {
+        write_if_changed(argv[2], generate(argv[1]));
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+    return 0;
+}
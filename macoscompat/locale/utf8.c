@@ -91,6 +91,279 @@ typedef struct {
 	SecondByte sb;
 } _UTF8State;
 
+/*
+ * ASCII run kernels.  Each one handles the longest prefix of at most n
+ * characters that is plain ASCII excluding NUL and returns its length,
+ * the callers fall back to the scalar code at the first character that is
+ * not.  They only look at whole vectors, so short inputs and the last few
+ * characters always go through the scalar code.  The SIMD variants are
+ * picked once at load time.
+ */
+#define	ASCII_BLOCK	16
+
+/*
+ * Between two kernel calls the callers convert up to this many characters
+ * in the scalar loop.  This keeps text with short ASCII runs from paying for
+ * a kernel call per run, and the scalar loop from paying for an extra check
+ * per character.
+ */
+#define	ASCII_SCALAR_CHUNK	16
+
+#if defined(__x86_64__) && !defined(UTF8_SCALAR_ONLY)
+#include <immintrin.h>
+
+typedef size_t (*_UTF8_widen_fn)(wchar_t * __restrict, const char * __restrict,
+		    size_t);
+typedef size_t (*_UTF8_narrow_fn)(char * __restrict,
+		    const wchar_t * __restrict, size_t);
+typedef size_t (*_UTF8_mbspan_fn)(const char *, size_t);
+typedef size_t (*_UTF8_wcsspan_fn)(const wchar_t *, size_t);
+
+static size_t
+_UTF8_ascii_widen_sse2(wchar_t * __restrict dst, const char * __restrict s,
+    size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int mask;
+	size_t i, j;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		/* Signed compare: NUL and bytes >= 0x80 are not > 0 */
+		mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, zero));
+		if (mask != 0xffff) {
+			for (j = 0; j < (size_t)__builtin_ctz(~mask); j++)
+				dst[i + j] = (wchar_t)s[i + j];
+			return (i + j);
+		}
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *)(dst + i + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+	return (i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_UTF8_ascii_widen_avx2(wchar_t * __restrict dst, const char * __restrict s,
+    size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned int mask;
+	size_t i, j;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, zero));
+		if (mask != 0xffffffff) {
+			for (j = 0; j < (size_t)__builtin_ctz(~mask); j++)
+				dst[i + j] = (wchar_t)s[i + j];
+			return (i + j);
+		}
+		__m128i lo = _mm256_castsi256_si128(v);
+		__m128i hi = _mm256_extracti128_si256(v, 1);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtepu8_epi32(lo));
+		_mm256_storeu_si256((__m256i *)(dst + i + 8),
+		    _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+		_mm256_storeu_si256((__m256i *)(dst + i + 16), _mm256_cvtepu8_epi32(hi));
+		_mm256_storeu_si256((__m256i *)(dst + i + 24),
+		    _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+	}
+	/* GCC does not clear the upper halves before calling a non-AVX function */
+	_mm256_zeroupper();
+	return (i + _UTF8_ascii_widen_sse2(dst + i, s + i, n - i));
+}
+
+static size_t
+_UTF8_ascii_mbspan_sse2(const char *s, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpgt_epi8(
+		    _mm_loadu_si128((const __m128i *)(s + i)), zero));
+		if (mask != 0xffff)
+			return (i + __builtin_ctz(~mask));
+	}
+	return (i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_UTF8_ascii_mbspan_avx2(const char *s, size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(
+		    _mm256_loadu_si256((const __m256i *)(s + i)), zero));
+		if (mask != 0xffffffff)
+			return (i + __builtin_ctz(~mask));
+	}
+	_mm256_zeroupper();
+	return (i + _UTF8_ascii_mbspan_sse2(s + i, n - i));
+}
+
+/*
+ * Narrows 16 wide characters to bytes and returns a mask of the ones that
+ * are in 1..0x7f.  Out of range characters saturate, but those bytes are
+ * never stored.
+ */
+static inline unsigned int
+_UTF8_ascii_pack_sse2(const wchar_t *s, __m128i *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i limit = _mm_set1_epi32(0x80);
+	__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+	__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 4));
+	__m128i v2 = _mm_loadu_si128((const __m128i *)(s + 8));
+	__m128i v3 = _mm_loadu_si128((const __m128i *)(s + 12));
+#define	ASCII_OK(v)	_mm_and_si128(_mm_cmpgt_epi32(v, zero), _mm_cmpgt_epi32(limit, v))
+	__m128i ok = _mm_packs_epi16(_mm_packs_epi32(ASCII_OK(v0), ASCII_OK(v1)),
+	    _mm_packs_epi32(ASCII_OK(v2), ASCII_OK(v3)));
+#undef ASCII_OK
+	*out = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+	return (_mm_movemask_epi8(ok));
+}
+
+static size_t
+_UTF8_ascii_narrow_sse2(char * __restrict dst, const wchar_t * __restrict s,
+    size_t n)
+{
+	unsigned int mask;
+	__m128i bytes;
+	size_t i, j;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		mask = _UTF8_ascii_pack_sse2(s + i, &bytes);
+		if (mask != 0xffff) {
+			for (j = 0; j < (size_t)__builtin_ctz(~mask); j++)
+				dst[i + j] = (char)s[i + j];
+			return (i + j);
+		}
+		_mm_storeu_si128((__m128i *)(dst + i), bytes);
+	}
+	return (i);
+}
+
+static size_t
+_UTF8_ascii_wcsspan_sse2(const wchar_t *s, size_t n)
+{
+	unsigned int mask;
+	__m128i bytes;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		mask = _UTF8_ascii_pack_sse2(s + i, &bytes);
+		if (mask != 0xffff)
+			return (i + __builtin_ctz(~mask));
+	}
+	return (i);
+}
+
+/* The AVX2 packs work per 128-bit lane, the permute puts the result back in order */
+__attribute__((target("avx2")))
+static inline unsigned int
+_UTF8_ascii_pack_avx2(const wchar_t *s, __m256i *out)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i limit = _mm256_set1_epi32(0x80);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+	__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 8));
+	__m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 16));
+	__m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 24));
+#define	ASCII_OK(v)	_mm256_and_si256(_mm256_cmpgt_epi32(v, zero), _mm256_cmpgt_epi32(limit, v))
+	__m256i ok = _mm256_packs_epi16(
+	    _mm256_packs_epi32(ASCII_OK(v0), ASCII_OK(v1)),
+	    _mm256_packs_epi32(ASCII_OK(v2), ASCII_OK(v3)));
+#undef ASCII_OK
+	__m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1),
+	    _mm256_packs_epi32(v2, v3));
+	*out = _mm256_permutevar8x32_epi32(bytes, order);
+	return (_mm256_movemask_epi8(_mm256_permutevar8x32_epi32(ok, order)));
+}
+
+__attribute__((target("avx2")))
+static size_t
+_UTF8_ascii_narrow_avx2(char * __restrict dst, const wchar_t * __restrict s,
+    size_t n)
+{
+	unsigned int mask;
+	__m256i bytes;
+	size_t i, j;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		mask = _UTF8_ascii_pack_avx2(s + i, &bytes);
+		if (mask != 0xffffffff) {
+			for (j = 0; j < (size_t)__builtin_ctz(~mask); j++)
+				dst[i + j] = (char)s[i + j];
+			return (i + j);
+		}
+		_mm256_storeu_si256((__m256i *)(dst + i), bytes);
+	}
+	_mm256_zeroupper();
+	return (i + _UTF8_ascii_narrow_sse2(dst + i, s + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static size_t
+_UTF8_ascii_wcsspan_avx2(const wchar_t *s, size_t n)
+{
+	unsigned int mask;
+	__m256i bytes;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		mask = _UTF8_ascii_pack_avx2(s + i, &bytes);
+		if (mask != 0xffffffff)
+			return (i + __builtin_ctz(~mask));
+	}
+	_mm256_zeroupper();
+	return (i + _UTF8_ascii_wcsspan_sse2(s + i, n - i));
+}
+
+/* Resolved while relocating libmacoscompat, before any constructor ran */
+#define	ASCII_RESOLVER(name)						\
+static _UTF8_##name##_fn						\
+_UTF8_resolve_##name(void)						\
+{									\
+	__builtin_cpu_init();						\
+	if (__builtin_cpu_supports("avx2"))				\
+		return (_UTF8_ascii_##name##_avx2);			\
+	return (_UTF8_ascii_##name##_sse2);				\
+}
+ASCII_RESOLVER(widen)
+ASCII_RESOLVER(narrow)
+ASCII_RESOLVER(mbspan)
+ASCII_RESOLVER(wcsspan)
+#undef ASCII_RESOLVER
+
+static size_t _UTF8_ascii_widen(wchar_t * __restrict, const char * __restrict,
+		    size_t) __attribute__((ifunc("_UTF8_resolve_widen")));
+static size_t _UTF8_ascii_narrow(char * __restrict, const wchar_t * __restrict,
+		    size_t) __attribute__((ifunc("_UTF8_resolve_narrow")));
+static size_t _UTF8_ascii_mbspan(const char *, size_t)
+		    __attribute__((ifunc("_UTF8_resolve_mbspan")));
+static size_t _UTF8_ascii_wcsspan(const wchar_t *, size_t)
+		    __attribute__((ifunc("_UTF8_resolve_wcsspan")));
+
+#else
+
+#define	_UTF8_ascii_widen(dst, s, n)	((size_t)0)
+#define	_UTF8_ascii_narrow(dst, s, n)	((size_t)0)
+#define	_UTF8_ascii_mbspan(s, n)	((size_t)0)
+#define	_UTF8_ascii_wcsspan(s, n)	((size_t)0)
+
+#endif
+
 int
 _UTF8_init(struct __xlocale_st_runelocale *xrl)
 {
@@ -252,6 +525,7 @@ _UTF8_mbsnrtowcs(wchar_t * __restrict dst, const char ** __restrict src,
 	size_t nchr;
 	wchar_t wc;
 	size_t nb;
+	size_t chunk;
 
 	us = (_UTF8State *)ps;
 
@@ -269,21 +543,32 @@ _UTF8_mbsnrtowcs(wchar_t * __restrict dst, const char ** __restrict src,
 			return ((size_t)-1);
 		}
 		for (;;) {
-			if (nms > 0 && (signed char)*s > 0)
-				/*
-				 * Fast path for plain ASCII characters
-				 * excluding NUL.
-				 */
-				nb = 1;
-			else if ((nb = _UTF8_mbrtowc(&wc, s, nms, ps, loc)) ==
-			    (size_t)-1)
-				/* Invalid sequence - mbrtowc() sets errno. */
-				return ((size_t)-1);
-			else if (nb == 0 || nb == (size_t)-2)
-				return (nchr);
-			s += nb;
-			nms -= nb;
-			nchr++;
+			if (nms >= ASCII_BLOCK && (signed char)*s > 0) {
+				nb = _UTF8_ascii_mbspan(s, nms);
+				s += nb;
+				nms -= nb;
+				nchr += nb;
+			}
+			for (chunk = ASCII_SCALAR_CHUNK; chunk > 0; chunk--) {
+				if (nms > 0 && (signed char)*s > 0)
+					/*
+					 * Fast path for plain ASCII characters
+					 * excluding NUL.
+					 */
+					nb = 1;
+				else if ((nb = _UTF8_mbrtowc(&wc, s, nms, ps,
+				    loc)) == (size_t)-1)
+					/*
+					 * Invalid sequence - mbrtowc() sets
+					 * errno.
+					 */
+					return ((size_t)-1);
+				else if (nb == 0 || nb == (size_t)-2)
+					return (nchr);
+				s += nb;
+				nms -= nb;
+				nchr++;
+			}
 		}
 		/*NOTREACHED*/
 	}
@@ -297,29 +582,42 @@ _UTF8_mbsnrtowcs(wchar_t * __restrict dst, const char ** __restrict src,
 		errno = EILSEQ;
 		return ((size_t)-1);
 	}
-	while (len-- > 0) {
-		if (nms > 0 && (signed char)*s > 0) {
-			/*
-			 * Fast path for plain ASCII characters
-			 * excluding NUL.
-			 */
-			*dst = (wchar_t)*s;
-			nb = 1;
-		} else if ((nb = _UTF8_mbrtowc(dst, s, nms, ps, loc)) ==
-		    (size_t)-1) {
-			*src = s;
-			return ((size_t)-1);
-		} else if (nb == (size_t)-2) {
-			*src = s + nms;
-			return (nchr);
-		} else if (nb == 0) {
-			*src = NULL;
-			return (nchr);
+	while (len > 0) {
+		if (nms >= ASCII_BLOCK && len >= ASCII_BLOCK &&
+		    (signed char)*s > 0) {
+			nb = _UTF8_ascii_widen(dst, s, MIN(nms, len));
+			s += nb;
+			nms -= nb;
+			len -= nb;
+			nchr += nb;
+			dst += nb;
+		}
+		chunk = MIN(len, ASCII_SCALAR_CHUNK);
+		len -= chunk;
+		while (chunk-- > 0) {
+			if (nms > 0 && (signed char)*s > 0) {
+				/*
+				 * Fast path for plain ASCII characters
+				 * excluding NUL.
+				 */
+				*dst = (wchar_t)*s;
+				nb = 1;
+			} else if ((nb = _UTF8_mbrtowc(dst, s, nms, ps, loc)) ==
+			    (size_t)-1) {
+				*src = s;
+				return ((size_t)-1);
+			} else if (nb == (size_t)-2) {
+				*src = s + nms;
+				return (nchr);
+			} else if (nb == 0) {
+				*src = NULL;
+				return (nchr);
+			}
+			s += nb;
+			nms -= nb;
+			nchr++;
+			dst++;
 		}
-		s += nb;
-		nms -= nb;
-		nchr++;
-		dst++;
 	}
 	*src = s;
 	return (nchr);
@@ -399,6 +697,7 @@ _UTF8_wcsnrtombs(char * __restrict dst, const wchar_t ** __restrict src,
 	const wchar_t *s;
 	size_t nbytes;
 	size_t nb;
+	size_t chunk;
 
 	us = (_UTF8State *)ps;
 
@@ -411,55 +710,84 @@ _UTF8_wcsnrtombs(char * __restrict dst, const wchar_t ** __restrict src,
 	nbytes = 0;
 
 	if (dst == NULL) {
-		while (nwc-- > 0) {
-			if (0 <= *s && *s < 0x80)
-				/* Fast path for plain ASCII characters. */
-				nb = 1;
-			else if ((nb = _UTF8_wcrtomb(buf, *s, ps, loc)) ==
-			    (size_t)-1)
-				/* Invalid character - wcrtomb() sets errno. */
-				return ((size_t)-1);
-			if (*s == L'\0')
-				return (nbytes + nb - 1);
-			s++;
-			nbytes += nb;
+		while (nwc > 0) {
+			if (nwc >= ASCII_BLOCK && 0 < *s && *s < 0x80) {
+				nb = _UTF8_ascii_wcsspan(s, nwc);
+				s += nb;
+				nwc -= nb;
+				nbytes += nb;
+			}
+			chunk = MIN(nwc, ASCII_SCALAR_CHUNK);
+			nwc -= chunk;
+			while (chunk-- > 0) {
+				if (0 <= *s && *s < 0x80)
+					/* Fast path for plain ASCII characters. */
+					nb = 1;
+				else if ((nb = _UTF8_wcrtomb(buf, *s, ps, loc)) ==
+				    (size_t)-1)
+					/*
+					 * Invalid character - wcrtomb() sets
+					 * errno.
+					 */
+					return ((size_t)-1);
+				if (*s == L'\0')
+					return (nbytes + nb - 1);
+				s++;
+				nbytes += nb;
+			}
 		}
 		return (nbytes);
 	}
 
-	while (len > 0 && nwc-- > 0) {
-		if (0 <= *s && *s < 0x80) {
-			/* Fast path for plain ASCII characters. */
-			nb = 1;
-			*dst = *s;
-		} else if (len > (size_t)UTF8_MB_CUR_MAX) {
-			/* Enough space to translate in-place. */
-			if ((nb = _UTF8_wcrtomb(dst, *s, ps, loc)) == (size_t)-1) {
-				*src = s;
-				return ((size_t)-1);
+	while (len > 0 && nwc > 0) {
+		if (nwc >= ASCII_BLOCK && len >= ASCII_BLOCK &&
+		    0 < *s && *s < 0x80) {
+			nb = _UTF8_ascii_narrow(dst, s, MIN(nwc, len));
+			s += nb;
+			nwc -= nb;
+			dst += nb;
+			len -= nb;
+			nbytes += nb;
+		}
+		chunk = MIN(nwc, ASCII_SCALAR_CHUNK);
+		nwc -= chunk;
+		while (len > 0 && chunk-- > 0) {
+			if (0 <= *s && *s < 0x80) {
+				/* Fast path for plain ASCII characters. */
+				nb = 1;
+				*dst = *s;
+			} else if (len > (size_t)UTF8_MB_CUR_MAX) {
+				/* Enough space to translate in-place. */
+				if ((nb = _UTF8_wcrtomb(dst, *s, ps, loc)) ==
+				    (size_t)-1) {
+					*src = s;
+					return ((size_t)-1);
+				}
+			} else {
+				/*
+				 * May not be enough space; use temp. buffer.
+				 */
+				if ((nb = _UTF8_wcrtomb(buf, *s, ps, loc)) ==
+				    (size_t)-1) {
+					*src = s;
+					return ((size_t)-1);
+				}
+				if (nb > (int)len)
+					/* MB sequence for character won't fit. */
+					goto full;
+				memcpy(dst, buf, nb);
 			}
-		} else {
-			/*
-			 * May not be enough space; use temp. buffer.
-			 */
-			if ((nb = _UTF8_wcrtomb(buf, *s, ps, loc)) == (size_t)-1) {
-				*src = s;
-				return ((size_t)-1);
+			if (*s == L'\0') {
+				*src = NULL;
+				return (nbytes + nb - 1);
 			}
-			if (nb > (int)len)
-				/* MB sequence for character won't fit. */
-				break;
-			memcpy(dst, buf, nb);
-		}
-		if (*s == L'\0') {
-			*src = NULL;
-			return (nbytes + nb - 1);
+			s++;
+			dst += nb;
+			len -= nb;
+			nbytes += nb;
 		}
-		s++;
-		dst += nb;
-		len -= nb;
-		nbytes += nb;
 	}
+full:
 	*src = s;
 	return (nbytes);
 }
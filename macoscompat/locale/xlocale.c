@@ -22,12 +22,13 @@
  */
 
 #include "xlocale_private.h"
+#include "mblocal.h"
 #include <errno.h>
 #include <stddef.h>
 #include <string.h>
 
 #define NMBSTATET	10
-#define C_LOCALE_INITIALIZER	{	\
+#define C_LOCALE_INITIALIZER(ctype)	{	\
 	0, XPERMANENT,			\
 	{}, {}, {}, {}, {},		\
 	{}, {}, {}, {}, {},		\
@@ -35,11 +36,81 @@
 	XMAGIC,				\
 	1, 0, 0, 0, 0, 0, 1, 1, 0,	\
 	NULL,				\
-	&_DefaultRuneXLocale,		\
+	(ctype),			\
 }
 
+/*
+ * The global locale's ctype is a copy that setlocale() overwrites in place:
+ * every thread that follows the global locale caches a pointer to it, and
+ * those caches can only be updated by their own threads.
+ */
+static struct __xlocale_st_runelocale __global_runelocale;
+static struct __xlocale_st_runelocale __utf8_runelocale;
+static pthread_once_t __utf8_runelocale_once = PTHREAD_ONCE_INIT;
+
+extern int __mb_cur_max;
+extern int __mb_sb_limit;
+
 static char C[] = "C";
-static struct _xlocale __c_locale = C_LOCALE_INITIALIZER;
+static struct _xlocale __c_locale = C_LOCALE_INITIALIZER(&_DefaultRuneXLocale);
 const locale_t _c_locale = (const locale_t)&__c_locale;
-struct _xlocale __global_locale = C_LOCALE_INITIALIZER;
+static struct _xlocale __utf8_locale = C_LOCALE_INITIALIZER(&__utf8_runelocale);
+struct _xlocale __global_locale = C_LOCALE_INITIALIZER(&__global_runelocale);
 thread_local darwin_locale_t __current_locale_val;
+thread_local _RuneLocale *__current_runelocale_val = &__global_runelocale._CurrentRuneLocale;
+
+__attribute__((constructor(101)))
+static void
+__global_runelocale_init(void)
+{
+	memcpy(&__global_runelocale, &_DefaultRuneXLocale,
+	    sizeof(__global_runelocale));
+	_CurrentRuneLocale = &__global_runelocale._CurrentRuneLocale;
+}
+
+/*
+ * Darwin's UTF-8 locales: the C locale's ASCII, Unicode above it (runes are
+ * code points) and the UTF-8 converters.
+ */
+static void
+__utf8_runelocale_init(void)
+{
+	memcpy(&__utf8_runelocale, &_DefaultRuneXLocale,
+	    sizeof(__utf8_runelocale));
+	strcpy(__utf8_runelocale.__ctype_encoding, "UTF-8");
+	strcpy(__utf8_runelocale._CurrentRuneLocale.__encoding, "UTF-8");
+	_UTF8_init(&__utf8_runelocale);
+	__runelocale_fill_unicode(&__utf8_runelocale._CurrentRuneLocale);
+}
+
+static struct __xlocale_st_runelocale *
+__runelocale_for(int ctype)
+{
+	if (ctype != XLOCALE_CTYPE_UTF8)
+		return (&_DefaultRuneXLocale);
+	pthread_once(&__utf8_runelocale_once, __utf8_runelocale_init);
+	return (&__utf8_runelocale);
+}
+
+void
+__xlocale_set_global_ctype(int ctype)
+{
+	struct __xlocale_st_runelocale *xrl = __runelocale_for(ctype);
+
+	memcpy(&__global_runelocale, xrl, sizeof(__global_runelocale));
+	__mb_cur_max = xrl->__mb_cur_max;
+	__mb_sb_limit = xrl->__mb_sb_limit;
+}
+
+void
+__xlocale_set_thread_ctype(int ctype)
+{
+	if (ctype == XLOCALE_CTYPE_GLOBAL) {
+		__current_locale_val = NULL;
+		__current_runelocale_val = &__global_runelocale._CurrentRuneLocale;
+		return;
+	}
+	__current_runelocale_val = &__runelocale_for(ctype)->_CurrentRuneLocale;
+	__current_locale_val = ctype == XLOCALE_CTYPE_UTF8 ? &__utf8_locale :
+	    (darwin_locale_t)_c_locale;
+}
@@ -224,7 +224,38 @@ __locale_ptr(locale_t __loc)
 }
 #endif
 
-extern thread_local darwin_locale_t __current_locale_val;
+/*
+ * libmacoscompat is always loaded with the executable, so the thread's
+ * locale can live in the static TLS block and be read with a single
+ * %fs-relative load instead of a __tls_get_addr call.
+ */
+extern thread_local darwin_locale_t __current_locale_val
+    __attribute__((tls_model("initial-exec")));
+
+/*
+ * The rune locale of __current_locale(), cached for the ctype inlines so
+ * that a classification is the TLS load and the table entry.  Only the
+ * functions below change __current_locale_val or the ctype of the global
+ * locale, and they keep it in sync.
+ */
+extern thread_local _RuneLocale *__current_runelocale_val
+    __attribute__((tls_model("initial-exec")));
+
+/*
+ * The ctypes there are: the C locale's, Darwin's UTF-8 one, and for a
+ * thread, whatever the global locale has.  setlocale() and uselocale()
+ * (locale.cpp) pick one by the host locale's codeset.
+ */
+#define	XLOCALE_CTYPE_GLOBAL	(-1)
+#define	XLOCALE_CTYPE_C		0
+#define	XLOCALE_CTYPE_UTF8	1
+
+__attribute__((visibility("hidden")))
+void	__xlocale_set_global_ctype(int);
+__attribute__((visibility("hidden")))
+void	__xlocale_set_thread_ctype(int);
+__attribute__((visibility("hidden")))
+void	__runelocale_fill_unicode(_RuneLocale *);
 
 static inline __attribute__((always_inline)) darwin_locale_t
 __current_locale(void)
@@ -232,6 +263,12 @@ __current_locale(void)
     return (__current_locale_val ? __current_locale_val : &__global_locale);
 }
 
+static inline __attribute__((always_inline)) _RuneLocale *
+__current_runelocale(void)
+{
+    return (__current_runelocale_val);
+}
+
 __END_DECLS
 
 #endif /* _XLOCALE_PRIVATE_H_ */
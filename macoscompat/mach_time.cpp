@@ -0,0 +1,159 @@
+#include <cpuid.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <x86intrin.h>
+
+#define KERN_SUCCESS 0
+
+// mach_absolute_time counts nanoseconds, as it always has on x86-64 Darwin, so mach_timebase_info is an exact 1/1 and
+// binaries that never looked at the timebase keep working. The nanoseconds come from the TSC scaled by a factor that is
+// worked out once, the first time the clock is used, which saves the vDSO its clocksource checks and its seqlock.
+// The TSC is only trusted when it is invariant and the kernel picked it as its own clocksource, which means the
+// kernel found it synchronized across CPUs and stable; otherwise the clock is CLOCK_MONOTONIC_RAW through the vDSO.
+// Either way the values continue from CLOCK_MONOTONIC_RAW, that is the time since boot, like on Darwin.
+
+namespace {
+
+constexpr uint64_t NsPerSecond = 1000000000;
+constexpr int ScaleShift = 32;
+constexpr long CalibrationNs = 10000000; // how long TSC and CLOCK_MONOTONIC_RAW are compared if no CPUID leaf knows the rate
+constexpr int CalibrationSamples = 5;
+
+uint64_t monotonic_raw_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * NsPerSecond + (uint64_t) ts.tv_nsec;
+}
+
+// lfence keeps the read from moving ahead of earlier loads, just like the kernel's ordered TSC reads
+inline uint64_t read_tsc() {
+    _mm_lfence();
+    return __rdtsc();
+}
+
+bool invariant_tsc() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+}
+
+bool kernel_uses_tsc() {
+    auto file = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "re");
+    if (!file)
+        return false;
+    char name[32] {};
+    bool ret = fgets(name, sizeof(name), file) && strcmp(name, "tsc\n") == 0;
+    fclose(file);
+    return ret;
+}
+
+// The TSC rate as a fraction in Hz, from the CPU or the hypervisor if either of them tells
+bool tsc_rate_from_cpuid(uint64_t& hz, uint64_t& divisor) {
+    unsigned eax, ebx, ecx, edx;
+    // Leaf 0x15: the TSC runs at crystal * ebx / eax
+    if (__get_cpuid_max(0, nullptr) >= 0x15) {
+        __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+        if (eax != 0 && ebx != 0 && ecx != 0) {
+            hz = (uint64_t) ecx * ebx;
+            divisor = eax;
+            return true;
+        }
+    }
+    // Leaf 0x40000010 (VMware, KVM and others when asked to): the TSC rate in kHz
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (ecx & (1u << 31)) {
+        __cpuid(0x40000000, eax, ebx, ecx, edx);
+        if (eax >= 0x40000010) {
+            __cpuid(0x40000010, eax, ebx, ecx, edx);
+            if (eax != 0) {
+                hz = (uint64_t) eax * 1000;
+                divisor = 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// A TSC value and the CLOCK_MONOTONIC_RAW time in the middle of the tightest of a few reads around it
+void sample(uint64_t& tsc, uint64_t& ns) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CalibrationSamples; i++) {
+        auto before = read_tsc();
+        auto now = monotonic_raw_ns();
+        auto after = read_tsc();
+        if (after - before < best) {
+            best = after - before;
+            tsc = before + (after - before) / 2;
+            ns = now;
+        }
+    }
+}
+
+struct MachClock {
+    bool useTsc = false;
+    uint64_t baseTsc = 0;
+    uint64_t baseNs = 0;
+    uint64_t scale = 0; // nanoseconds per tick << ScaleShift
+
+    MachClock() {
+        if (!invariant_tsc() || !kernel_uses_tsc())
+            return;
+        uint64_t hz, divisor;
+        sample(baseTsc, baseNs);
+        if (!tsc_rate_from_cpuid(hz, divisor)) {
+            struct timespec wait {0, CalibrationNs};
+            while (nanosleep(&wait, &wait) != 0) {
+            }
+            uint64_t tsc, ns;
+            sample(tsc, ns);
+            if (tsc <= baseTsc || ns <= baseNs)
+                return;
+            scale = (uint64_t) (((unsigned __int128) (ns - baseNs) << ScaleShift) / (tsc - baseTsc));
+        } else {
+            scale = (uint64_t) (((unsigned __int128) NsPerSecond * divisor << ScaleShift) / hz);
+        }
+        useTsc = scale != 0;
+    }
+
+    uint64_t now() const {
+        if (!useTsc)
+            return monotonic_raw_ns();
+        // The TSC only runs forward, but one read may land on a CPU whose TSC is a few ticks behind the base
+        auto delta = (int64_t) (read_tsc() - baseTsc);
+        if (__builtin_expect(delta < 0, 0))
+            return baseNs;
+        return baseNs + (uint64_t) (((unsigned __int128) (uint64_t) delta * scale) >> ScaleShift);
+    }
+};
+
+MachClock const& mach_clock() {
+    static MachClock clock;
+    return clock;
+}
+
+}
+
+extern "C" {
+
+struct mach_timebase_info {
+    uint32_t numer;
+    uint32_t denom;
+};
+
+uint64_t mach_absolute_time() {
+    return mach_clock().now();
+}
+
+uint64_t mach_approximate_time() {
+    return mach_clock().now();
+}
+
+int mach_timebase_info(struct mach_timebase_info* info) {
+    info->numer = 1;
+    info->denom = 1;
+    return KERN_SUCCESS;
+}
+
+}
@@ -5,15 +5,20 @@
 #include <ctime>
 #include <array>
 #include <vector>
-#include <mutex>
 #include <unistd.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <link.h>
 #include <fcntl.h>
-#include "index_allocator.h"
+#include "futex_semaphore.h"
+#include "handle_table.h"
+#include "shim_translation.h"
 
+#define KERN_SUCCESS 0
 #define KERN_INVALID_ARGUMENT 4
+#define KERN_RESOURCE_SHORTAGE 6
+#define KERN_ABORTED 14
+#define KERN_TERMINATED 37
+#define KERN_OPERATION_TIMED_OUT 49
 
 extern "C" {
 
@@ -31,8 +36,8 @@ void* mach_host_self() {
 #define CALENDAR_CLOCK		1
 #define HIGHRES_CLOCK		2
 struct mach_timespec {
-    int tv_nsec;
     unsigned int tv_sec;
+    int tv_nsec;
 };
 int host_get_clock_service(void* host, int clockId, mach_port_t* serv) {
     switch (clockId) {
@@ -62,17 +67,6 @@ void _NSGetEnviron() {
     abort();
 }
 
-int _NSGetExecutablePath(char* buf, uint32_t* bufsize) {
-    auto ret = readlink("/proc/self/exe", buf, *bufsize);
-    if (ret < 0 || ret >= *bufsize) {
-        fprintf(stderr, "failed to read /proc/self/exe\n");
-        abort();
-    }
-    buf[ret] = 0;
-    *bufsize = ret;
-    return 0;
-}
-
 void _ZNKSt3__120__vector_base_commonILb1EE20__throw_length_errorEv() {
     std::__throw_length_error("vector");
 }
@@ -85,91 +79,66 @@ void select$1050() {
 }
 
 
-typedef uint32_t darwin_sigset_t;
-
-struct darwin_sigaction {
-    void (*sa_handler_)(int);
-    darwin_sigset_t sa_mask;
-    int sa_flags;
-};
-
-static int darwin_sa_flags_to_host(int flags) {
-    int host = 0;
-    if (flags & 1) host |= SA_ONSTACK;
-    if (flags & 2) host |= SA_RESTART;
-    if (flags & 4) host |= SA_RESETHAND;
-    if (flags & 8) host |= SA_NOCLDSTOP;
-    if (flags & 0x10) host |= SA_NODEFER;
-    if (flags & 0x20) host |= SA_NOCLDWAIT;
-    if (flags & 0x40) host |= SA_SIGINFO;
-//    if (flags & 0x100) host |= SA_USERTRAMP;
-//    if (flags & 0x200) host |= SA_64REGSET;
-    return host;
-}
-static int darwin_sa_flags_from_host(int host) {
-    int flags = 0;
-    if (host & SA_ONSTACK) flags |= 1;
-    if (host & SA_RESTART) flags |= 2;
-    if (host & SA_RESETHAND) flags |= 4;
-    if (host & SA_NOCLDSTOP) flags |= 8;
-    if (host & SA_NODEFER) flags |= 0x10;
-    if (host & SA_NOCLDWAIT) flags |= 0x20;
-    if (host & SA_SIGINFO) flags |= 0x40;
-//    if (host & SA_USERTRAMP) flags |= 0x100;
-//    if (host & SA_64REGSET) flags |= 0x200;
-    return flags;
-}
-
 int darwin_sigaction(int sig, const struct darwin_sigaction* action, struct darwin_sigaction* original) {
-    struct sigaction host_action {};
-    struct sigaction host_original {};
+    return darwin_sigaction_impl(sig, action, original);
+}
 
-    host_action.sa_handler = action->sa_handler_;
-    host_action.sa_mask.__val[0] = action->sa_mask;
-    host_action.sa_flags = darwin_sa_flags_to_host(action->sa_flags);
 
-    int ret = sigaction(sig, &host_action, &host_original);
-    if (ret)
-        return ret;
+static HandleTable<FutexSemaphore> semaphores;
 
-    if (original) {
-        original->sa_handler_ = host_original.sa_handler;
-        original->sa_mask = host_original.sa_mask.__val[0];
-        original->sa_flags = darwin_sa_flags_from_host(host_original.sa_flags);
+static int semaphore_wait_result(FutexSemaphore::WaitResult result) {
+    switch (result) {
+        case FutexSemaphore::WaitResult::Success:
+            return KERN_SUCCESS;
+        case FutexSemaphore::WaitResult::TimedOut:
+            return KERN_OPERATION_TIMED_OUT;
+        case FutexSemaphore::WaitResult::Interrupted:
+            return KERN_ABORTED;
+        case FutexSemaphore::WaitResult::Terminated:
+            return KERN_TERMINATED;
     }
-
-    return 0;
+    return KERN_INVALID_ARGUMENT;
 }
 
-
-static IndexAllocator<sem_t> semaphores;
-static std::mutex semaphoresMutex;
-
 int semaphore_create(task_t task, semaphore_t* semaphore, int policy, int value) {
-    std::lock_guard guard(semaphoresMutex);
-    auto ret = semaphores.allocate();
-    sem_init(&semaphores.get(ret), 0, value);
+    if (value < 0)
+        return KERN_INVALID_ARGUMENT;
+    FutexSemaphore* sem;
+    auto ret = semaphores.allocate(sem);
+    if (ret == 0)
+        return KERN_RESOURCE_SHORTAGE;
+    sem->init((uint32_t) value);
     *semaphore = ret;
-    return 0;
+    return KERN_SUCCESS;
 }
 int semaphore_destroy(task_t task, semaphore_t semaphore) {
-    std::lock_guard guard(semaphoresMutex);
-    sem_destroy(&semaphores.get(semaphore));
-    semaphores.free(semaphore);
-    return 0;
+    auto sem = semaphores.get(semaphore);
+    if (!sem)
+        return KERN_INVALID_ARGUMENT;
+    // Threads still waiting return KERN_TERMINATED, like they do on Darwin; terminate returns once they have all left,
+    // so the slot can be handed out again
+    sem->terminate();
+    return semaphores.free(semaphore) ? KERN_SUCCESS : KERN_INVALID_ARGUMENT;
 }
 int semaphore_signal(semaphore_t semaphore) {
-    sem_post(&semaphores.get(semaphore));
-    return 0;
+    auto sem = semaphores.get(semaphore);
+    if (!sem)
+        return KERN_INVALID_ARGUMENT;
+    sem->signal();
+    return KERN_SUCCESS;
 }
 int semaphore_timedwait(semaphore_t semaphore, mach_timespec wait_time) {
-    struct timespec host_wait_time { wait_time.tv_sec, wait_time.tv_nsec };
-    int ret = sem_timedwait(&semaphores.get(semaphore), &host_wait_time);
-    return ret; // TODO: translate!!
+    auto sem = semaphores.get(semaphore);
+    if (!sem || wait_time.tv_nsec < 0 || wait_time.tv_nsec >= 1000000000)
+        return KERN_INVALID_ARGUMENT;
+    struct timespec timeout { (time_t) wait_time.tv_sec, wait_time.tv_nsec };
+    return semaphore_wait_result(sem->wait(&timeout));
 }
 int semaphore_wait(semaphore_t semaphore) {
-    int ret = sem_wait(&semaphores.get(semaphore));
-    return ret; // TODO: translate!!
+    auto sem = semaphores.get(semaphore);
+    if (!sem)
+        return KERN_INVALID_ARGUMENT;
+    return semaphore_wait_result(sem->wait(nullptr));
 }
 
 bool _ZN2QT30qt_mac_applicationIsInDarkModeEv() {
@@ -201,27 +170,4 @@ void NSRunCriticalAlertPanel() {
     abort();
 }
 
-void memset_pattern16(void *b, const void *pattern16, size_t len) {
-    __int128_t v = *(__int128_t*) pattern16;
-    auto target = (__int128_t*)b;
-    auto end =  (__int128_t*)((uintptr_t)b+(len&~0xfLLu));
-    for ( ; target < end; target++)
-        *target = v;
-    int finalLen = len & 0xf;
-    for (int i = 0; i < finalLen; i++)
-        ((uint8_t*)end)[i] = ((uint8_t*)&v)[i];
-}
-
-void* darwin_dlopen(const char* path, int mode) {
-    printf("dlopen: %s\n", path);
-    int host_mode = 0;
-    if (mode & 1) host_mode |= RTLD_LAZY;
-    if (mode & 2) host_mode |= RTLD_NOW;
-    if (mode & 4) host_mode |= RTLD_LOCAL;
-    if (mode & 8) host_mode |= RTLD_GLOBAL;
-    if (mode & 0x10) host_mode |= RTLD_NOLOAD;
-    if (mode & 0x80) host_mode |= RTLD_NODELETE;
-    return dlopen(path, host_mode);
-}
-
 }
\ No newline at end of file
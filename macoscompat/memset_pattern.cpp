@@ -0,0 +1,167 @@
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+
+// Fills larger than this bypass the cache, they would only evict everything else without ever being read back from it
+constexpr size_t NON_TEMPORAL_THRESHOLD = 8 * 1024 * 1024;
+
+// The pattern repeated so that a full vector can be loaded at any phase of it
+struct alignas(64) PatternBuffer {
+    uint8_t bytes[128];
+};
+
+template <typename T>
+T load_unaligned(const void* p) {
+    T ret;
+    memcpy(&ret, p, sizeof(T));
+    return ret;
+}
+
+using FillFn = void (*)(uint8_t* dst, const PatternBuffer& pattern, size_t len);
+
+void expandPattern(PatternBuffer& out, __m128i pattern) {
+    for (size_t i = 0; i < sizeof(out.bytes); i += 16)
+        _mm_store_si128((__m128i*) (out.bytes + i), pattern);
+}
+
+void fillSmall(uint8_t* dst, const PatternBuffer& pattern, size_t len) {
+    // Overlapping power of two stores like memset does for short lengths, the overlap is in phase as well
+    uint64_t v8;
+    uint32_t v4;
+    uint16_t v2;
+    if (len >= 8) {
+        memcpy(&v8, pattern.bytes, 8);
+        memcpy(dst, &v8, 8);
+        memcpy(&v8, pattern.bytes + ((len - 8) & 15), 8);
+        memcpy(dst + len - 8, &v8, 8);
+    } else if (len >= 4) {
+        memcpy(&v4, pattern.bytes, 4);
+        memcpy(dst, &v4, 4);
+        memcpy(&v4, pattern.bytes + len - 4, 4);
+        memcpy(dst + len - 4, &v4, 4);
+    } else if (len >= 2) {
+        memcpy(&v2, pattern.bytes, 2);
+        memcpy(dst, &v2, 2);
+        memcpy(&v2, pattern.bytes + len - 2, 2);
+        memcpy(dst + len - 2, &v2, 2);
+    } else if (len == 1) {
+        dst[0] = pattern.bytes[0];
+    }
+}
+
+// All variants store the unaligned head and tail with a vector each and only use aligned stores in between. The
+// pattern period (16) divides every vector size, so the phase of a store only depends on its offset modulo 16.
+
+void fillSse2(uint8_t* dst, const PatternBuffer& pattern, size_t len) {
+    if (len < 16)
+        return fillSmall(dst, pattern, len);
+    auto end = dst + len;
+    _mm_storeu_si128((__m128i*) dst, _mm_load_si128((const __m128i*) pattern.bytes));
+    auto p = (uint8_t*) (((uintptr_t) dst + 16) & ~(uintptr_t) 15);
+    auto v = _mm_loadu_si128((const __m128i*) (pattern.bytes + ((p - dst) & 15)));
+    if (len >= NON_TEMPORAL_THRESHOLD) {
+        for (; p + 16 <= end; p += 16)
+            _mm_stream_si128((__m128i*) p, v);
+        _mm_sfence();
+    } else {
+        for (; p + 64 <= end; p += 64) {
+            _mm_store_si128((__m128i*) p, v);
+            _mm_store_si128((__m128i*) (p + 16), v);
+            _mm_store_si128((__m128i*) (p + 32), v);
+            _mm_store_si128((__m128i*) (p + 48), v);
+        }
+        for (; p + 16 <= end; p += 16)
+            _mm_store_si128((__m128i*) p, v);
+    }
+    _mm_storeu_si128((__m128i*) (end - 16), _mm_loadu_si128((const __m128i*) (pattern.bytes + ((len - 16) & 15))));
+}
+
+__attribute__((target("avx2")))
+void fillAvx2(uint8_t* dst, const PatternBuffer& pattern, size_t len) {
+    if (len < 32)
+        return fillSse2(dst, pattern, len);
+    auto end = dst + len;
+    _mm256_storeu_si256((__m256i*) dst, _mm256_load_si256((const __m256i*) pattern.bytes));
+    auto p = (uint8_t*) (((uintptr_t) dst + 32) & ~(uintptr_t) 31);
+    auto v = _mm256_loadu_si256((const __m256i*) (pattern.bytes + ((p - dst) & 15)));
+    if (len >= NON_TEMPORAL_THRESHOLD) {
+        for (; p + 32 <= end; p += 32)
+            _mm256_stream_si256((__m256i*) p, v);
+        _mm_sfence();
+    } else {
+        for (; p + 128 <= end; p += 128) {
+            _mm256_store_si256((__m256i*) p, v);
+            _mm256_store_si256((__m256i*) (p + 32), v);
+            _mm256_store_si256((__m256i*) (p + 64), v);
+            _mm256_store_si256((__m256i*) (p + 96), v);
+        }
+        for (; p + 32 <= end; p += 32)
+            _mm256_store_si256((__m256i*) p, v);
+    }
+    _mm256_storeu_si256((__m256i*) (end - 32), _mm256_loadu_si256((const __m256i*) (pattern.bytes + ((len - 32) & 15))));
+}
+
+__attribute__((target("avx512f")))
+void fillAvx512(uint8_t* dst, const PatternBuffer& pattern, size_t len) {
+    // Short fills are not worth the 512-bit stores (and the frequency drop they cause on some CPUs)
+    if (len < 256)
+        return fillAvx2(dst, pattern, len);
+    auto end = dst + len;
+    _mm512_storeu_si512(dst, _mm512_load_si512(pattern.bytes));
+    auto p = (uint8_t*) (((uintptr_t) dst + 64) & ~(uintptr_t) 63);
+    auto v = _mm512_loadu_si512(pattern.bytes + ((p - dst) & 15));
+    if (len >= NON_TEMPORAL_THRESHOLD) {
+        for (; p + 64 <= end; p += 64)
+            _mm512_stream_si512((__m512i*) p, v);
+        _mm_sfence();
+    } else {
+        for (; p + 256 <= end; p += 256) {
+            _mm512_store_si512(p, v);
+            _mm512_store_si512(p + 64, v);
+            _mm512_store_si512(p + 128, v);
+            _mm512_store_si512(p + 192, v);
+        }
+        for (; p + 64 <= end; p += 64)
+            _mm512_store_si512(p, v);
+    }
+    _mm512_storeu_si512(end - 64, _mm512_loadu_si512(pattern.bytes + ((len - 64) & 15)));
+}
+
+}
+
+extern "C" {
+
+// Runs while relocating libmacoscompat, before any constructor, hence the explicit __builtin_cpu_init
+static FillFn resolve_memset_pattern_fill() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return fillAvx512;
+    if (__builtin_cpu_supports("avx2"))
+        return fillAvx2;
+    return fillSse2;
+}
+
+static void memset_pattern_fill(uint8_t* dst, const PatternBuffer& pattern, size_t len)
+        __attribute__((ifunc("resolve_memset_pattern_fill")));
+
+void memset_pattern4(void *b, const void *pattern4, size_t len) {
+    PatternBuffer pattern;
+    expandPattern(pattern, _mm_set1_epi32((int) load_unaligned<uint32_t>(pattern4)));
+    memset_pattern_fill((uint8_t*) b, pattern, len);
+}
+
+void memset_pattern8(void *b, const void *pattern8, size_t len) {
+    PatternBuffer pattern;
+    expandPattern(pattern, _mm_set1_epi64x((long long) load_unaligned<uint64_t>(pattern8)));
+    memset_pattern_fill((uint8_t*) b, pattern, len);
+}
+
+void memset_pattern16(void *b, const void *pattern16, size_t len) {
+    PatternBuffer pattern;
+    expandPattern(pattern, _mm_loadu_si128((const __m128i*) pattern16));
+    memset_pattern_fill((uint8_t*) b, pattern, len);
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+
+struct MpscNode {
+    std::atomic<MpscNode*> next {nullptr};
+};
+
+// Intrusive multi-producer single-consumer queue (Vyukov). push is wait-free and never blocks on the consumer. Only one
+// thread may pop at a time; pop returns nullptr when the queue is empty, but also while a producer is between its two
+// stores, so a consumer that knows an item is on its way has to retry.
+class MpscQueue {
+
+    alignas(64) std::atomic<MpscNode*> head; // last pushed node, touched by producers
+    alignas(64) MpscNode* tail; // next node to pop, only touched by the consumer
+    MpscNode stub;
+
+public:
+    MpscQueue() : head(&stub), tail(&stub) {}
+
+    MpscQueue(MpscQueue const&) = delete;
+    MpscQueue& operator=(MpscQueue const&) = delete;
+
+    void push(MpscNode* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    MpscNode* pop() {
+        auto node = tail;
+        auto next = node->next.load(std::memory_order_acquire);
+        if (node == &stub) {
+            if (!next)
+                return nullptr;
+            tail = next;
+            node = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return node;
+        }
+        if (node != head.load(std::memory_order_acquire))
+            return nullptr; // a producer has swapped head but not linked the node yet
+        // node is the last one, put the stub behind it so that it can be handed out
+        push(&stub);
+        next = node->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return node;
+        }
+        return nullptr;
+    }
+
+};
@@ -0,0 +1,64 @@
+#include "os_atomic.h"
+
+// The hottest of these are also in shims_inline.cpp and bound into the image itself with --inline-shims
+
+#define BARRIER_VARIANT(name) decltype(name) name##Barrier __attribute__((alias(#name)));
+#define HOT_FUNCTION(type, name, parameters, result) type name parameters { return result; } BARRIER_VARIANT(name)
+
+extern "C" {
+
+OS_ATOMIC_HOT_FUNCTIONS(HOT_FUNCTION)
+
+int32_t OSAtomicOr32(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_or_fetch(value, mask, __ATOMIC_SEQ_CST);
+}
+int32_t OSAtomicOr32Orig(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_fetch_or(value, mask, __ATOMIC_SEQ_CST);
+}
+int32_t OSAtomicAnd32(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_and_fetch(value, mask, __ATOMIC_SEQ_CST);
+}
+int32_t OSAtomicAnd32Orig(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_fetch_and(value, mask, __ATOMIC_SEQ_CST);
+}
+int32_t OSAtomicXor32(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_xor_fetch(value, mask, __ATOMIC_SEQ_CST);
+}
+int32_t OSAtomicXor32Orig(uint32_t mask, volatile uint32_t* value) {
+    return (int32_t) __atomic_fetch_xor(value, mask, __ATOMIC_SEQ_CST);
+}
+BARRIER_VARIANT(OSAtomicOr32)
+BARRIER_VARIANT(OSAtomicOr32Orig)
+BARRIER_VARIANT(OSAtomicAnd32)
+BARRIER_VARIANT(OSAtomicAnd32Orig)
+BARRIER_VARIANT(OSAtomicXor32)
+BARRIER_VARIANT(OSAtomicXor32Orig)
+
+bool OSAtomicTestAndSet(uint32_t n, volatile void* address) {
+    return os_atomic_test_and_set_impl(n, address, true);
+}
+bool OSAtomicTestAndClear(uint32_t n, volatile void* address) {
+    return os_atomic_test_and_set_impl(n, address, false);
+}
+BARRIER_VARIANT(OSAtomicTestAndSet)
+BARRIER_VARIANT(OSAtomicTestAndClear)
+
+void OSMemoryBarrier() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void OSAtomicEnqueue(OSQueueHead* list, void* element, size_t offset) {
+    os_atomic_enqueue_impl(list, element, offset);
+}
+void* OSAtomicDequeue(OSQueueHead* list, size_t offset) {
+    return os_atomic_dequeue_impl(list, offset);
+}
+
+void OSAtomicFifoEnqueue(OSFifoQueueHead* list, void* element, size_t offset) {
+    os_atomic_fifo_enqueue_impl(list, element, offset);
+}
+void* OSAtomicFifoDequeue(OSFifoQueueHead* list, size_t offset) {
+    return os_atomic_fifo_dequeue_impl(list, offset);
+}
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// The OSAtomic API, shared by libmacoscompat and the in-image copies the converter can place in .compat.text (see
+// shims_inline.cpp), so nothing in here may use data or call into a library. Every locked instruction is a full
+// barrier on x86-64, so the Barrier variants are the same functions; the queues follow the Barrier semantics as well.
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+
+typedef struct {
+    void* opaque1; // first element
+    long opaque2; // generation, bumped by every change so that a dequeue can not succeed against a recycled head
+} __attribute__((aligned(16))) OSQueueHead;
+
+typedef struct {
+    void* opaque1; // first element, the top 16 bits count the changes of the head (see os_fifo_head)
+    void* opaque2; // last element
+    int opaque3; // unused, Darwin keeps a spinlock here
+} __attribute__((aligned(16))) OSFifoQueueHead;
+
+}
+
+// The reference counting and compare-and-swap loops of converted code call these all the time, so they are defined both
+// in libmacoscompat and in shims_inline.cpp, each with its Barrier variant. X(return type, name, parameters, result)
+#define OS_ATOMIC_HOT_FUNCTIONS(X) \
+    X(int32_t, OSAtomicAdd32, (int32_t amount, volatile int32_t* value), os_atomic_add_impl(amount, value)) \
+    X(int32_t, OSAtomicIncrement32, (volatile int32_t* value), os_atomic_add_impl(1, value)) \
+    X(int32_t, OSAtomicDecrement32, (volatile int32_t* value), os_atomic_add_impl(-1, value)) \
+    X(int64_t, OSAtomicAdd64, (int64_t amount, volatile int64_t* value), os_atomic_add_impl(amount, value)) \
+    X(int64_t, OSAtomicIncrement64, (volatile int64_t* value), os_atomic_add_impl((int64_t) 1, value)) \
+    X(int64_t, OSAtomicDecrement64, (volatile int64_t* value), os_atomic_add_impl((int64_t) -1, value)) \
+    X(bool, OSAtomicCompareAndSwap32, (int32_t oldValue, int32_t newValue, volatile int32_t* value), os_atomic_cas_impl(oldValue, newValue, value)) \
+    X(bool, OSAtomicCompareAndSwapInt, (int oldValue, int newValue, volatile int* value), os_atomic_cas_impl(oldValue, newValue, value)) \
+    X(bool, OSAtomicCompareAndSwapLong, (long oldValue, long newValue, volatile long* value), os_atomic_cas_impl(oldValue, newValue, value)) \
+    X(bool, OSAtomicCompareAndSwapPtr, (void* oldValue, void* newValue, void* volatile* value), os_atomic_cas_impl(oldValue, newValue, value)) \
+    X(bool, OSAtomicCompareAndSwap64, (int64_t oldValue, int64_t newValue, volatile int64_t* value), os_atomic_cas_impl(oldValue, newValue, value))
+
+template <typename T>
+static inline T os_atomic_add_impl(T amount, volatile T* value) {
+    return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+}
+
+template <typename T>
+static inline bool os_atomic_cas_impl(T oldValue, T newValue, volatile T* value) {
+    return __atomic_compare_exchange_n(value, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Bit n counts from the most significant bit of the first byte
+static inline bool os_atomic_test_and_set_impl(uint32_t n, volatile void* address, bool set) {
+    auto byte = (volatile uint8_t*) address + (n >> 3);
+    auto mask = (uint8_t) (0x80 >> (n & 7));
+    auto old = set ? __atomic_fetch_or(byte, mask, __ATOMIC_SEQ_CST) : __atomic_fetch_and(byte, (uint8_t) ~mask, __ATOMIC_SEQ_CST);
+    return (old & mask) != 0;
+}
+
+// On failure the expected words are updated to the current contents
+static inline bool os_atomic_cas16(volatile void* address, uint64_t& expectedLow, uint64_t& expectedHigh, uint64_t low, uint64_t high) {
+    bool ret;
+    asm volatile("lock cmpxchg16b %1"
+                 : "=@ccz"(ret), "+m"(*(volatile unsigned __int128*) address), "+a"(expectedLow), "+d"(expectedHigh)
+                 : "b"(low), "c"(high)
+                 : "memory");
+    return ret;
+}
+
+static inline void* volatile* os_queue_link(void* element, size_t offset) {
+    return (void* volatile*) ((char*) element + offset);
+}
+
+// LIFO, a Treiber stack with a generation counter next to the head. As on Darwin, a dequeue may read the link of an
+// element another thread has just dequeued, elements must not be unmapped while the queue is in use.
+static inline void os_atomic_enqueue_impl(OSQueueHead* list, void* element, size_t offset) {
+    auto words = (volatile uint64_t*) list;
+    uint64_t head = words[0];
+    uint64_t generation = words[1];
+    do {
+        *os_queue_link(element, offset) = (void*) head;
+    } while (!os_atomic_cas16(list, head, generation, (uint64_t) element, generation + 1));
+}
+
+static inline void* os_atomic_dequeue_impl(OSQueueHead* list, size_t offset) {
+    auto words = (volatile uint64_t*) list;
+    uint64_t generation = words[1];
+    uint64_t head = words[0];
+    while (head != 0) {
+        auto next = (uint64_t) *os_queue_link((void*) head, offset);
+        if (os_atomic_cas16(list, head, generation, next, generation + 1))
+            return (void*) head;
+    }
+    return nullptr;
+}
+
+// FIFO, a linked list with head and tail in the first 16 bytes. The head word carries a 16-bit change counter above the
+// (47-bit user space) pointer, which protects every compare-and-swap against recycled elements, and as tail changes never
+// touch the head, two equal reads of the head around a read of the tail give a consistent snapshot of both.
+// A producer swaps in the new tail together with an unchanged head, which proves the old tail is still queued, and links
+// it to the new one afterwards. Until then the old tail can not be dequeued, consumers wait for the link.
+
+#define OS_FIFO_POINTER_MASK ((1ull << 48) - 1)
+
+static inline uint64_t os_fifo_head(uint64_t previous, void* first) {
+    return (((previous >> 48) + 1) << 48) | (uint64_t) first;
+}
+
+static inline void os_fifo_snapshot(OSFifoQueueHead* list, uint64_t& head, uint64_t& tail) {
+    auto words = (uint64_t*) list;
+    head = __atomic_load_n(&words[0], __ATOMIC_ACQUIRE);
+    while (true) {
+        tail = __atomic_load_n(&words[1], __ATOMIC_ACQUIRE);
+        auto again = __atomic_load_n(&words[0], __ATOMIC_ACQUIRE);
+        if (again == head)
+            return;
+        head = again;
+    }
+}
+
+static inline void os_atomic_fifo_enqueue_impl(OSFifoQueueHead* list, void* element, size_t offset) {
+    __atomic_store_n((void**) os_queue_link(element, offset), nullptr, __ATOMIC_RELAXED);
+    uint64_t head, tail;
+    os_fifo_snapshot(list, head, tail);
+    while (true) {
+        if (tail == 0) {
+            if (os_atomic_cas16(list, head, tail, os_fifo_head(head, element), (uint64_t) element))
+                return;
+        } else if (os_atomic_cas16(list, head, tail, head, (uint64_t) element)) {
+            __atomic_store_n((void**) os_queue_link((void*) tail, offset), element, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+static inline void* os_atomic_fifo_dequeue_impl(OSFifoQueueHead* list, size_t offset) {
+    uint64_t head, tail;
+    while (true) {
+        os_fifo_snapshot(list, head, tail);
+        auto first = (void*) (head & OS_FIFO_POINTER_MASK);
+        if (!first)
+            return nullptr;
+        if ((uint64_t) first == tail) {
+            if (os_atomic_cas16(list, head, tail, os_fifo_head(head, nullptr), 0))
+                return first;
+            continue;
+        }
+        auto next = __atomic_load_n((void**) os_queue_link(first, offset), __ATOMIC_ACQUIRE);
+        if (!next) {
+            __builtin_ia32_pause(); // a producer has swapped the tail but not linked it yet
+            continue;
+        }
+        // Only the head moves, the tail is further back
+        if (__atomic_compare_exchange_n((uint64_t*) list, &head, os_fifo_head(head, next), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            return first;
+    }
+}
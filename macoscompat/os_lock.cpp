@@ -0,0 +1,197 @@
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// os_unfair_lock and OSSpinLock keep Darwin's 32-bit lock words and are parked on a futex over that word.
+//
+// os_unfair_lock: 0 when unlocked, otherwise the owner's id with the top bit set once somebody sleeps on it. Darwin
+// stores the owner's thread port there; ids here are handed out per thread and only used for the ownership checks.
+// OSSpinLock: 0 when unlocked, -1 when locked (the value Darwin uses) and -2 when locked with sleepers.
+//
+// Taking and releasing an uncontended lock is one compare-and-swap. A contended lock is spun on for a bit first, unless
+// there is only one CPU or others are already asleep on it, in which case the lock holder is not going to be done soon.
+
+namespace {
+
+constexpr uint32_t UnfairLockWaiters = 0x80000000u;
+constexpr int32_t SpinLockLocked = -1;
+constexpr int32_t SpinLockLockedWithWaiters = -2;
+constexpr int MaxSpinPauses = 1024; // total pause instructions before parking, spread over exponentially longer rounds
+
+const bool multipleCpus = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+
+std::atomic<uint32_t> nextOwnerId {1};
+thread_local uint32_t ownerId __attribute__((tls_model("initial-exec"))) = 0;
+
+inline uint32_t current_owner_id() {
+    auto id = ownerId;
+    if (__builtin_expect(id == 0, 0)) {
+        id = nextOwnerId.fetch_add(1, std::memory_order_relaxed) & ~UnfairLockWaiters;
+        if (id == 0)
+            id = nextOwnerId.fetch_add(1, std::memory_order_relaxed) & ~UnfairLockWaiters;
+        ownerId = id;
+    }
+    return id;
+}
+
+void futex_wait(void* addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, expected, nullptr, nullptr, 0);
+}
+
+void futex_wake_one(void* addr) {
+    syscall(SYS_futex, (uint32_t*) addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, nullptr, nullptr, 0);
+}
+
+// Spins until tryAcquire succeeds or spinning stops looking worthwhile; returns whether the lock was taken
+template <typename TryAcquire, typename HasSleepers>
+bool spin(TryAcquire tryAcquire, HasSleepers hasSleepers) {
+    if (!multipleCpus)
+        return false;
+    for (int pauses = 1, total = 0; total < MaxSpinPauses; total += pauses, pauses *= 2) {
+        for (int i = 0; i < pauses; i++)
+            __builtin_ia32_pause();
+        if (tryAcquire())
+            return true;
+        if (hasSleepers())
+            return false;
+    }
+    return false;
+}
+
+[[noreturn]] void lock_abort(const char* message) {
+    fprintf(stderr, "BUG IN CLIENT OF LIBPLATFORM: %s\n", message);
+    abort();
+}
+
+__attribute__((noinline)) void unfair_lock_slow(std::atomic<uint32_t>* lock, uint32_t self) {
+    uint32_t v;
+    bool acquired = spin([&] {
+        v = lock->load(std::memory_order_relaxed);
+        return v == 0 && lock->compare_exchange_strong(v, self, std::memory_order_acquire, std::memory_order_relaxed);
+    }, [&] {
+        return (v & UnfairLockWaiters) != 0;
+    });
+    if (acquired)
+        return;
+
+    v = lock->load(std::memory_order_relaxed);
+    while (true) {
+        if (v == 0) {
+            // Others may still be asleep, so the bit stays set and our unlock wakes the next one
+            if (lock->compare_exchange_weak(v, self | UnfairLockWaiters, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+            continue;
+        }
+        if ((v & ~UnfairLockWaiters) == self)
+            lock_abort("Trying to recursively lock an os_unfair_lock");
+        if (!(v & UnfairLockWaiters) && !lock->compare_exchange_weak(v, v | UnfairLockWaiters, std::memory_order_relaxed))
+            continue;
+        futex_wait(lock, v | UnfairLockWaiters);
+        v = lock->load(std::memory_order_relaxed);
+    }
+}
+
+__attribute__((noinline)) void unfair_unlock_slow(std::atomic<uint32_t>* lock, uint32_t v, uint32_t self) {
+    if ((v & ~UnfairLockWaiters) != self)
+        lock_abort("Unlock of an os_unfair_lock not owned by current thread");
+    lock->store(0, std::memory_order_release);
+    futex_wake_one(lock);
+}
+
+__attribute__((noinline)) void spin_lock_slow(std::atomic<int32_t>* lock) {
+    bool acquired = spin([&] {
+        int32_t expected = 0;
+        return lock->compare_exchange_strong(expected, SpinLockLocked, std::memory_order_acquire, std::memory_order_relaxed);
+    }, [&] {
+        return lock->load(std::memory_order_relaxed) == SpinLockLockedWithWaiters;
+    });
+    if (acquired)
+        return;
+    // Whoever gets the lock from here on marks it as contended, it can't know whether it was the last sleeper
+    while (lock->exchange(SpinLockLockedWithWaiters, std::memory_order_acquire) != 0)
+        futex_wait(lock, (uint32_t) SpinLockLockedWithWaiters);
+}
+
+}
+
+extern "C" {
+
+typedef struct os_unfair_lock_s {
+    uint32_t _os_unfair_lock_opaque;
+} os_unfair_lock, *os_unfair_lock_t;
+
+typedef int32_t OSSpinLock;
+
+static_assert(sizeof(os_unfair_lock) == sizeof(std::atomic<uint32_t>));
+static_assert(sizeof(OSSpinLock) == sizeof(std::atomic<int32_t>));
+
+void os_unfair_lock_lock(os_unfair_lock_t lock) {
+    auto word = reinterpret_cast<std::atomic<uint32_t>*>(&lock->_os_unfair_lock_opaque);
+    auto self = current_owner_id();
+    uint32_t expected = 0;
+    if (__builtin_expect(word->compare_exchange_strong(expected, self, std::memory_order_acquire, std::memory_order_relaxed), 1))
+        return;
+    unfair_lock_slow(word, self);
+}
+
+void os_unfair_lock_lock_with_options(os_unfair_lock_t lock, uint32_t options) {
+    // The options only tune how Darwin's scheduler treats the waiters
+    os_unfair_lock_lock(lock);
+}
+
+bool os_unfair_lock_trylock(os_unfair_lock_t lock) {
+    auto word = reinterpret_cast<std::atomic<uint32_t>*>(&lock->_os_unfair_lock_opaque);
+    uint32_t expected = 0;
+    return word->compare_exchange_strong(expected, current_owner_id(), std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void os_unfair_lock_unlock(os_unfair_lock_t lock) {
+    auto word = reinterpret_cast<std::atomic<uint32_t>*>(&lock->_os_unfair_lock_opaque);
+    auto self = current_owner_id();
+    uint32_t expected = self;
+    if (__builtin_expect(word->compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed), 1))
+        return;
+    unfair_unlock_slow(word, expected, self);
+}
+
+void os_unfair_lock_assert_owner(const os_unfair_lock* lock) {
+    auto word = reinterpret_cast<const std::atomic<uint32_t>*>(&lock->_os_unfair_lock_opaque);
+    if ((word->load(std::memory_order_relaxed) & ~UnfairLockWaiters) != current_owner_id())
+        lock_abort("Assertion failed: Lock unexpectedly not owned by current thread");
+}
+
+void os_unfair_lock_assert_not_owner(const os_unfair_lock* lock) {
+    auto word = reinterpret_cast<const std::atomic<uint32_t>*>(&lock->_os_unfair_lock_opaque);
+    if ((word->load(std::memory_order_relaxed) & ~UnfairLockWaiters) == current_owner_id())
+        lock_abort("Assertion failed: Lock unexpectedly owned by current thread");
+}
+
+void OSSpinLockLock(volatile OSSpinLock* lock) {
+    auto word = reinterpret_cast<std::atomic<int32_t>*>(const_cast<OSSpinLock*>(lock));
+    int32_t expected = 0;
+    if (__builtin_expect(word->compare_exchange_strong(expected, SpinLockLocked, std::memory_order_acquire, std::memory_order_relaxed), 1))
+        return;
+    spin_lock_slow(word);
+}
+
+bool OSSpinLockTry(volatile OSSpinLock* lock) {
+    auto word = reinterpret_cast<std::atomic<int32_t>*>(const_cast<OSSpinLock*>(lock));
+    int32_t expected = 0;
+    return word->compare_exchange_strong(expected, SpinLockLocked, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void OSSpinLockUnlock(volatile OSSpinLock* lock) {
+    auto word = reinterpret_cast<std::atomic<int32_t>*>(const_cast<OSSpinLock*>(lock));
+    int32_t expected = SpinLockLocked;
+    if (__builtin_expect(word->compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed), 1))
+        return;
+    word->store(0, std::memory_order_release);
+    futex_wake_one(word);
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// Argument translation shared by the shims in libmacoscompat and the in-image copies the converter can place in
+// .compat.text (see shims_inline.cpp), which must not depend on anything but libc.
+
+#include <cstdint>
+#include <fcntl.h>
+#include <signal.h>
+
+extern "C" {
+
+typedef uint32_t darwin_sigset_t;
+
+struct darwin_sigaction {
+    void (*sa_handler_)(int);
+    darwin_sigset_t sa_mask;
+    int sa_flags;
+};
+
+}
+
+static inline int darwin_oflag_to_host(int oflag) {
+    int host_oflag = 0;
+
+    if (oflag & 1) host_oflag |= O_WRONLY;
+    if (oflag & 2) host_oflag |= O_RDWR;
+    if (oflag & 4) host_oflag |= O_NONBLOCK;
+    if (oflag & 8) host_oflag |= O_APPEND;
+//    if (oflag & 0x10) host_oflag |= O_SHLOCK;
+//    if (oflag & 0x20) host_oflag |= O_EXLOCK;
+    if (oflag & 0x40) host_oflag |= O_ASYNC;
+    if (oflag & 0x80) host_oflag |= O_SYNC;
+    if (oflag & 0x100) host_oflag |= O_NOFOLLOW;
+    if (oflag & 0x200) host_oflag |= O_CREAT;
+    if (oflag & 0x400) host_oflag |= O_TRUNC;
+    if (oflag & 0x800) host_oflag |= O_EXCL;
+
+    return host_oflag;
+}
+
+static inline int darwin_sa_flags_to_host(int flags) {
+    int host = 0;
+    if (flags & 1) host |= SA_ONSTACK;
+    if (flags & 2) host |= SA_RESTART;
+    if (flags & 4) host |= SA_RESETHAND;
+    if (flags & 8) host |= SA_NOCLDSTOP;
+    if (flags & 0x10) host |= SA_NODEFER;
+    if (flags & 0x20) host |= SA_NOCLDWAIT;
+    if (flags & 0x40) host |= SA_SIGINFO;
+//    if (flags & 0x100) host |= SA_USERTRAMP;
+//    if (flags & 0x200) host |= SA_64REGSET;
+    return host;
+}
+static inline int darwin_sa_flags_from_host(int host) {
+    int flags = 0;
+    if (host & SA_ONSTACK) flags |= 1;
+    if (host & SA_RESTART) flags |= 2;
+    if (host & SA_RESETHAND) flags |= 4;
+    if (host & SA_NOCLDSTOP) flags |= 8;
+    if (host & SA_NODEFER) flags |= 0x10;
+    if (host & SA_NOCLDWAIT) flags |= 0x20;
+    if (host & SA_SIGINFO) flags |= 0x40;
+//    if (host & SA_USERTRAMP) flags |= 0x100;
+//    if (host & SA_64REGSET) flags |= 0x200;
+    return flags;
+}
+
+static inline int darwin_open_impl(const char *file, int oflag, mode_t mode) {
+    return open(file, darwin_oflag_to_host(oflag), mode);
+}
+
+static inline int darwin_sigaction_impl(int sig, const struct darwin_sigaction* action, struct darwin_sigaction* original) {
+    struct sigaction host_action {};
+    struct sigaction host_original {};
+
+    host_action.sa_handler = action->sa_handler_;
+    host_action.sa_mask.__val[0] = action->sa_mask;
+    host_action.sa_flags = darwin_sa_flags_to_host(action->sa_flags);
+
+    int ret = sigaction(sig, &host_action, &host_original);
+    if (ret)
+        return ret;
+
+    if (original) {
+        original->sa_handler_ = host_original.sa_handler;
+        original->sa_mask = host_original.sa_mask.__val[0];
+        original->sa_flags = darwin_sa_flags_from_host(host_original.sa_flags);
+    }
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+// Copies of pure argument translation and atomic shims that the converter places in .compat.text of the converted
+// image when run with --inline-shims, so calls to them do not go through libmacoscompat. This is linked in as raw code
+// (see embed_gen): no data, no static constructors, no unwind tables, and libc is only reached through GOT slots.
+
+#include "os_atomic.h"
+#include "shim_translation.h"
+
+#define SHIM __attribute__((visibility("default")))
+#define BARRIER_VARIANT(name) SHIM decltype(name) name##Barrier __attribute__((alias(#name)));
+#define HOT_FUNCTION(type, name, parameters, result) SHIM type name parameters { return result; } BARRIER_VARIANT(name)
+
+extern "C" {
+
+SHIM int darwin_open(const char *file, int oflag, mode_t mode) {
+    return darwin_open_impl(file, oflag, mode);
+}
+
+SHIM int darwin_sigaction(int sig, const struct darwin_sigaction* action, struct darwin_sigaction* original) {
+    return darwin_sigaction_impl(sig, action, original);
+}
+
+// The hot OSAtomic functions (see os_atomic.h), the remaining ones stay in libmacoscompat
+OS_ATOMIC_HOT_FUNCTIONS(HOT_FUNCTION)
+
+SHIM void OSMemoryBarrier() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+}
@@ -0,0 +1,212 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <dlfcn.h>
+#include <link.h>
+
+// Emitted by the converter (--compact-unwind-index), keep in sync with converter/converter.cpp
+#define PT_COMPAT_UNWIND_INFO 0x6d326501
+
+#define UNWIND_X86_64_MODE_MASK 0x0F000000
+#define UNWIND_X86_64_MODE_DWARF 0x04000000
+#define UNWIND_X86_64_DWARF_SECTION_OFFSET 0x00FFFFFF
+#define UNWIND_SECOND_LEVEL_REGULAR 2
+
+struct compat_unwind_info_header {
+    uint32_t version;
+    uint32_t unwindInfoSize;
+    uint64_t imageBase;
+    uint64_t ehFrameAddress;
+};
+
+struct unwind_info_section_header {
+    uint32_t version;
+    uint32_t commonEncodingsArraySectionOffset;
+    uint32_t commonEncodingsArrayCount;
+    uint32_t personalityArraySectionOffset;
+    uint32_t personalityArrayCount;
+    uint32_t indexSectionOffset;
+    uint32_t indexCount;
+};
+
+struct unwind_info_section_header_index_entry {
+    uint32_t functionOffset;
+    uint32_t secondLevelPagesSectionOffset;
+    uint32_t lsdaIndexArraySectionOffset;
+};
+
+struct unwind_info_regular_second_level_entry {
+    uint32_t functionOffset;
+    uint32_t encoding;
+};
+
+struct unwind_info_regular_second_level_page_header {
+    uint32_t kind;
+    uint16_t entryPageOffset;
+    uint16_t entryCount;
+};
+
+struct dwarf_eh_bases {
+    void* tbase;
+    void* dbase;
+    void* func;
+};
+
+namespace {
+
+// Every loaded object with executable code, so that a pc outside all of them is the only reason to rescan. Objects
+// without the converter's table are kept with a null unwindInfo and go to the system implementation.
+struct UnwindImage {
+    uintptr_t start, end;
+    uintptr_t base;
+    const uint8_t* unwindInfo;
+    const uint8_t* ehFrame;
+};
+
+std::shared_mutex imagesMutex;
+std::vector<UnwindImage> images;
+unsigned long long imagesAdds = (unsigned long long) -1, imagesSubs = (unsigned long long) -1;
+
+using FindFdeFn = const void* (*)(void* pc, dwarf_eh_bases* bases);
+
+int collectImage(struct dl_phdr_info* info, size_t size, void* data) {
+    auto& ret = *(std::vector<UnwindImage>*) data;
+    const ElfW(Phdr)* tablePhdr = nullptr;
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        auto& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_COMPAT_UNWIND_INFO)
+            tablePhdr = &phdr;
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+            start = std::min<uintptr_t>(start, info->dlpi_addr + phdr.p_vaddr);
+            end = std::max<uintptr_t>(end, info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+        }
+    }
+    if (start >= end)
+        return 0;
+
+    auto hdr = tablePhdr ? (const compat_unwind_info_header*) (info->dlpi_addr + tablePhdr->p_vaddr) : nullptr;
+    if (hdr == nullptr || hdr->version != 1) {
+        ret.push_back({start, end, 0, nullptr, nullptr});
+        return 0;
+    }
+    ret.push_back({start, end, (uintptr_t) (info->dlpi_addr + hdr->imageBase), (const uint8_t*) (hdr + 1),
+                   (const uint8_t*) (info->dlpi_addr + hdr->ehFrameAddress)});
+    return 0;
+}
+
+int readLoadCounters(struct dl_phdr_info* info, size_t size, void* data) {
+    auto counters = (unsigned long long*) data;
+    counters[0] = info->dlpi_adds;
+    counters[1] = info->dlpi_subs;
+    return 1;
+}
+
+// Requires imagesMutex
+bool imagesCurrent(unsigned long long const (&counters)[2]) {
+    return counters[0] == imagesAdds && counters[1] == imagesSubs;
+}
+
+// Rebuilds the image list if anything was loaded or unloaded since the last scan, returns whether it did
+bool refreshImages() {
+    unsigned long long counters[2];
+    dl_iterate_phdr(readLoadCounters, counters);
+    {
+        std::shared_lock lock (imagesMutex);
+        if (imagesCurrent(counters))
+            return false;
+    }
+
+    std::vector<UnwindImage> newImages;
+    dl_iterate_phdr(collectImage, &newImages);
+    std::sort(newImages.begin(), newImages.end(), [](auto const& a, auto const& b) { return a.start < b.start; });
+
+    std::unique_lock lock (imagesMutex);
+    images = std::move(newImages);
+    imagesAdds = counters[0];
+    imagesSubs = counters[1];
+    return true;
+}
+
+const UnwindImage* findImage(uintptr_t pc) {
+    auto it = std::upper_bound(images.begin(), images.end(), pc, [](uintptr_t pc, auto const& img) { return pc < img.start; });
+    if (it == images.begin())
+        return nullptr;
+    --it;
+    return pc < it->end ? &*it : nullptr;
+}
+
+const void* findFdeInImage(UnwindImage const& img, uintptr_t pc, dwarf_eh_bases* bases) {
+    if (pc < img.base || pc - img.base > UINT32_MAX)
+        return nullptr;
+    auto target = (uint32_t) (pc - img.base);
+
+    auto hdr = (const unwind_info_section_header*) img.unwindInfo;
+    if (hdr->indexCount < 2)
+        return nullptr;
+    auto index = (const unwind_info_section_header_index_entry*) (img.unwindInfo + hdr->indexSectionOffset);
+    auto pageCount = hdr->indexCount - 1; // the last entry is a sentinel marking the end of the table
+    if (target < index[0].functionOffset || target >= index[pageCount].functionOffset)
+        return nullptr;
+    auto page = std::upper_bound(index, index + pageCount, target, [](uint32_t t, auto const& e) { return t < e.functionOffset; }) - 1;
+
+    auto pageHdr = (const unwind_info_regular_second_level_page_header*) (img.unwindInfo + page->secondLevelPagesSectionOffset);
+    if (pageHdr->kind != UNWIND_SECOND_LEVEL_REGULAR || pageHdr->entryCount == 0)
+        return nullptr;
+    auto entries = (const unwind_info_regular_second_level_entry*) ((const uint8_t*) pageHdr + pageHdr->entryPageOffset);
+    auto entry = std::upper_bound(entries, entries + pageHdr->entryCount, target, [](uint32_t t, auto const& e) { return t < e.functionOffset; });
+    if (entry == entries)
+        return nullptr;
+    --entry;
+
+    if ((entry->encoding & UNWIND_X86_64_MODE_MASK) != UNWIND_X86_64_MODE_DWARF)
+        return nullptr;
+    bases->tbase = nullptr;
+    bases->dbase = nullptr;
+    bases->func = (void*) (img.base + entry->functionOffset);
+    return img.ehFrame + (entry->encoding & UNWIND_X86_64_DWARF_SECTION_OFFSET);
+}
+
+}
+
+extern "C" {
+
+// Interposes libgcc's lookup so frames of converted images are resolved through the two-level table the converter
+// emitted instead of a dl_iterate_phdr walk + .eh_frame_hdr search. Anything else goes to the real implementation.
+// The objects are fully rescanned only for a pc that none of them contains, which means something was loaded since,
+// or when a converted image is hit after objects were loaded or unloaded, as its range may now belong to another one.
+const void* _Unwind_Find_FDE(void* pc, dwarf_eh_bases* bases) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        {
+            std::shared_lock lock (imagesMutex);
+            auto img = findImage((uintptr_t) pc);
+            if (img && !img->unwindInfo)
+                break;
+            if (img) {
+                unsigned long long counters[2];
+                dl_iterate_phdr(readLoadCounters, counters);
+                if (imagesCurrent(counters)) {
+                    auto ret = findFdeInImage(*img, (uintptr_t) pc, bases);
+                    if (ret)
+                        return ret;
+                    break;
+                }
+            }
+        }
+        if (!refreshImages())
+            break;
+    }
+
+    static auto realFindFde = (FindFdeFn) dlsym(RTLD_NEXT, "_Unwind_Find_FDE");
+    if (!realFindFde) {
+        fprintf(stderr, "_Unwind_Find_FDE: failed to find the system implementation\n");
+        abort();
+    }
+    return realFindFde(pc, bases);
+}
+
+}
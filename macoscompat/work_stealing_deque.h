@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Chase-Lev work-stealing deque with a fixed capacity (the C11 formulation of Lê et al.). The owning thread pushes and
+// pops at the bottom, any other thread may steal from the top. A full deque refuses the push instead of growing, which
+// keeps stealing free of buffer reclamation; the caller has somewhere else to put the item.
+template <typename T, std::size_t Capacity>
+class WorkStealingDeque {
+
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    alignas(64) std::atomic<int64_t> top {0};
+    alignas(64) std::atomic<int64_t> bottom {0};
+    std::atomic<T*> buffer[Capacity] {};
+
+public:
+    bool push(T* item) {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        if (b - t >= (int64_t) Capacity)
+            return false;
+        buffer[b & (Capacity - 1)].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    T* pop() {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto item = buffer[b & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    T* steal() {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        auto item = buffer[t & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr; // lost against the owner or another thief
+        return item;
+    }
+
+};